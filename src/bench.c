@@ -0,0 +1,1275 @@
+// bench.c
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "config.h"
+#include "status.h"
+#include "utils.h"
+#include "shell/shell.h"
+#include "memory/memory.h"
+#include "memory/slab.h"
+#include "memory/page.h"
+#include "memory/zpool.h"
+#include "memory/frame.h"
+#include "memory/mmap.h"
+#include "ssd/ata.h"
+#include "ssd/block.h"
+#include "ssd/bcache.h"
+#include "ssd/blkq.h"
+#include "ssd/virtio_blk.h"
+#include "ssd/ahci.h"
+#include "ssd/ramdisk.h"
+#include "idt/isr.h"
+#include "idt/irq.h"
+#include "idt/timer.h"
+#include "fs/file.h"
+#include "fs/fat/fat.h"
+
+static uint32_t bench_seed = 0x1234567;
+
+static uint32_t bench_rand() {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 16) & 0x7FFF;
+}
+
+void bench_report(const char* name, uint64_t cycles, uint32_t ops) {
+    print_serial("  ");
+    print_serial(name);
+    print_serial(": ");
+    kputdec((uint32_t)udiv64(cycles, ops ? ops : 1));
+    print_serial(" cycles/op\n");
+}
+
+// ---------------------------------------------------------------------------
+// Heap block allocator: indexed free bitmap vs the original linear scan
+// ---------------------------------------------------------------------------
+#define BENCH_HEAP_OPS 256
+
+static struct heap bench_heap_state;
+static struct heap_table bench_heap_table;
+static HEAP_BLOCK_TABLE_ENTRY bench_heap_entries[HEAP_MAX_BLOCKS];
+static void* bench_heap_ptrs[HEAP_MAX_BLOCKS];
+
+// The first-fit scan heap_get_start_block used before the free index existed
+static int bench_heap_linear_start_block(struct heap_table* table, uint32_t total_blocks) {
+    uint32_t bc = 0;
+    int bs = -1;
+    for (size_t i = 0; i < table->total; i++) {
+        if ((table->entries[i] & 0x0f) != HEAP_BLOCK_TABLE_ENTRY_FREE) {
+            bc = 0;
+            bs = -1;
+            continue;
+        }
+        if (bs == -1) {
+            bs = i;
+        }
+        bc++;
+        if (bc == total_blocks) {
+            return bs;
+        }
+    }
+    return -ENOMEM;
+}
+
+static void bench_heap_linear_mark(struct heap_table* table, int start, uint32_t total, HEAP_BLOCK_TABLE_ENTRY val) {
+    for (uint32_t i = 0; i < total; i++) {
+        table->entries[start + i] = val;
+    }
+}
+
+static void bench_heap_at_occupancy(uint32_t percent) {
+    // The pool is never dereferenced, so any block aligned base will do
+    void* base = (void*)KERNEL_HEAP_START_VIRTUAL_ADDRESS;
+    void* end = base + HEAP_MAX_BLOCKS * RZOS_HEAP_BLOCK_SIZE;
+    bench_heap_table.entries = bench_heap_entries;
+    bench_heap_table.total = HEAP_MAX_BLOCKS;
+    if (heap_create(&bench_heap_state, base, end, &bench_heap_table) < 0) {
+        print_serial("  heap_create failed\n");
+        return;
+    }
+
+    // Fill the heap one block at a time, then punch random holes until only
+    // 'percent' of it is still in use
+    for (uint32_t i = 0; i < HEAP_MAX_BLOCKS; i++) {
+        bench_heap_ptrs[i] = heap_malloc(&bench_heap_state, RZOS_HEAP_BLOCK_SIZE);
+    }
+    uint32_t keep = (HEAP_MAX_BLOCKS / 100) * percent;
+    uint32_t used = HEAP_MAX_BLOCKS;
+    while (used > keep) {
+        uint32_t i = (bench_rand() * 32768 + bench_rand()) % HEAP_MAX_BLOCKS;
+        if (bench_heap_ptrs[i]) {
+            heap_free(&bench_heap_state, bench_heap_ptrs[i]);
+            bench_heap_ptrs[i] = 0;
+            used--;
+        }
+    }
+
+    print_serial("occupancy ");
+    kputdec(percent);
+    print_serial("%\n");
+
+    uint64_t indexed = 0;
+    uint64_t linear = 0;
+    uint32_t ops = 0;
+    for (int i = 0; i < BENCH_HEAP_OPS; i++) {
+        uint32_t size = (1 + bench_rand() % 4) * RZOS_HEAP_BLOCK_SIZE;
+        uint32_t blocks = size / RZOS_HEAP_BLOCK_SIZE;
+
+        uint64_t t0 = rdtsc();
+        void* p = heap_malloc(&bench_heap_state, size);
+        if (p) {
+            heap_free(&bench_heap_state, p);
+        }
+        uint64_t t1 = rdtsc();
+        int start = bench_heap_linear_start_block(&bench_heap_table, blocks);
+        if (start >= 0) {
+            bench_heap_linear_mark(&bench_heap_table, start, blocks, HEAP_BLOCK_TABLE_ENTRY_TAKEN);
+            bench_heap_linear_mark(&bench_heap_table, start, blocks, HEAP_BLOCK_TABLE_ENTRY_FREE);
+        }
+        uint64_t t2 = rdtsc();
+
+        indexed += t1 - t0;
+        linear += t2 - t1;
+        ops++;
+    }
+    bench_report("indexed alloc+free", indexed, ops);
+    bench_report("linear  alloc+free", linear, ops);
+}
+
+void bench_heap() {
+    print_serial("[bench] heap block allocator\n");
+    bench_heap_at_occupancy(10);
+    bench_heap_at_occupancy(50);
+    bench_heap_at_occupancy(90);
+}
+
+// ---------------------------------------------------------------------------
+// Small object allocation: slab caches vs one heap block per object
+// ---------------------------------------------------------------------------
+#define BENCH_SLAB_OBJECTS 128
+
+static void* bench_slab_ptrs[BENCH_SLAB_OBJECTS];
+
+void bench_slab() {
+    extern struct heap kernel_heap;
+    print_serial("[bench] slab allocator\n");
+
+    for (uint32_t size = SLAB_MIN_SIZE; size <= SLAB_MAX_SIZE; size <<= 2) {
+        print_serial("object size ");
+        kputdec(size);
+        print_serial("\n");
+
+        uint64_t t0 = rdtsc();
+        for (int i = 0; i < BENCH_SLAB_OBJECTS; i++) {
+            bench_slab_ptrs[i] = kmalloc(size);
+        }
+        for (int i = 0; i < BENCH_SLAB_OBJECTS; i++) {
+            kfree(bench_slab_ptrs[i]);
+        }
+        uint64_t t1 = rdtsc();
+        for (int i = 0; i < BENCH_SLAB_OBJECTS; i++) {
+            bench_slab_ptrs[i] = heap_malloc(&kernel_heap, size);
+        }
+        for (int i = 0; i < BENCH_SLAB_OBJECTS; i++) {
+            heap_free(&kernel_heap, bench_slab_ptrs[i]);
+        }
+        uint64_t t2 = rdtsc();
+
+        bench_report("slab alloc+free", t1 - t0, BENCH_SLAB_OBJECTS);
+        bench_report("heap alloc+free", t2 - t1, BENCH_SLAB_OBJECTS);
+    }
+    slab_print_stats();
+}
+
+// ---------------------------------------------------------------------------
+// Kernel translations after an address space switch, with and without CR4.PGE
+// ---------------------------------------------------------------------------
+#define BENCH_TLB_PAGES 64
+#define BENCH_TLB_ROUNDS 64
+
+static uint64_t bench_tlb_round(struct paging_chunk_4gb* a, struct paging_chunk_4gb* b) {
+    uint64_t cycles = 0;
+    for (int round = 0; round < BENCH_TLB_ROUNDS; round++) {
+        paging_switch(get_dir_chunk4gb((round & 1) ? a : b));
+
+        // The kernel image and stack live in the 4KiB identity mapped region
+        uint64_t t0 = rdtsc();
+        for (int i = 0; i < BENCH_TLB_PAGES; i++) {
+            volatile uint32_t* p = (volatile uint32_t*)(0x100000 + i * PAGE_SIZE);
+            (void)*p;
+        }
+        cycles += rdtsc() - t0;
+    }
+    return cycles;
+}
+
+void bench_tlb() {
+    print_serial("[bench] TLB cost of paging_switch\n");
+    struct paging_chunk_4gb* kernel = paging_kernel_chunk();
+    struct paging_chunk_4gb* other = paging_chunk(PAGE_PRESENT | PAGE_RW);
+    if (!other) {
+        print_serial("  paging_chunk failed\n");
+        return;
+    }
+
+    paging_set_global(false);
+    uint64_t local = bench_tlb_round(kernel, other);
+    paging_set_global(true);
+    paging_flush_tlb_global();
+    uint64_t global = bench_tlb_round(kernel, other);
+
+    paging_switch(get_dir_chunk4gb(kernel));
+    paging_chunk_free(other);
+
+    bench_report("touch 64 kernel pages after switch, non-global", local, BENCH_TLB_ROUNDS);
+    bench_report("touch 64 kernel pages after switch, global", global, BENCH_TLB_ROUNDS);
+}
+
+// ---------------------------------------------------------------------------
+// Demand-zero faults on a sparse kernel reservation
+// ---------------------------------------------------------------------------
+// Above the direct map, nothing else lives here
+#define BENCH_VM_ADDRESS 0xE0000000
+#define BENCH_VM_SIZE (16 * 1024 * 1024)
+#define BENCH_VM_STRIDE (16 * PAGE_SIZE)
+
+void bench_vm() {
+    print_serial("[bench] demand-zero paging\n");
+    struct paging_chunk_4gb* kernel = paging_kernel_chunk();
+    if (vm_reserve(kernel, (void*)BENCH_VM_ADDRESS, BENCH_VM_SIZE, PAGE_RW) < 0) {
+        print_serial("  vm_reserve failed\n");
+        return;
+    }
+
+    uint32_t touched = 0;
+    uint64_t t0 = rdtsc();
+    for (uint32_t offset = 0; offset < BENCH_VM_SIZE; offset += BENCH_VM_STRIDE) {
+        volatile uint32_t* p = (volatile uint32_t*)(BENCH_VM_ADDRESS + offset);
+        *p = offset;
+        touched++;
+    }
+    uint64_t t1 = rdtsc();
+    for (uint32_t offset = 0; offset < BENCH_VM_SIZE; offset += BENCH_VM_STRIDE) {
+        volatile uint32_t* p = (volatile uint32_t*)(BENCH_VM_ADDRESS + offset);
+        *p = offset;
+    }
+    uint64_t t2 = rdtsc();
+
+    bench_report("first touch (fault + zero + map)", t1 - t0, touched);
+    bench_report("second touch", t2 - t1, touched);
+    vm_print_stats();
+    vm_release(kernel, (void*)BENCH_VM_ADDRESS);
+}
+
+// ---------------------------------------------------------------------------
+// memset/memcpy/memcmp: correctness over sizes and alignments, then throughput
+// ---------------------------------------------------------------------------
+#define BENCH_MEMORY_MAX (1024 * 1024)
+#define BENCH_MEMORY_SLACK 32
+
+static uint8_t* bench_memory_src;
+static uint8_t* bench_memory_dst;
+
+static bool bench_memory_check(uint32_t size, uint32_t src_align, uint32_t dst_align) {
+    uint8_t* src = bench_memory_src + src_align;
+    uint8_t* dst = bench_memory_dst + dst_align;
+
+    for (uint32_t i = 0; i < size; i++) {
+        src[i] = (uint8_t)(i * 7 + size);
+    }
+    // Guard bytes on both sides of the destination
+    dst[-1] = 0xA5;
+    dst[size] = 0xA5;
+
+    memcpy(dst, src, size);
+    for (uint32_t i = 0; i < size; i++) {
+        if (dst[i] != src[i]) {
+            return false;
+        }
+    }
+    if (memcmp(dst, src, size) != 0) {
+        return false;
+    }
+    dst[size - 1] ^= 0x80;
+    if (memcmp(dst, src, size) == 0) {
+        return false;
+    }
+
+    memset(dst, 0x3C, size);
+    for (uint32_t i = 0; i < size; i++) {
+        if (dst[i] != 0x3C) {
+            return false;
+        }
+    }
+    return dst[-1] == 0xA5 && dst[size] == 0xA5;
+}
+
+static uint32_t bench_memory_next_size(uint32_t size) {
+    // Every size up to 256, then powers of two and their odd neighbours
+    if (size < 256) {
+        return size + 1;
+    }
+    if ((size & (size - 1)) == 0) {
+        return size + 3;
+    }
+    uint32_t pow = 1;
+    while (pow <= size) {
+        pow <<= 1;
+    }
+    return pow;
+}
+
+static void bench_memory_throughput(uint32_t size, uint32_t align) {
+    uint8_t* src = bench_memory_src + align;
+    uint8_t* dst = bench_memory_dst;
+    uint32_t rounds = (BENCH_MEMORY_MAX / size) < 64 ? 4 : 64;
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        memcpy(dst, src, size);
+    }
+    uint64_t t1 = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < size; i++) {
+            dst[i] = src[i];
+        }
+    }
+    uint64_t t2 = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        memset(dst, r, size);
+    }
+    uint64_t t3 = rdtsc();
+
+    print_serial("size ");
+    kputdec(size);
+    print_serial(" src align ");
+    kputdec(align);
+    print_serial(" (cycles per KiB)\n");
+    uint32_t kib = (size * rounds + 1023) / 1024;
+    bench_report("memcpy", t1 - t0, kib);
+    bench_report("byte loop copy", t2 - t1, kib);
+    bench_report("memset", t3 - t2, kib);
+}
+
+void bench_memory() {
+    print_serial("[bench] memset/memcpy/memcmp\n");
+    bench_memory_src = kmalloc(BENCH_MEMORY_MAX + BENCH_MEMORY_SLACK);
+    bench_memory_dst = kmalloc(BENCH_MEMORY_MAX + BENCH_MEMORY_SLACK);
+    if (!bench_memory_src || !bench_memory_dst) {
+        print_serial("  out of memory\n");
+        return;
+    }
+
+    uint32_t checked = 0;
+    uint32_t failed = 0;
+    for (uint32_t size = 1; size <= BENCH_MEMORY_MAX; size = bench_memory_next_size(size)) {
+        // Every pair of 16 byte alignments for small sizes, matching and
+        // mismatching pairs for the big ones to keep the run short
+        for (uint32_t sa = 0; sa < 16; sa++) {
+            for (uint32_t da = 1; da < 17; da++) {
+                if (size > 4096 && da != sa + 1 && da != ((sa + 5) & 15) + 1) {
+                    continue;
+                }
+                checked++;
+                if (!bench_memory_check(size, sa, da)) {
+                    failed++;
+                }
+            }
+        }
+    }
+    print_serial("  correctness: ");
+    kputdec(checked - failed);
+    print_serial("/");
+    kputdec(checked);
+    print_serial(" cases passed\n");
+
+    bench_memory_throughput(64, 0);
+    bench_memory_throughput(4096, 0);
+    bench_memory_throughput(4096, 3);
+    bench_memory_throughput(65536, 0);
+    bench_memory_throughput(BENCH_MEMORY_MAX, 0);
+    bench_memory_throughput(BENCH_MEMORY_MAX, 1);
+
+    kfree(bench_memory_src);
+    kfree(bench_memory_dst);
+}
+
+// ---------------------------------------------------------------------------
+// kzalloc of whole pages with a full and an empty zero pool
+// ---------------------------------------------------------------------------
+#define BENCH_ZPOOL_PAGES 32
+
+static void* bench_zpool_ptrs[BENCH_ZPOOL_PAGES];
+
+static uint64_t bench_zpool_round() {
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_ZPOOL_PAGES; i++) {
+        bench_zpool_ptrs[i] = kzalloc(PAGE_SIZE);
+    }
+    uint64_t cycles = rdtsc() - t0;
+    for (int i = 0; i < BENCH_ZPOOL_PAGES; i++) {
+        kfree(bench_zpool_ptrs[i]);
+    }
+    return cycles;
+}
+
+void bench_zpool() {
+    print_serial("[bench] pre-zeroed page pool\n");
+    // Hand whatever the pool holds back to the frame allocator
+    uintptr_t page;
+    while ((page = zpool_take_page())) {
+        frame_free(page, 0);
+    }
+    uint64_t cold = bench_zpool_round();
+    zpool_refill(BENCH_ZPOOL_PAGES);
+    uint64_t warm = bench_zpool_round();
+
+    bench_report("kzalloc(PAGE_SIZE), empty pool", cold, BENCH_ZPOOL_PAGES);
+    bench_report("kzalloc(PAGE_SIZE), filled pool", warm, BENCH_ZPOOL_PAGES);
+    zpool_print_stats();
+}
+
+#define BENCH_KREALLOC_STEPS 64
+
+// Grow a buffer one block at a time, the way a log or array would, and
+// compare against doing the same with kmalloc + memcpy + kfree.
+void bench_krealloc() {
+    print_serial("[bench] krealloc growth\n");
+    uint32_t step = RZOS_HEAP_BLOCK_SIZE;
+
+    char* buf = NULL;
+    uint64_t t0 = rdtsc();
+    for (int i = 1; i <= BENCH_KREALLOC_STEPS; i++) {
+        char* next = krealloc(buf, i * step);
+        if (!next) {
+            break;
+        }
+        buf = next;
+    }
+    uint64_t in_place = rdtsc() - t0;
+    kfree(buf);
+
+    buf = NULL;
+    t0 = rdtsc();
+    for (int i = 1; i <= BENCH_KREALLOC_STEPS; i++) {
+        char* next = kmalloc(i * step);
+        if (!next) {
+            break;
+        }
+        if (buf) {
+            memcpy(next, buf, (i - 1) * step);
+            kfree(buf);
+        }
+        buf = next;
+    }
+    uint64_t copied = rdtsc() - t0;
+    kfree(buf);
+
+    bench_report("krealloc grow by one block", in_place, BENCH_KREALLOC_STEPS);
+    bench_report("kmalloc+memcpy+kfree grow", copied, BENCH_KREALLOC_STEPS);
+    krealloc_print_stats();
+}
+
+#define BENCH_ATA_SECTORS 64
+#define BENCH_ATA_ROUNDS ((1024 * 1024) / (BENCH_ATA_SECTORS * RZOS_SECTOR_SIZE))
+
+// CPU time burned per MiB read. Polling keeps the CPU busy for the whole
+// transfer, in interrupt mode only the handler and submission count, the
+// time spent halted is free for other work.
+void bench_ata() {
+    print_serial("[bench] ATA read, polled vs IRQ14\n");
+    void* buf = kmalloc(BENCH_ATA_SECTORS * RZOS_SECTOR_SIZE);
+    if (!buf) {
+        return;
+    }
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_ATA_ROUNDS; i++) {
+        if (ata_read_polled(0, BENCH_ATA_SECTORS, buf) < 0) {
+            print_serial("  polled read failed\n");
+            break;
+        }
+    }
+    uint64_t polled = rdtsc() - t0;
+
+    uint64_t irq_before = ata_stats.irq_cycles;
+    uint64_t wait_before = ata_stats.wait_cycles;
+    t0 = rdtsc();
+    for (int i = 0; i < BENCH_ATA_ROUNDS; i++) {
+        if (ata_read(0, BENCH_ATA_SECTORS, buf) < 0) {
+            print_serial("  interrupt read failed\n");
+            break;
+        }
+    }
+    uint64_t wall = rdtsc() - t0;
+    uint64_t waited = ata_stats.wait_cycles - wait_before;
+    uint64_t busy = wall - waited + (ata_stats.irq_cycles - irq_before);
+
+    bench_report("polled, CPU cycles per MiB", polled, 1);
+    bench_report("IRQ14, CPU cycles per MiB", busy, 1);
+    bench_report("IRQ14, wall cycles per MiB", wall, 1);
+    ata_print_stats();
+    kfree(buf);
+}
+
+static void bench_report_rate(const char* name, uint32_t bytes, uint64_t cycles) {
+    uint64_t us = tsc_cycles_to_us(cycles);
+    uint32_t kib_per_s = (uint32_t)udiv64((uint64_t)(bytes / 1024) * 1000000, us ? us : 1);
+    print_serial("  ");
+    print_serial(name);
+    print_serial(": ");
+    kputdec(kib_per_s / 1024);
+    print_serial(".");
+    kputdec(((kib_per_s % 1024) * 10) / 1024);
+    print_serial(" MiB/s\n");
+}
+
+#define BENCH_DISK_TOTAL (1024 * 1024)
+
+// Reads BENCH_DISK_TOTAL bytes in requests of the given size, the driver
+// splits each request into commands
+static uint64_t bench_disk_round(char* buf, uint32_t request_bytes) {
+    uint32_t sectors = request_bytes / RZOS_SECTOR_SIZE;
+    uint64_t t0 = rdtsc();
+    for (uint32_t done = 0; done < BENCH_DISK_TOTAL; done += request_bytes) {
+        if (ata_read(0, sectors, buf) < 0) {
+            print_serial("  read failed\n");
+            break;
+        }
+    }
+    return rdtsc() - t0;
+}
+
+void bench_disk() {
+    static const uint32_t sizes[] = { 4096, 64 * 1024, 1024 * 1024 };
+    static const char* pio_names[] = { "PIO 4 KiB", "PIO 64 KiB", "PIO 1 MiB" };
+    static const char* dma_names[] = { "DMA 4 KiB", "DMA 64 KiB", "DMA 1 MiB" };
+
+    print_serial("[bench] disk throughput, PIO vs bus-master DMA\n");
+    char* buf = kmalloc(BENCH_DISK_TOTAL);
+    if (!buf) {
+        return;
+    }
+    int saved_mode = ata_get_mode();
+    for (int i = 0; i < 3; i++) {
+        ata_set_mode(ATA_MODE_PIO);
+        bench_report_rate(pio_names[i], BENCH_DISK_TOTAL, bench_disk_round(buf, sizes[i]));
+        if (ata_set_mode(ATA_MODE_DMA) == RZOS_ALL_OK) {
+            bench_report_rate(dma_names[i], BENCH_DISK_TOTAL, bench_disk_round(buf, sizes[i]));
+        }
+    }
+    ata_set_mode(saved_mode);
+    ata_print_stats();
+    kfree(buf);
+}
+
+#define BENCH_SEQ_ROUNDS 8
+
+static void bench_sequential_mode(const char* name, char* buf) {
+    uint32_t commands = ata_stats.commands;
+    uint32_t sectors = ata_stats.sectors;
+    uint64_t cycles = 0;
+    for (int i = 0; i < BENCH_SEQ_ROUNDS; i++) {
+        cycles += bench_disk_round(buf, BENCH_DISK_TOTAL);
+    }
+    commands = ata_stats.commands - commands;
+    sectors = ata_stats.sectors - sectors;
+
+    bench_report_rate(name, BENCH_DISK_TOTAL * BENCH_SEQ_ROUNDS, cycles);
+    print_serial("    sectors per command: ");
+    kputdec(commands ? sectors / commands : 0);
+    print_serial("\n");
+}
+
+// Large sequential reads, one 1 MiB request at a time. With LBA48 each goes
+// out as a single command, and READ MULTIPLE cuts PIO interrupts per block.
+void bench_disk_sequential() {
+    print_serial("[bench] sequential 1 MiB reads\n");
+    char* buf = kmalloc(BENCH_DISK_TOTAL);
+    if (!buf) {
+        return;
+    }
+    int saved_mode = ata_get_mode();
+    uint32_t irqs = ata_stats.irqs;
+    ata_set_mode(ATA_MODE_PIO);
+    bench_sequential_mode("PIO", buf);
+    print_serial("    interrupts per MiB: ");
+    kputdec((ata_stats.irqs - irqs) / BENCH_SEQ_ROUNDS);
+    print_serial("\n");
+    if (ata_set_mode(ATA_MODE_DMA) == RZOS_ALL_OK) {
+        bench_sequential_mode("DMA", buf);
+    }
+    ata_set_mode(saved_mode);
+    kfree(buf);
+}
+
+#define BENCH_BCACHE_READS 512
+
+// Random single-sector reads over a working set of blocks. While the set
+// fits in the cache almost every read is a hit, once it doesn't LRU thrashes.
+static void bench_bcache_round(const char* name, struct block_device* dev, uint32_t blocks, char* buf) {
+    uint32_t hits = bcache_stats.hits;
+    uint32_t misses = bcache_stats.misses;
+    uint32_t evictions = bcache_stats.evictions;
+    uint32_t sectors = blocks * BCACHE_SECTORS_PER_BLOCK;
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_BCACHE_READS; i++) {
+        uint32_t lba = bench_rand() % sectors;
+        if (bcache_read(dev, lba, 1, buf) < 0) {
+            print_serial("  read failed\n");
+            break;
+        }
+    }
+    uint64_t cycles = rdtsc() - t0;
+
+    bench_report(name, cycles, BENCH_BCACHE_READS);
+    print_serial("    hits ");
+    kputdec(bcache_stats.hits - hits);
+    print_serial(", misses ");
+    kputdec(bcache_stats.misses - misses);
+    print_serial(", evictions ");
+    kputdec(bcache_stats.evictions - evictions);
+    print_serial("\n");
+}
+
+void bench_bcache() {
+    print_serial("[bench] block cache, random reads\n");
+    struct block_device* dev = block_get(0);
+    char* buf = kmalloc(RZOS_SECTOR_SIZE);
+    if (!dev || !buf) {
+        kfree(buf);
+        return;
+    }
+    uint32_t cache_blocks = (RZOS_BCACHE_SIZE_KB * 1024) / RZOS_BCACHE_BLOCK_SIZE;
+    uint32_t disk_blocks = dev->sectors / BCACHE_SECTORS_PER_BLOCK;
+    uint32_t small = cache_blocks / 2;
+    uint32_t large = cache_blocks * 4;
+    if (large > disk_blocks) {
+        large = disk_blocks;
+    }
+
+    bcache_invalidate(dev);
+    bench_bcache_round("working set 1/2 of cache", dev, small, buf);
+    bcache_invalidate(dev);
+    bench_bcache_round("working set 4x cache", dev, large, buf);
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_BCACHE_READS; i++) {
+        ata_read(bench_rand() % (large * BCACHE_SECTORS_PER_BLOCK), 1, buf);
+    }
+    bench_report("uncached ata_read", rdtsc() - t0, BENCH_BCACHE_READS);
+    bcache_print_stats();
+    kfree(buf);
+}
+
+static uint64_t bench_readahead_round(struct block_device* dev, char* buf, uint32_t sectors) {
+    bcache_invalidate(dev);
+    uint64_t t0 = rdtsc();
+    for (uint32_t lba = 0; lba + 8 <= sectors; lba += 8) {
+        if (bcache_read(dev, lba, 8, buf) < 0) {
+            print_serial("  read failed\n");
+            break;
+        }
+    }
+    return rdtsc() - t0;
+}
+
+// Sequential 4 KiB reads through the block cache, with and without read-ahead
+void bench_readahead() {
+    print_serial("[bench] sequential 4 KiB reads, read-ahead\n");
+    struct block_device* dev = block_get(0);
+    char* buf = kmalloc(RZOS_BCACHE_BLOCK_SIZE);
+    if (!dev || !buf) {
+        kfree(buf);
+        return;
+    }
+    uint32_t sectors = dev->sectors;
+    if (sectors > BENCH_DISK_TOTAL / RZOS_SECTOR_SIZE) {
+        sectors = BENCH_DISK_TOTAL / RZOS_SECTOR_SIZE;
+    }
+    uint32_t bytes = (sectors / 8) * RZOS_BCACHE_BLOCK_SIZE;
+
+    bcache_set_readahead(false);
+    bench_report_rate("read-ahead off", bytes, bench_readahead_round(dev, buf, sectors));
+    bcache_set_readahead(true);
+    uint32_t issued = bcache_stats.ra_issued;
+    uint32_t hits = bcache_stats.ra_hits;
+    bench_report_rate("read-ahead on", bytes, bench_readahead_round(dev, buf, sectors));
+    print_serial("    prefetched ");
+    kputdec(bcache_stats.ra_issued - issued);
+    print_serial(", used ");
+    kputdec(bcache_stats.ra_hits - hits);
+    print_serial("\n");
+    bcache_print_stats();
+    kfree(buf);
+}
+
+#define BENCH_BLKQ_OPS 256
+
+static struct block_request bench_blkq_reqs[RZOS_BLOCK_QUEUE_DEPTH];
+
+// Keeps depth 4 KiB reads at random block-aligned LBAs in flight until ops have
+// completed, returns the cycles taken
+static uint64_t bench_blkq_random(struct block_device* dev, uint8_t* bufs, uint32_t blocks, uint32_t depth, uint32_t ops) {
+    uint32_t issued = 0;
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < depth && issued < ops; i++, issued++) {
+        blkq_init_request(&bench_blkq_reqs[i], dev, (bench_rand() % blocks) * 8, 8, bufs + i * RZOS_BCACHE_BLOCK_SIZE, false);
+        blkq_submit(&bench_blkq_reqs[i]);
+    }
+    // Refill slots in order, each wait also lets later requests finish
+    for (uint32_t i = 0; issued < ops; i = (i + 1) % depth, issued++) {
+        blkq_wait(&bench_blkq_reqs[i]);
+        blkq_init_request(&bench_blkq_reqs[i], dev, (bench_rand() % blocks) * 8, 8, bufs + i * RZOS_BCACHE_BLOCK_SIZE, false);
+        blkq_submit(&bench_blkq_reqs[i]);
+    }
+    for (uint32_t i = 0; i < depth; i++) {
+        blkq_wait(&bench_blkq_reqs[i]);
+    }
+    return rdtsc() - t0;
+}
+
+// Runs bench_blkq_random at one queue depth and prints the IOPS
+static void bench_report_iops(struct block_device* dev, uint8_t* bufs, uint32_t blocks, uint32_t depth) {
+    uint64_t us = tsc_cycles_to_us(bench_blkq_random(dev, bufs, blocks, depth, BENCH_BLKQ_OPS));
+    print_serial("  random 4 KiB reads, QD");
+    kputdec(depth);
+    print_serial(": ");
+    kputdec((uint32_t)udiv64((uint64_t)BENCH_BLKQ_OPS * 1000000, us ? us : 1));
+    print_serial(" IOPS\n");
+}
+
+// Block aligned start of count sectors at the end of dev that lie past the
+// FAT volume on it, in the scratch space the Makefile leaves behind the
+// volume for the write benchmarks. Returns 0 when there is no such room.
+static uint32_t bench_scratch(struct block_device* dev, uint32_t count) {
+    struct fat_bpb* bpb = kmalloc(RZOS_SECTOR_SIZE);
+    if (!bpb || dev->sectors < count || block_read(dev, 0, 1, bpb) < 0) {
+        kfree(bpb);
+        return 0;
+    }
+    uint32_t volume_end = bpb->total_sectors16 ? bpb->total_sectors16 : bpb->total_sectors32;
+    kfree(bpb);
+    uint32_t start = (dev->sectors - count) / BCACHE_SECTORS_PER_BLOCK * BCACHE_SECTORS_PER_BLOCK;
+    return volume_end && start >= volume_end ? start : 0;
+}
+
+// Random 4 KiB reads at increasing queue depth, then a burst of adjacent
+// requests to show how many the queue folds into one command
+void bench_blkq() {
+    static const uint32_t depths[] = { 1, 4, 16, RZOS_BLOCK_QUEUE_DEPTH };
+    print_serial("[bench] block queue\n");
+    struct block_device* dev = block_get(0);
+    uint8_t* bufs = kmalloc(RZOS_BLOCK_QUEUE_DEPTH * RZOS_BCACHE_BLOCK_SIZE);
+    if (!dev || !bufs || !dev->submit) {
+        kfree(bufs);
+        return;
+    }
+    uint32_t blocks = dev->sectors / 8;
+    if (blocks > BENCH_DISK_TOTAL / RZOS_BCACHE_BLOCK_SIZE) {
+        blocks = BENCH_DISK_TOTAL / RZOS_BCACHE_BLOCK_SIZE;
+    }
+
+    for (uint32_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        bench_report_iops(dev, bufs, blocks, depths[d]);
+    }
+
+    uint32_t submitted = blkq_stats.submitted;
+    uint32_t dispatched = blkq_stats.dispatched;
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < RZOS_BLOCK_QUEUE_DEPTH; i++) {
+        blkq_init_request(&bench_blkq_reqs[i], dev, i * 8, 8, bufs + i * RZOS_BCACHE_BLOCK_SIZE, false);
+        blkq_submit(&bench_blkq_reqs[i]);
+    }
+    for (uint32_t i = 0; i < RZOS_BLOCK_QUEUE_DEPTH; i++) {
+        blkq_wait(&bench_blkq_reqs[i]);
+    }
+    bench_report_rate("adjacent 4 KiB reads", RZOS_BLOCK_QUEUE_DEPTH * RZOS_BCACHE_BLOCK_SIZE, rdtsc() - t0);
+    print_serial("    ");
+    kputdec(blkq_stats.submitted - submitted);
+    print_serial(" requests in ");
+    kputdec(blkq_stats.dispatched - dispatched);
+    print_serial(" commands\n");
+
+    // Writes go to the scratch space behind the FAT volume and put back what
+    // they read, so the disk is unchanged afterwards
+    uint32_t scratch = bench_scratch(dev, RZOS_BLOCK_QUEUE_DEPTH * 8);
+    if (!scratch) {
+        print_serial("  no scratch space for writes\n");
+    } else if (block_read(dev, scratch, RZOS_BLOCK_QUEUE_DEPTH * 8, bufs) == RZOS_ALL_OK) {
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < RZOS_BLOCK_QUEUE_DEPTH; i++) {
+            blkq_init_request(&bench_blkq_reqs[i], dev, scratch + i * 8, 8, bufs + i * RZOS_BCACHE_BLOCK_SIZE, true);
+            blkq_submit(&bench_blkq_reqs[i]);
+        }
+        int res = RZOS_ALL_OK;
+        for (uint32_t i = 0; i < RZOS_BLOCK_QUEUE_DEPTH; i++) {
+            if (blkq_wait(&bench_blkq_reqs[i]) < 0) {
+                res = -EIO;
+            }
+        }
+        if (res < 0) {
+            print_serial("  write failed\n");
+        } else {
+            bench_report_rate("adjacent 4 KiB writes", RZOS_BLOCK_QUEUE_DEPTH * RZOS_BCACHE_BLOCK_SIZE, rdtsc() - t0);
+        }
+    }
+    blkq_print_stats();
+    ata_print_stats();
+    kfree(bufs);
+}
+
+// Sequential 64 KiB reads and random 4 KiB reads at depth 1 and 32 on one
+// device, all through the block queue
+static void bench_block_device(struct block_device* dev, uint8_t* bufs) {
+    print_serial("  ");
+    print_serial(dev->name);
+    print_serial("\n");
+    uint32_t sectors = dev->sectors;
+    if (sectors > BENCH_DISK_TOTAL / RZOS_SECTOR_SIZE) {
+        sectors = BENCH_DISK_TOTAL / RZOS_SECTOR_SIZE;
+    }
+    uint32_t request = 64 * 1024 / RZOS_SECTOR_SIZE;
+    uint64_t t0 = rdtsc();
+    for (uint32_t lba = 0; lba + request <= sectors; lba += request) {
+        if (block_read(dev, lba, request, bufs) < 0) {
+            print_serial("  read failed\n");
+            return;
+        }
+    }
+    bench_report_rate("sequential 64 KiB reads", (sectors / request) * request * RZOS_SECTOR_SIZE, rdtsc() - t0);
+    bench_report_iops(dev, bufs, sectors / 8, 1);
+    bench_report_iops(dev, bufs, sectors / 8, RZOS_BLOCK_QUEUE_DEPTH);
+}
+
+// The same image over ATA PIO and virtio-blk, run with make run-virtio
+void bench_virtio() {
+    print_serial("[bench] ATA PIO against virtio-blk\n");
+    struct block_device* vda = virtio_blk_device();
+    struct block_device* ata = block_get(0);
+    uint8_t* bufs = kmalloc(RZOS_BLOCK_QUEUE_DEPTH * RZOS_BCACHE_BLOCK_SIZE);
+    if (!vda || !ata || !bufs) {
+        print_serial("  no virtio-blk disk\n");
+        kfree(bufs);
+        return;
+    }
+    int mode = ata_get_mode();
+    ata_set_mode(ATA_MODE_PIO);
+    bench_block_device(ata, bufs);
+    ata_set_mode(mode);
+    bench_block_device(vda, bufs);
+    virtio_blk_print_stats();
+    kfree(bufs);
+}
+
+// Random 4 KiB reads over NCQ at queue depths 1, 8 and 32, run with make run-ahci
+void bench_ahci() {
+    static const uint32_t depths[] = { 1, 8, 32 };
+    print_serial("[bench] AHCI random 4 KiB reads\n");
+    struct block_device* sda = ahci_device();
+    uint8_t* bufs = kmalloc(RZOS_BLOCK_QUEUE_DEPTH * RZOS_BCACHE_BLOCK_SIZE);
+    if (!sda || !bufs) {
+        print_serial("  no AHCI disk\n");
+        kfree(bufs);
+        return;
+    }
+    uint32_t blocks = sda->sectors / 8;
+    if (blocks > BENCH_DISK_TOTAL / RZOS_BCACHE_BLOCK_SIZE) {
+        blocks = BENCH_DISK_TOTAL / RZOS_BCACHE_BLOCK_SIZE;
+    }
+    for (uint32_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        bench_report_iops(sda, bufs, blocks, depths[d]);
+    }
+    ahci_print_stats();
+    kfree(bufs);
+}
+
+#define BENCH_WRITEBACK_BLOCKS 32
+#define BENCH_WRITEBACK_OPS 1024
+
+// Random 512 B writes into the scratch space behind the FAT volume on the
+// boot disk, once written through and once absorbed by the block cache and
+// flushed. The original contents are saved first and written back at the end.
+void bench_writeback() {
+    print_serial("[bench] random 512 B writes, write-back cache\n");
+    struct block_device* dev = block_get(0);
+    uint32_t sectors = BENCH_WRITEBACK_BLOCKS * BCACHE_SECTORS_PER_BLOCK;
+    if (!dev || !dev->write) {
+        print_serial("  no writable disk\n");
+        return;
+    }
+    uint32_t start = bench_scratch(dev, sectors);
+    if (!start) {
+        print_serial("  no scratch space for writes\n");
+        return;
+    }
+    uint8_t* saved = kmalloc(sectors * RZOS_SECTOR_SIZE);
+    uint8_t* sector = kmalloc(RZOS_SECTOR_SIZE);
+    if (!saved || !sector) {
+        kfree(saved);
+        kfree(sector);
+        return;
+    }
+    bcache_flush(dev);
+    if (block_read(dev, start, sectors, saved) < 0) {
+        print_serial("  read failed\n");
+        kfree(saved);
+        kfree(sector);
+        return;
+    }
+    memset(sector, 0xA5, RZOS_SECTOR_SIZE);
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_WRITEBACK_OPS; i++) {
+        block_write(dev, start + bench_rand() % sectors, 1, sector);
+    }
+    block_flush(dev);
+    bench_report("write-through", rdtsc() - t0, BENCH_WRITEBACK_OPS);
+
+    // The cached copies of the scratch range went stale above
+    bcache_invalidate(dev);
+    uint32_t absorbed = bcache_stats.absorbed;
+    uint32_t batches = bcache_stats.flush_batches;
+    uint32_t dispatched = blkq_stats.dispatched;
+    uint64_t written = bcache_stats.write_bytes;
+    uint64_t disk_written = bcache_stats.disk_write_bytes;
+    t0 = rdtsc();
+    for (int i = 0; i < BENCH_WRITEBACK_OPS; i++) {
+        bcache_write(dev, start + bench_rand() % sectors, 1, sector);
+    }
+    bcache_flush(dev);
+    bench_report("write-back + flush", rdtsc() - t0, BENCH_WRITEBACK_OPS);
+    print_serial("    absorbed ");
+    kputdec(bcache_stats.absorbed - absorbed);
+    print_serial(", flush batches ");
+    kputdec(bcache_stats.flush_batches - batches);
+    print_serial(", queued commands ");
+    kputdec(blkq_stats.dispatched - dispatched);
+    print_serial(", ");
+    kputdec(udiv64(bcache_stats.write_bytes - written, 1024));
+    print_serial(" KiB written, ");
+    kputdec(udiv64(bcache_stats.disk_write_bytes - disk_written, 1024));
+    print_serial(" KiB to disk\n");
+
+    if (bcache_write(dev, start, sectors, saved) < 0 || bcache_flush(dev) < 0) {
+        print_serial("  restoring the scratch range failed\n");
+    }
+    bcache_print_stats();
+    kfree(saved);
+    kfree(sector);
+}
+
+#define BENCH_FAT_FILE "0:/LARGE.BIN"
+#define BENCH_FAT_CHUNK 4096
+#define BENCH_FAT_RANDOM_READS 256
+
+// Reads the whole file in BENCH_FAT_CHUNK pieces, returns the cycles taken
+static uint64_t bench_fat_sequential(int fd, char* buf) {
+    fseek(fd, 0, SEEK_SET);
+    uint64_t t0 = rdtsc();
+    while (fread(buf, 1, BENCH_FAT_CHUNK, fd) > 0) {
+    }
+    return rdtsc() - t0;
+}
+
+// A large file on the boot disk's FAT volume read sequentially, with and
+// without the remembered cluster position, then at random offsets
+void bench_fat() {
+    print_serial("[bench] FAT file reads\n");
+    int fd = fopen(BENCH_FAT_FILE, "r");
+    char* buf = kmalloc(BENCH_FAT_CHUNK);
+    struct file_stat stat;
+    if (fd < 0 || !buf || fstat(fd, &stat) < 0 || stat.filesize < BENCH_FAT_CHUNK) {
+        print_serial("  no " BENCH_FAT_FILE "\n");
+        if (fd > 0) {
+            fclose(fd);
+        }
+        kfree(buf);
+        return;
+    }
+
+    // First pass warms the block cache so the rounds below compare the
+    // chain walk rather than the disk
+    bench_fat_sequential(fd, buf);
+    uint32_t steps = fat_stats.chain_steps;
+    uint64_t cycles = bench_fat_sequential(fd, buf);
+    bench_report_rate("sequential, position kept", stat.filesize, cycles);
+    print_serial("    chain steps ");
+    kputdec(fat_stats.chain_steps - steps);
+    print_serial("\n");
+
+    fat_set_position_cache(false);
+    steps = fat_stats.chain_steps;
+    cycles = bench_fat_sequential(fd, buf);
+    fat_set_position_cache(true);
+    bench_report_rate("sequential, chain walked each read", stat.filesize, cycles);
+    print_serial("    chain steps ");
+    kputdec(fat_stats.chain_steps - steps);
+    print_serial("\n");
+
+    steps = fat_stats.chain_steps;
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < BENCH_FAT_RANDOM_READS; i++) {
+        fseek(fd, (bench_rand() * 32768 + bench_rand()) % (stat.filesize - BENCH_FAT_CHUNK), SEEK_SET);
+        fread(buf, 1, BENCH_FAT_CHUNK, fd);
+    }
+    bench_report("random 4 KiB reads", rdtsc() - t0, BENCH_FAT_RANDOM_READS);
+    print_serial("    chain steps ");
+    kputdec(fat_stats.chain_steps - steps);
+    print_serial("\n");
+    fat_print_stats();
+    fclose(fd);
+    kfree(buf);
+}
+
+#define BENCH_MMAP_ADDRESS RZOS_PROGRAM_VIRTUAL_ADDRESS
+// Fits the pages a mapping keeps resident
+#define BENCH_MMAP_HOT_BYTES (RZOS_MMAP_RESIDENT_PAGES * PAGE_SIZE)
+#define BENCH_MMAP_HOT_ROUNDS 32
+
+static uint32_t bench_mmap_sum(const uint32_t* p, uint32_t bytes) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < bytes / 4; i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+// fread into a buffer and sums it, returns the cycles taken
+static uint64_t bench_mmap_read(int fd, char* buf, uint32_t bytes, uint32_t* sum) {
+    uint64_t t0 = rdtsc();
+    fseek(fd, 0, SEEK_SET);
+    for (uint32_t done = 0; done < bytes; done += BENCH_FAT_CHUNK) {
+        fread(buf, 1, BENCH_FAT_CHUNK, fd);
+        *sum += bench_mmap_sum((uint32_t*)buf, BENCH_FAT_CHUNK);
+    }
+    return rdtsc() - t0;
+}
+
+// Sums the mapping from inside the address space that holds it
+static uint64_t bench_mmap_scan(struct paging_chunk_4gb* chunk, uint32_t bytes, uint32_t* sum) {
+    paging_switch(chunk->directory_entry);
+    uint64_t t0 = rdtsc();
+    *sum += bench_mmap_sum((uint32_t*)BENCH_MMAP_ADDRESS, bytes);
+    uint64_t cycles = rdtsc() - t0;
+    paging_switch(paging_kernel_chunk()->directory_entry);
+    return cycles;
+}
+
+// Faults in the last page of the mapping right after a sequential read sent
+// read-ahead out. The fault runs with interrupts off and has to get past the
+// command still in flight instead of failing on the busy device.
+static void bench_mmap_fault_during_readahead(struct paging_chunk_4gb* chunk, int fd, char* buf, uint32_t bytes) {
+    struct block_device* dev = block_get(0);
+    uint32_t offset = bytes - PAGE_SIZE;
+    if (!dev || bytes <= BENCH_MMAP_HOT_BYTES) {
+        return;
+    }
+    bcache_invalidate(dev);
+    uint32_t issued = bcache_stats.ra_issued;
+    uint32_t drained = ata_stats.drained;
+    // The second read continues the first, which starts read-ahead
+    bcache_read(dev, 0, BCACHE_SECTORS_PER_BLOCK, buf);
+    bcache_read(dev, BCACHE_SECTORS_PER_BLOCK, BCACHE_SECTORS_PER_BLOCK, buf);
+    paging_switch(chunk->directory_entry);
+    uint32_t map_sum = bench_mmap_sum((uint32_t*)(BENCH_MMAP_ADDRESS + offset), PAGE_SIZE);
+    paging_switch(paging_kernel_chunk()->directory_entry);
+
+    fseek(fd, offset, SEEK_SET);
+    fread(buf, 1, PAGE_SIZE, fd);
+    if (map_sum == bench_mmap_sum((uint32_t*)buf, PAGE_SIZE)) {
+        print_serial("  fault during read-ahead: ok, ");
+    } else {
+        print_serial("  fault during read-ahead: data differs, ");
+    }
+    kputdec(bcache_stats.ra_issued - issued);
+    print_serial(" blocks prefetched, ");
+    kputdec(ata_stats.drained - drained);
+    print_serial(" ATA interrupts drained\n");
+}
+
+// Scans LARGE.BIN through fread and through a mapping in a fresh address
+// space, once cold from end to end and then repeatedly over a small hot range
+void bench_mmap() {
+    print_serial("[bench] file scan, read + copy vs mmap\n");
+    int fd = fopen(BENCH_FAT_FILE, "r");
+    char* buf = kmalloc(BENCH_FAT_CHUNK);
+    struct paging_chunk_4gb* chunk = paging_chunk(0);
+    struct file_stat stat;
+    uint32_t bytes = 0;
+    if (fd > 0 && fstat(fd, &stat) == RZOS_ALL_OK) {
+        bytes = stat.filesize & ~(BENCH_FAT_CHUNK - 1);
+    }
+    if (bytes < BENCH_MMAP_HOT_BYTES || !buf || !chunk ||
+        mmap_file(chunk, (void*)BENCH_MMAP_ADDRESS, bytes, PAGE_USER, fd, 0) < 0) {
+        print_serial("  no " BENCH_FAT_FILE " to map\n");
+        if (fd > 0) {
+            fclose(fd);
+        }
+        kfree(buf);
+        paging_chunk_free(chunk);
+        return;
+    }
+
+    uint32_t read_sum = 0;
+    uint32_t map_sum = 0;
+    bench_report_rate("read + copy, whole file", bytes, bench_mmap_read(fd, buf, bytes, &read_sum));
+    bench_report_rate("mmap, whole file", bytes, bench_mmap_scan(chunk, bytes, &map_sum));
+    if (read_sum != map_sum) {
+        print_serial("  mmap data differs from fread\n");
+    }
+
+    uint64_t read_cycles = 0;
+    uint64_t map_cycles = 0;
+    for (int i = 0; i < BENCH_MMAP_HOT_ROUNDS; i++) {
+        read_cycles += bench_mmap_read(fd, buf, BENCH_MMAP_HOT_BYTES, &read_sum);
+        map_cycles += bench_mmap_scan(chunk, BENCH_MMAP_HOT_BYTES, &map_sum);
+    }
+    bench_report_rate("read + copy, hot 64 KiB", BENCH_MMAP_HOT_BYTES * BENCH_MMAP_HOT_ROUNDS, read_cycles);
+    bench_report_rate("mmap, hot 64 KiB", BENCH_MMAP_HOT_BYTES * BENCH_MMAP_HOT_ROUNDS, map_cycles);
+    bench_mmap_fault_during_readahead(chunk, fd, buf, bytes);
+    mmap_print_stats();
+
+    fclose(fd);
+    vm_release(chunk, (void*)BENCH_MMAP_ADDRESS);
+    paging_chunk_free(chunk);
+    kfree(buf);
+}
+
+#define BENCH_INITRD_FILE "DATA.BIN"
+
+// Reads a whole file in BENCH_FAT_CHUNK pieces, returns the cycles taken from
+// fopen to fclose or 0 when the file can't be read
+static uint64_t bench_initrd_file(const char* path, char* buf, uint32_t* bytes) {
+    uint64_t t0 = rdtsc();
+    int fd = fopen(path, "r");
+    if (fd < 0) {
+        return 0;
+    }
+    *bytes = 0;
+    int res;
+    while ((res = fread(buf, 1, BENCH_FAT_CHUNK, fd)) > 0) {
+        *bytes += res;
+    }
+    fclose(fd);
+    return rdtsc() - t0;
+}
+
+// The same file read from the initrd and cold from the FAT volume on the
+// boot disk, which is what early boot paid before there was an initrd
+void bench_initrd() {
+    print_serial("[bench] initrd vs boot disk\n");
+    struct block_device* dev = ramdisk_device();
+    char* buf = kmalloc(BENCH_FAT_CHUNK);
+    if (!dev || !buf) {
+        print_serial("  no initrd\n");
+        kfree(buf);
+        return;
+    }
+    ramdisk_print_stats();
+
+    char path[] = "0:/" BENCH_INITRD_FILE;
+    path[0] = '0' + dev->id;
+    uint32_t bytes = 0;
+    uint64_t cycles = bench_initrd_file(path, buf, &bytes);
+    if (cycles) {
+        bench_report_rate("initrd " BENCH_INITRD_FILE, bytes, cycles);
+    }
+    bcache_invalidate(block_get(0));
+    cycles = bench_initrd_file("0:/" BENCH_INITRD_FILE, buf, &bytes);
+    if (cycles) {
+        bench_report_rate("boot disk " BENCH_INITRD_FILE ", cold", bytes, cycles);
+    }
+    kfree(buf);
+}
+
+#define BENCH_IRQ_SOFT 10000
+#define BENCH_IRQ_TIMER_HZ 10000
+#define BENCH_IRQ_SPIN_MS 100
+
+static volatile uint32_t bench_irq_count;
+
+static void bench_irq_handler(registers_t* regs) {
+    bench_irq_count++;
+}
+
+// Spins for the given cycles, returns the loop iterations it got through
+static uint32_t bench_irq_spin(uint64_t cycles) {
+    uint32_t n = 0;
+    uint64_t end = rdtsc() + cycles;
+    while (rdtsc() < end) {
+        n++;
+    }
+    return n;
+}
+
+// Interrupt entry, table dispatch and return, first through int3 on a
+// handler that only counts, then as the time a fast timer takes away from a
+// spinning loop compared with the same loop run with interrupts off
+void bench_irq() {
+    print_serial("[bench] interrupt overhead\n");
+    if (isr_register_handler(ISR_BREAKPOINT, bench_irq_handler) == RZOS_ALL_OK) {
+        bench_irq_count = 0;
+        uint64_t t0 = rdtsc();
+        for (int i = 0; i < BENCH_IRQ_SOFT; i++) {
+            __asm__ volatile("int3");
+        }
+        bench_report("int3 to a table handler", rdtsc() - t0, BENCH_IRQ_SOFT);
+        isr_register_handler(ISR_BREAKPOINT, NULL);
+    }
+
+    if (!timer_stats.hz || timer_set_frequency(BENCH_IRQ_TIMER_HZ) < 0) {
+        print_serial("  no timer\n");
+        return;
+    }
+    uint64_t spin = (uint64_t)tsc_mhz * 1000 * BENCH_IRQ_SPIN_MS;
+    uint32_t flags = irq_save();
+    uint32_t quiet = bench_irq_spin(spin);
+    irq_restore(flags);
+    uint32_t ticks = timer_ticks();
+    uint32_t loud = bench_irq_spin(spin);
+    ticks = timer_ticks() - ticks;
+    uint32_t hz = BENCH_IRQ_TIMER_HZ;
+    timer_set_frequency(RZOS_TIMER_HZ);
+
+    print_serial(timer_stats.lapic ? "  local APIC" : "  PIT");
+    print_serial(" timer at ");
+    kputdec(hz);
+    print_serial(" Hz: ");
+    kputdec(ticks);
+    print_serial(" ticks in ");
+    kputdec(BENCH_IRQ_SPIN_MS);
+    print_serial(" ms");
+    if (ticks && quiet > loud) {
+        uint64_t lost = udiv64(spin * (quiet - loud), quiet);
+        print_serial(", ");
+        kputdec((uint32_t)udiv64(lost, ticks));
+        print_serial(" cycles per tick");
+    }
+    print_serial("\n");
+}
+
+void bench_run_all() {
+    bench_memory();
+    bench_heap();
+    bench_slab();
+    bench_tlb();
+    bench_vm();
+    bench_zpool();
+    bench_krealloc();
+    bench_ata();
+    bench_disk();
+    bench_disk_sequential();
+    bench_bcache();
+    bench_readahead();
+    bench_blkq();
+    bench_virtio();
+    bench_ahci();
+    bench_writeback();
+    bench_fat();
+    bench_mmap();
+    bench_initrd();
+    bench_irq();
+}
@@ -0,0 +1,30 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// In-kernel benchmarks, run from kernel_main when RZOS_RUN_BENCHMARKS is set
+void bench_run_all();
+void bench_report(const char* name, uint64_t cycles, uint32_t ops);
+
+void bench_heap();
+void bench_slab();
+void bench_tlb();
+void bench_vm();
+void bench_memory();
+void bench_zpool();
+void bench_krealloc();
+void bench_ata();
+void bench_disk();
+void bench_disk_sequential();
+void bench_bcache();
+void bench_readahead();
+void bench_blkq();
+void bench_virtio();
+void bench_ahci();
+void bench_writeback();
+void bench_fat();
+void bench_mmap();
+void bench_initrd();
+void bench_irq();
+#endif
@@ -2,11 +2,53 @@ ORG 0x7c00
 BITS 16
 CODE_SEG equ gdt_code-gdt_start
 DATA_SEG equ gdt_data-gdt_start
+
+; Boot info for kernel_main, see struct boot_info in boot/boot_info.h
+BOOT_INFO equ 0x1000
+BOOT_INFO_MAGIC equ 0x49425A52
+BI_MAGIC equ 0
+BI_E820_COUNT equ 4
+BI_LOADER_START equ 8
+BI_LOADER_END equ 16
+BI_KERNEL_SECTORS equ 24
+BI_INITRD_LBA equ 28
+BI_E820 equ 32
+BOOT_E820_MAX equ 32
+E820_SMAP equ 0x534D4150
+
+; struct kernel_header, right behind the kernel's first jump
+KERNEL_ADDRESS equ 0x0100000
+KERNEL_HEADER equ KERNEL_ADDRESS + 4
+KERNEL_HEADER_MAGIC equ 0x484B5A52
 _start:
     jmp short start
     nop
-    
-times 33 db 0
+
+; FAT16 BIOS parameter block. The reserved sectors hold this sector, the
+; kernel and right behind it the initrd, the Makefile writes the empty FATs
+; and copies files in.
+OEMIdentifier       db 'RZOS    '
+BytesPerSector      dw 0x200
+SectorsPerCluster   db 0x04
+ReservedSectors     dw 2048
+FATCopies           db 0x02
+RootDirEntries      dw 0x200
+NumSectors          dw 0x8000
+MediaType           db 0xF8
+SectorsPerFat       dw 0x20
+SectorsPerTrack     dw 0x20
+NumberOfHeads       dw 0x40
+HiddenSectors       dd 0x00
+SectorsBig          dd 0x00
+
+; Extended BPB (DOS 4.0)
+DriveNumber         db 0x80
+WinNTBit            db 0x00
+Signature           db 0x29
+VolumeID            dd 0xD105
+VolumeIDString      db 'RZOS BOOT  '
+SystemIDString      db 'FAT16   '
+
 start:
     jmp 0:step2
 
@@ -19,6 +61,34 @@ step2:
     mov sp,0x7c00
     sti;Enable interuppter flag
 
+    rdtsc
+    mov [BOOT_INFO+BI_LOADER_START],eax
+    mov [BOOT_INFO+BI_LOADER_START+4],edx
+    mov dword [BOOT_INFO+BI_MAGIC],BOOT_INFO_MAGIC
+
+    ;BIOS memory map, int 15h E820 returns one entry per call
+    mov di,BOOT_INFO+BI_E820
+    xor ebx,ebx
+    xor esi,esi
+.e820_next:
+    mov eax,0xE820
+    mov edx,E820_SMAP
+    mov ecx,24
+    ;BIOSes returning 20 byte entries leave the ACPI flags alone, 1 is "valid"
+    mov dword [di+20],1
+    int 0x15
+    jc .e820_done
+    cmp eax,E820_SMAP
+    jne .e820_done
+    inc esi
+    add di,24
+    cmp esi,BOOT_E820_MAX
+    je .e820_done
+    test ebx,ebx
+    jnz .e820_next
+.e820_done:
+    mov [BOOT_INFO+BI_E820_COUNT],esi
+
 .load_protectd:
     cli;
     lgdt[gdt_descriptor]
@@ -57,72 +127,140 @@ gdt_descriptor:
 [BITS 32]
 
 load32:
+    ;IDENTIFY word 47 has the most sectors the drive moves per data request
+    mov dx,0x1F6
+    mov al,0xE0
+    out dx,al
+    mov dx,0x1F7
+    mov al,0xEC
+    out dx,al
+    call ata_wait_data
+    mov ecx,256
+    mov dx,0x1F0
+    mov edi,KERNEL_ADDRESS
+    rep insw
+    mov bl,[KERNEL_ADDRESS+47*2]
+    cmp bl,2
+    jb .load_kernel
+
+    ;SET MULTIPLE to it so READ MULTIPLE stops once per block, not per sector.
+    ;Drives that refuse keep reading a sector per request.
+    mov dx,0x1F2
+    mov al,bl
+    out dx,al
+    mov dx,0x1F7
+    mov al,0xC6
+    out dx,al
+.set_multiple:
+    in al,dx
+    test al,0x80
+    jnz .set_multiple
+    test al,1
+    jnz .load_kernel
+    mov [ata_block],bl
+    mov byte [ata_command],0xC4
+
+.load_kernel:
+    ;The first sector has the kernel header with the image size in sectors
     mov eax,1
-    mov ecx,100
-    mov edi,0x0100000
+    mov ecx,eax
+    mov edi,KERNEL_ADDRESS
+    call ata_lba_read
+    ;Without a header there is no telling how much to load
+    cmp dword [KERNEL_HEADER],KERNEL_HEADER_MAGIC
+    jne $
+    mov ecx,[KERNEL_HEADER+4]
+    mov [BOOT_INFO+BI_KERNEL_SECTORS],ecx
+    ;The initrd header sector comes right after the kernel
+    lea edx,[ecx+1]
+    mov [BOOT_INFO+BI_INITRD_LBA],edx
+    ;The rest, eax is LBA 2 and edi points past the first sector
+    dec ecx
     call ata_lba_read
-    jmp CODE_SEG:0x0100000
+    rdtsc
+    mov [BOOT_INFO+BI_LOADER_END],eax
+    mov [BOOT_INFO+BI_LOADER_END+4],edx
+    mov ebx,BOOT_INFO
+    jmp CODE_SEG:KERNEL_ADDRESS
 
+;eax = LBA, ecx = sectors, edi = destination. The count register is 8 bits
+;wide, so this issues one command per 256 sectors, a count of 0 means 256.
+;Returns with eax at the LBA after the last sector read.
 ata_lba_read:
+    mov esi,ecx
+.next_command:
+    test esi,esi
+    jz .done
+    xor ecx,ecx
+    inc ch
+    cmp esi,ecx
+    jae .full
+    mov ecx,esi
+.full:
+    sub esi,ecx
+    ;LBA of the command after this one
+    lea ebp,[eax+ecx]
     mov ebx,eax ;Backup the LBA
-    ;send the higest 8 bits of lba to hard disk controller
-    shr eax,24
-    or  eax,0xE0;select the master drive
-    mov dx,0x1F6
-    out dx,al  
-    ;Finished sending the highest 8 bits of the lba
 
-    ;Send the totle sectors to read
-    mov eax,ecx
+    ;Sector count, then the LBA a byte at a time, its top 4 bits go with
+    ;the drive select. The registers are consecutive ports from 0x1F2.
     mov dx,0x1F2
-    out dx,al  
-    ;Finished sending the total sectors to read 
-
-    ;send more bits of the LBA
-    mov eax,ebx;Restore the backup LBA
-    mov dx,0x1F3
-    out dx,al  
-    ;Finished sending more bits
-
-    mov dx,0x1F4
-    mov eax,ebx;Restore the backup LBA
-    shr eax,8
-    out dx,al 
-    ;Finished sending more bits of LBA
-
-    ;send Upper 16 bits of the LBA
-    mov dx,0x1F5
+    mov al,cl
+    out dx,al
+    inc dx
     mov eax,ebx
-    shr eax,16
-    out dx,al 
-    ;Finished sending upper 16 bits of the LBA
-
-    mov dx,0x1F7
-    mov al,0x20
-    out dx,al  
-
+    out dx,al
+    inc dx
+    shr eax,8
+    out dx,al
+    inc dx
+    shr eax,8
+    out dx,al
+    inc dx
+    shr eax,8
+    or al,0xE0;select the master drive
+    out dx,al
+    inc dx
+    mov al,[ata_command]
+    out dx,al
 
-    ;read all sector into memory
-.next_sector:
+    ;read the sectors into memory, a block of up to ata_block per request
+.next_block:
+    call ata_wait_data
+    movzx ebx,byte [ata_block]
+    cmp ebx,ecx
+    jbe .whole_block
+    mov ebx,ecx
+.whole_block:
+    sub ecx,ebx
     push ecx
+    ;we need to read 256 words per sector
+    mov ecx,ebx
+    shl ecx,8
+    mov dx,0x1F0
+    rep insw
+    pop ecx
+    test ecx,ecx
+    jnz .next_block
+    mov eax,ebp
+    jmp .next_command
+.done:
+    ret
 
-    ;checking if we need to read
-
-.try_again:
+;Waits until the drive has data for us
+ata_wait_data:
     mov dx,0x1F7
+.try_again:
     in al,dx
+    test al,0x80
+    jnz .try_again
     test al,8
     jz .try_again
+    ret
 
-;we need to read 256 words at a time
-    mov ecx,256
-    mov dx,0x1F0
-    rep insw
-    pop ecx
-    loop .next_sector
-    ;End of reading sectors into memory
-    ret 
-
+;READ SECTORS, or READ MULTIPLE once SET MULTIPLE took
+ata_command db 0x20
+ata_block db 1
 
 times 510 -($-$$) db 0
 dw 0xAA55
\ No newline at end of file
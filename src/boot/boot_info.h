@@ -0,0 +1,48 @@
+#ifndef BOOT_INFO_H
+#define BOOT_INFO_H
+
+#include <stdint.h>
+
+// What boot.asm hands kernel_main, built in low memory while still in real
+// mode. The layout is shared with boot.asm, keep the BI_ offsets there in
+// line with it.
+
+#define BOOT_INFO_MAGIC 0x49425A52 // "RZBI"
+#define BOOT_E820_MAX 32
+
+#define E820_USABLE 1
+#define E820_RESERVED 2
+#define E820_ACPI_RECLAIMABLE 3
+#define E820_ACPI_NVS 4
+#define E820_BAD 5
+
+// The first sector of the kernel image starts with a short jump over this
+struct kernel_header {
+    uint8_t jmp[4];
+    uint32_t magic;
+    // Sectors the loader reads, this one included
+    uint32_t sectors;
+} __attribute__((packed));
+
+#define KERNEL_HEADER_MAGIC 0x484B5A52 // "RZKH"
+
+struct e820_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi;
+} __attribute__((packed));
+
+struct boot_info {
+    uint32_t magic;
+    uint32_t e820_count;
+    // TSC when the boot sector started and when it jumped to the kernel
+    uint64_t loader_start_tsc;
+    uint64_t loader_end_tsc;
+    uint32_t kernel_sectors;
+    // Initrd header sector, the first one after the kernel
+    uint32_t initrd_lba;
+    struct e820_entry e820[BOOT_E820_MAX];
+} __attribute__((packed));
+
+#endif
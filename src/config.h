@@ -1,26 +1,61 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-//Definitions for kernel heap virtual address space
+//Definitions for kernel heap virtual address space.
+//The whole window is reserved at boot, frames are only mapped in as blocks get used.
 #define KERNEL_HEAP_START_VIRTUAL_ADDRESS 0xD0000000 
-#define KERNEL_HEAP_SIZE_MB                 16       
+#define KERNEL_HEAP_SIZE_MB                 100
 #define KERNEL_HEAP_MAX_VIRTUAL_ADDRESS (KERNEL_HEAP_START_VIRTUAL_ADDRESS + (KERNEL_HEAP_SIZE_MB * 1024 * 1024))
+// The window actually used is at most 1/RZOS_HEAP_RAM_SHARE of the RAM the
+// frame allocator manages
+#define RZOS_HEAP_RAM_SHARE 2
 
 
+// Physical memory from KERNEL_DIRECT_MAP_PHYS_START upwards is mapped at KERNEL_DIRECT_MAP_OFFSET.
+// Both are 4MiB aligned so the direct map can use large pages.
+#define KERNEL_DIRECT_MAP_OFFSET 0xC0000000
+#define KERNEL_DIRECT_MAP_PHYS_START 0x0
+// The direct map stops where the kernel heap window starts
+#define KERNEL_DIRECT_MAP_MAX_BYTES (KERNEL_HEAP_START_VIRTUAL_ADDRESS - KERNEL_DIRECT_MAP_OFFSET)
+
+// Device registers are mapped uncached into this window by paging_map_mmio
+#define KERNEL_MMIO_VIRTUAL_ADDRESS 0xF0000000
+#define KERNEL_MMIO_SIZE_MB 64
+
+// Use 4MiB pages (CR4.PSE) in paging_map_to when the range allows it
+#define RZOS_PAGING_USE_PSE 1
+// Mark kernel mappings global (CR4.PGE) so CR3 reloads keep them in the TLB
+#define RZOS_PAGING_USE_GLOBAL 1
+
+// Upper bound on the physical memory the frame allocator can track
+#define RZOS_MAX_PHYSICAL_MEMORY_MB 512
+// RAM assumed when the boot loader found no E820 memory map
+#define RZOS_FALLBACK_MEMORY_MB 32
+// Usable E820 ranges the kernel keeps, after merging adjacent ones
+#define RZOS_MAX_MEMORY_RANGES 16
+
 #define KERNEL_CODE_SELECTOR 0x08
 #define KERNEL_DATA_SELECTOR 0x10
 #define KERNEL_END 0x10a000
 #define PAGE_SIZE 0x1000
 #define RZOS_TOTAL_INTERRUPTS 512
 
-// 100MB heap size
-#define RZOS_HEAP_SIZE_BYTES 104857600
 #define RZOS_HEAP_BLOCK_SIZE 4096
-#define RZOS_HEAP_ADDRESS 0x0300000 
-#define RZOS_HEAP_TABLE_ADDRESS 0x00007E00
+
+// Physical RAM from here up belongs to the frame allocator
+#define RZOS_FRAME_POOL_START 0x0300000
 
 #define RZOS_SECTOR_SIZE 512
 
+// Boot disk layout. The kernel follows the boot sector, the initrd header
+// sector follows the kernel with the archive right behind it. All of it is
+// inside the FAT16 reserved sectors, see boot.asm and the Makefile. The
+// loader passes the header's LBA in boot_info.
+// Largest initrd the kernel will read, a sanity bound on the header
+#define RZOS_INITRD_MAX_SECTORS 2048
+// Set to 0 to boot without reading the initrd
+#define RZOS_LOAD_INITRD 1
+
 #define RZOS_MAX_FILESYSTEMS 12
 #define RZOS_MAX_FILE_DESCRIPTORS 512
 
@@ -34,6 +69,11 @@
 #define RZOS_PROGRAM_VIRTUAL_STACK_ADDRESS_END RZOS_PROGRAM_VIRTUAL_STACK_ADDRESS_START - RZOS_USER_PROGRAM_STACK_SIZE
 
 #define RZOS_MAX_PROGRAM_ALLOCATIONS 1024
+// Demand-zero regions created with vm_reserve, across all address spaces
+#define RZOS_MAX_VM_REGIONS 64
+// Pages a file or device mapping keeps mapped at once, the oldest is unmapped
+// to make room. Each one may pin a block cache buffer.
+#define RZOS_MMAP_RESIDENT_PAGES 16
 #define RZOS_MAX_PROCESSES 12
 
 #define USER_DATA_SEGMENT 0x23
@@ -43,4 +83,38 @@
 
 #define RZOS_KEYBOARD_BUFFER_SIZE 1024
 
+// Frames kept zeroed ahead of time for page tables and kzalloc
+#define RZOS_ZERO_POOL_PAGES 64
+// Pages zeroed per pass of the idle loop
+#define RZOS_ZERO_POOL_REFILL_BATCH 8
+
+// Let memset/memcpy use SSE2 when the CPU has it
+#define RZOS_USE_SSE 1
+
+// Block cache: buffer size and how much heap it may hold on to
+#define RZOS_BCACHE_BLOCK_SIZE 4096
+#define RZOS_BCACHE_SIZE_KB 256
+// Sequential read-ahead window in cache blocks, it doubles from MIN to MAX
+#define RZOS_READAHEAD_MIN_BLOCKS 2
+#define RZOS_READAHEAD_MAX_BLOCKS 32
+// Sequential streams tracked at once across all devices
+#define RZOS_READAHEAD_STREAMS 4
+// Requests queued or in flight per block device
+#define RZOS_BLOCK_QUEUE_DEPTH 32
+// Write-back: dirty data above this is flushed right away, below it once
+// the oldest dirty block has waited RZOS_BCACHE_WRITEBACK_MS
+#define RZOS_BCACHE_DIRTY_MAX_KB 128
+#define RZOS_BCACHE_WRITEBACK_MS 500
+
+// Periodic timer rate, and whether the local APIC timer may stand in for the PIT
+#define RZOS_TIMER_HZ 100
+#define RZOS_TIMER_USE_LAPIC 1
+
+// Set to 1 to run the in-kernel benchmarks (src/bench.c) during boot
+#define RZOS_RUN_BENCHMARKS 0
+
+// Boot profiler spans recorded, and how deep they may nest
+#define RZOS_PROF_MAX_SPANS 64
+#define RZOS_PROF_MAX_DEPTH 8
+
 #endif
\ No newline at end of file
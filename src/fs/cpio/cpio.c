@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "fs/cpio/cpio.h"
+#include "ssd/ramdisk.h"
+#include "memory/memory.h"
+#include "status.h"
+
+static int cpio_resolve(struct block_device* dev, void** out);
+static int cpio_open(void* volume, const char* path, FILE_MODE mode, void** out);
+static int cpio_read(void* volume, void* file, uint32_t offset, uint32_t size, void* out);
+static int cpio_stat(void* volume, void* file, struct file_stat* stat);
+static int cpio_close(void* file);
+
+static struct filesystem cpio_fs = {
+    .resolve = cpio_resolve,
+    .open = cpio_open,
+    .read = cpio_read,
+    .stat = cpio_stat,
+    .close = cpio_close,
+    .name = "cpio"
+};
+
+struct filesystem* cpio_init()
+{
+    return &cpio_fs;
+}
+
+// One parsed header. name is NUL terminated inside the archive.
+struct cpio_entry {
+    const char* name;
+    uint32_t mode;
+    uint32_t data;
+    uint32_t size;
+    uint32_t next;
+};
+
+static int cpio_field(const uint8_t* header, int index, uint32_t* out)
+{
+    const uint8_t* p = header + 6 + index * 8;
+    uint32_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        uint8_t c = p[i];
+        if (c >= '0' && c <= '9') {
+            value = (value << 4) | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value = (value << 4) | (c - 'A' + 10);
+        } else {
+            return -EINFORMAT;
+        }
+    }
+    *out = value;
+    return RZOS_ALL_OK;
+}
+
+static bool cpio_name_is(const char* a, const char* b, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return a[len] == 0;
+}
+
+// Parses the header at offset. Returns -ENOFOUND at the trailer and
+// -EINFORMAT when the header or its sizes don't fit the archive.
+static int cpio_entry_at(struct cpio_volume* vol, uint32_t offset, struct cpio_entry* out)
+{
+    const uint8_t* header = vol->base + offset;
+    if (offset > vol->size || vol->size - offset < CPIO_HEADER_SIZE ||
+        memcmp((void*)header, CPIO_NEWC_MAGIC, 6) != 0) {
+        return -EINFORMAT;
+    }
+    uint32_t namesize;
+    if (cpio_field(header, CPIO_FIELD_MODE, &out->mode) < 0 ||
+        cpio_field(header, CPIO_FIELD_FILESIZE, &out->size) < 0 ||
+        cpio_field(header, CPIO_FIELD_NAMESIZE, &namesize) < 0) {
+        return -EINFORMAT;
+    }
+    uint32_t name = offset + CPIO_HEADER_SIZE;
+    if (namesize == 0 || vol->size - name < namesize || vol->base[name + namesize - 1] != 0) {
+        return -EINFORMAT;
+    }
+    // Name and data each start 4-byte aligned
+    out->name = (const char*)vol->base + name;
+    out->data = (name + namesize + 3) & ~3;
+    if (out->data > vol->size || vol->size - out->data < out->size) {
+        return -EINFORMAT;
+    }
+    out->next = (out->data + out->size + 3) & ~3;
+    if (cpio_name_is(out->name, CPIO_TRAILER, sizeof(CPIO_TRAILER) - 1)) {
+        return -ENOFOUND;
+    }
+    return RZOS_ALL_OK;
+}
+
+static int cpio_resolve(struct block_device* dev, void** out)
+{
+    const uint8_t* base = ramdisk_memory(dev);
+    uint32_t size = ramdisk_size(dev);
+    if (!base || size < CPIO_HEADER_SIZE || memcmp((void*)base, CPIO_NEWC_MAGIC, 6) != 0) {
+        return -EFSNOTUS;
+    }
+    struct cpio_volume* vol = kzalloc(sizeof(struct cpio_volume));
+    if (!vol) {
+        return -ENOMEM;
+    }
+    vol->base = base;
+    vol->size = size;
+    *out = vol;
+    return RZOS_ALL_OK;
+}
+
+// Archive names are relative and may start with "./"
+static const char* cpio_strip(const char* name)
+{
+    for (;;) {
+        if (name[0] == '.' && name[1] == '/') {
+            name += 2;
+        } else if (name[0] == '/') {
+            name++;
+        } else {
+            return name;
+        }
+    }
+}
+
+static int cpio_open(void* volume, const char* path, FILE_MODE mode, void** out)
+{
+    struct cpio_volume* vol = volume;
+    if (mode != FILE_MODE_READ) {
+        return -ERDONLY;
+    }
+    path = cpio_strip(path);
+    uint32_t len = 0;
+    while (path[len]) {
+        len++;
+    }
+    while (len && path[len - 1] == '/') {
+        len--;
+    }
+
+    struct cpio_file* file = kzalloc(sizeof(struct cpio_file));
+    if (!file) {
+        return -ENOMEM;
+    }
+    if (len == 0) {
+        file->mode = CPIO_MODE_DIRECTORY;
+        *out = file;
+        return RZOS_ALL_OK;
+    }
+
+    struct cpio_entry entry;
+    uint32_t offset = 0;
+    int res;
+    while ((res = cpio_entry_at(vol, offset, &entry)) == RZOS_ALL_OK) {
+        if (cpio_name_is(cpio_strip(entry.name), path, len)) {
+            file->data = vol->base + entry.data;
+            file->size = entry.size;
+            file->mode = entry.mode;
+            *out = file;
+            return RZOS_ALL_OK;
+        }
+        offset = entry.next;
+    }
+    kfree(file);
+    return res;
+}
+
+static int cpio_read(void* volume, void* private, uint32_t offset, uint32_t size, void* out)
+{
+    struct cpio_file* file = private;
+    if ((file->mode & CPIO_MODE_TYPE) == CPIO_MODE_DIRECTORY) {
+        return -EINVARG;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    memcpy(out, (void*)(file->data + offset), size);
+    return size;
+}
+
+static int cpio_stat(void* volume, void* private, struct file_stat* stat)
+{
+    struct cpio_file* file = private;
+    stat->filesize = file->size;
+    stat->flags = FILE_STAT_READ_ONLY;
+    if ((file->mode & CPIO_MODE_TYPE) == CPIO_MODE_DIRECTORY) {
+        stat->flags |= FILE_STAT_DIRECTORY;
+    }
+    return RZOS_ALL_OK;
+}
+
+static int cpio_close(void* private)
+{
+    kfree(private);
+    return RZOS_ALL_OK;
+}
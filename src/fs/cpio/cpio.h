@@ -0,0 +1,35 @@
+#ifndef CPIO_H
+#define CPIO_H
+
+#include <stdint.h>
+#include "config.h"
+#include "fs/file.h"
+
+// Read-only "newc" cpio archives held in memory, which is what the initrd
+// ramdisk carries. Every header field is 8 hex digits.
+#define CPIO_NEWC_MAGIC "070701"
+#define CPIO_HEADER_SIZE 110
+#define CPIO_FIELD_MODE 1
+#define CPIO_FIELD_FILESIZE 6
+#define CPIO_FIELD_NAMESIZE 11
+#define CPIO_TRAILER "TRAILER!!!"
+
+#define CPIO_MODE_TYPE 0170000
+#define CPIO_MODE_DIRECTORY 0040000
+#define CPIO_MODE_FILE 0100000
+
+struct cpio_volume {
+    const uint8_t* base;
+    uint32_t size;
+};
+
+// An open entry, data points into the archive
+struct cpio_file {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t mode;
+};
+
+struct filesystem* cpio_init();
+
+#endif
@@ -0,0 +1,465 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "fs/fat/fat.h"
+#include "ssd/bcache.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+struct fat_stats fat_stats;
+
+static bool fat_position_cache = true;
+
+static int fat_resolve(struct block_device* dev, void** out);
+static int fat_open(void* volume, const char* path, FILE_MODE mode, void** out);
+static int fat_read(void* volume, void* file, uint32_t offset, uint32_t size, void* out);
+static int fat_stat(void* volume, void* file, struct file_stat* stat);
+static int fat_close(void* file);
+static int fat_bmap(void* volume, void* file, uint32_t offset, uint32_t* lba, uint32_t* contiguous);
+
+static struct filesystem fat_fs = {
+    .resolve = fat_resolve,
+    .open = fat_open,
+    .read = fat_read,
+    .stat = fat_stat,
+    .close = fat_close,
+    .bmap = fat_bmap,
+    .name = "FAT"
+};
+
+struct filesystem* fat_init()
+{
+    memset(&fat_stats, 0, sizeof(fat_stats));
+    return &fat_fs;
+}
+
+// With it off every read walks the cluster chain from the start, only
+// there to measure what remembering the position saves
+void fat_set_position_cache(bool enable)
+{
+    fat_position_cache = enable;
+}
+
+// Fills vol from the boot sector of a volume starting at start, -EFSNOTUS
+// when it isn't a FAT16/FAT32 one this driver can read
+static int fat_parse_bpb(struct fat_volume* vol, uint8_t* sector, uint32_t start)
+{
+    struct fat_bpb* bpb = (struct fat_bpb*)sector;
+    if (sector[510] != 0x55 || sector[511] != 0xAA) {
+        return -EFSNOTUS;
+    }
+    uint32_t spc = bpb->sectors_per_cluster;
+    if (bpb->bytes_per_sector != RZOS_SECTOR_SIZE || spc == 0 || (spc & (spc - 1)) ||
+        bpb->reserved_sectors == 0 || bpb->fat_copies == 0) {
+        return -EFSNOTUS;
+    }
+
+    struct fat32_bpb_ext* ext = (struct fat32_bpb_ext*)(sector + sizeof(struct fat_bpb));
+    uint32_t fat_size = bpb->sectors_per_fat16 ? bpb->sectors_per_fat16 : ext->sectors_per_fat32;
+    uint32_t total = bpb->total_sectors16 ? bpb->total_sectors16 : bpb->total_sectors32;
+    uint32_t root_sectors = (bpb->root_dir_entries * sizeof(struct fat_dirent) + RZOS_SECTOR_SIZE - 1) / RZOS_SECTOR_SIZE;
+    uint32_t meta = bpb->reserved_sectors + bpb->fat_copies * fat_size + root_sectors;
+    if (fat_size == 0 || total <= meta || (uint64_t)start + total > vol->dev->sectors) {
+        return -EFSNOTUS;
+    }
+
+    // The cluster count alone decides the FAT type
+    uint32_t clusters = (total - meta) / spc;
+    if (clusters < FAT12_MAX_CLUSTERS) {
+        return -EFSNOTUS;
+    }
+    vol->type = clusters < FAT16_MAX_CLUSTERS ? FAT_TYPE_16 : FAT_TYPE_32;
+    if (vol->type == FAT_TYPE_32 && (bpb->root_dir_entries || ext->root_cluster < 2)) {
+        return -EFSNOTUS;
+    }
+
+    vol->start = start;
+    vol->sectors_per_cluster = spc;
+    vol->bytes_per_cluster = spc * RZOS_SECTOR_SIZE;
+    vol->fat_start = start + bpb->reserved_sectors;
+    vol->root_start = vol->fat_start + bpb->fat_copies * fat_size;
+    vol->root_sectors = root_sectors;
+    vol->root_cluster = vol->type == FAT_TYPE_32 ? ext->root_cluster : 0;
+    vol->data_start = vol->root_start + root_sectors;
+    vol->clusters = clusters;
+    return RZOS_ALL_OK;
+}
+
+static int fat_resolve(struct block_device* dev, void** out)
+{
+    struct fat_volume* vol = kzalloc(sizeof(struct fat_volume));
+    uint8_t* cache = kmalloc(FAT_CACHE_SECTORS * RZOS_SECTOR_SIZE);
+    uint8_t* bounce = kmalloc(RZOS_SECTOR_SIZE);
+    if (!vol || !cache || !bounce) {
+        kfree(vol);
+        kfree(cache);
+        kfree(bounce);
+        return -ENOMEM;
+    }
+    vol->dev = dev;
+    vol->bounce = bounce;
+    for (int i = 0; i < FAT_CACHE_SECTORS; i++) {
+        vol->cache[i].data = cache + i * RZOS_SECTOR_SIZE;
+    }
+
+    // A bare volume first, then the first FAT partition of an MBR
+    int res = bcache_read(dev, 0, 1, bounce);
+    if (res == RZOS_ALL_OK) {
+        res = fat_parse_bpb(vol, bounce, 0);
+    }
+    if (res == -EFSNOTUS && bounce[510] == 0x55 && bounce[511] == 0xAA) {
+        struct fat_mbr_partition parts[4];
+        memcpy(parts, bounce + FAT_MBR_PARTITION_TABLE, sizeof(parts));
+        for (int i = 0; i < 4 && res == -EFSNOTUS; i++) {
+            uint8_t type = parts[i].type;
+            if (type != 0x04 && type != 0x06 && type != 0x0B && type != 0x0C && type != 0x0E) {
+                continue;
+            }
+            if (parts[i].lba == 0 || parts[i].lba >= dev->sectors || bcache_read(dev, parts[i].lba, 1, bounce) < 0) {
+                continue;
+            }
+            res = fat_parse_bpb(vol, bounce, parts[i].lba);
+        }
+    }
+    if (res < 0) {
+        kfree(vol);
+        kfree(cache);
+        kfree(bounce);
+        return res;
+    }
+    *out = vol;
+    return RZOS_ALL_OK;
+}
+
+// Reads the FAT entry of cluster, the sector it lives in is usually cached
+// since a chain tends to stay within a few FAT sectors
+static int fat_get_entry(struct fat_volume* vol, uint32_t cluster, uint32_t* out)
+{
+    uint32_t offset = cluster * (vol->type == FAT_TYPE_32 ? 4 : 2);
+    uint32_t lba = vol->fat_start + offset / RZOS_SECTOR_SIZE;
+    struct fat_cache_sector* entry = &vol->cache[lba % FAT_CACHE_SECTORS];
+    if (entry->valid && entry->lba == lba) {
+        fat_stats.cache_hits++;
+    } else {
+        fat_stats.cache_misses++;
+        entry->valid = false;
+        if (bcache_read(vol->dev, lba, 1, entry->data) < 0) {
+            return -EIO;
+        }
+        entry->lba = lba;
+        entry->valid = true;
+    }
+
+    offset %= RZOS_SECTOR_SIZE;
+    if (vol->type == FAT_TYPE_32) {
+        *out = *(uint32_t*)(entry->data + offset) & FAT32_ENTRY_MASK;
+    } else {
+        *out = *(uint16_t*)(entry->data + offset);
+    }
+    return RZOS_ALL_OK;
+}
+
+static bool fat_is_eoc(struct fat_volume* vol, uint32_t entry)
+{
+    return entry >= (vol->type == FAT_TYPE_32 ? FAT32_EOC : FAT16_EOC);
+}
+
+// Finds the index-th cluster of file's chain. Returns -ENOFOUND when the
+// chain ends first and -EIO when it leads somewhere it can't.
+static int fat_cluster_at(struct fat_file* file, uint32_t index, uint32_t* out)
+{
+    struct fat_volume* vol = file->volume;
+    uint32_t cluster = file->first_cluster;
+    uint32_t i = 0;
+    if (fat_position_cache && file->cur_cluster && index >= file->cur_index) {
+        cluster = file->cur_cluster;
+        i = file->cur_index;
+    } else if (index > 0) {
+        fat_stats.chain_restarts++;
+    }
+
+    if (cluster < 2 || cluster >= vol->clusters + 2) {
+        return -EIO;
+    }
+    while (i < index) {
+        uint32_t next;
+        if (fat_get_entry(vol, cluster, &next) < 0) {
+            return -EIO;
+        }
+        fat_stats.chain_steps++;
+        if (fat_is_eoc(vol, next)) {
+            return -ENOFOUND;
+        }
+        if (next < 2 || next >= vol->clusters + 2) {
+            return -EIO;
+        }
+        cluster = next;
+        i++;
+    }
+    file->cur_cluster = cluster;
+    file->cur_index = index;
+    *out = cluster;
+    return RZOS_ALL_OK;
+}
+
+static uint32_t fat_cluster_lba(struct fat_volume* vol, uint32_t cluster)
+{
+    return vol->data_start + (cluster - 2) * vol->sectors_per_cluster;
+}
+
+// Copies size bytes starting offset bytes into the sector run at lba. Whole
+// sectors go straight to out, partial ones through the bounce sector.
+static int fat_read_bytes(struct fat_volume* vol, uint32_t lba, uint32_t offset, uint32_t size, uint8_t* out)
+{
+    lba += offset / RZOS_SECTOR_SIZE;
+    offset %= RZOS_SECTOR_SIZE;
+    while (size) {
+        if (offset == 0 && size >= RZOS_SECTOR_SIZE) {
+            uint32_t count = size / RZOS_SECTOR_SIZE;
+            if (bcache_read(vol->dev, lba, count, out) < 0) {
+                return -EIO;
+            }
+            lba += count;
+            out += count * RZOS_SECTOR_SIZE;
+            size -= count * RZOS_SECTOR_SIZE;
+            continue;
+        }
+        uint32_t n = RZOS_SECTOR_SIZE - offset;
+        if (n > size) {
+            n = size;
+        }
+        if (bcache_read(vol->dev, lba, 1, vol->bounce) < 0) {
+            return -EIO;
+        }
+        memcpy(out, vol->bounce + offset, n);
+        lba++;
+        offset = 0;
+        out += n;
+        size -= n;
+    }
+    return RZOS_ALL_OK;
+}
+
+// Reads sector index of a directory into the bounce sector, -ENOFOUND past
+// its end
+static int fat_dir_sector(struct fat_file* dir, uint32_t index)
+{
+    struct fat_volume* vol = dir->volume;
+    uint32_t lba;
+    if (dir->first_cluster == 0) {
+        if (index >= vol->root_sectors) {
+            return -ENOFOUND;
+        }
+        lba = vol->root_start + index;
+    } else {
+        uint32_t cluster;
+        int res = fat_cluster_at(dir, index / vol->sectors_per_cluster, &cluster);
+        if (res < 0) {
+            return res;
+        }
+        lba = fat_cluster_lba(vol, cluster) + index % vol->sectors_per_cluster;
+    }
+    return bcache_read(vol->dev, lba, 1, vol->bounce) < 0 ? -EIO : RZOS_ALL_OK;
+}
+
+static int fat_dir_find(struct fat_file* dir, const uint8_t* name, struct fat_dirent* out)
+{
+    for (uint32_t sector = 0;; sector++) {
+        int res = fat_dir_sector(dir, sector);
+        if (res < 0) {
+            return res;
+        }
+        struct fat_dirent* entries = (struct fat_dirent*)dir->volume->bounce;
+        for (uint32_t i = 0; i < RZOS_SECTOR_SIZE / sizeof(struct fat_dirent); i++) {
+            struct fat_dirent* entry = &entries[i];
+            if (entry->name[0] == FAT_DIRENT_END) {
+                return -ENOFOUND;
+            }
+            if (entry->name[0] == FAT_DIRENT_FREE || entry->attr == FAT_ATTR_LONG_NAME ||
+                (entry->attr & FAT_ATTR_VOLUME_ID)) {
+                continue;
+            }
+            if (memcmp(entry->name, (void*)name, 11) == 0) {
+                memcpy(out, entry, sizeof(struct fat_dirent));
+                return RZOS_ALL_OK;
+            }
+        }
+    }
+}
+
+// Turns one path component into the space-padded upper case 8.3 form
+static int fat_short_name(const char* part, uint32_t len, uint8_t* out)
+{
+    memset(out, ' ', 11);
+    if ((len == 1 && part[0] == '.') || (len == 2 && part[0] == '.' && part[1] == '.')) {
+        memcpy(out, (void*)part, len);
+        return RZOS_ALL_OK;
+    }
+    uint32_t dot = len;
+    for (uint32_t i = 0; i < len; i++) {
+        if (part[i] == '.') {
+            dot = i;
+        }
+    }
+    if (dot == 0 || dot > 8 || (dot < len && len - dot - 1 > 3)) {
+        return -EBADPATH;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (i == dot) {
+            continue;
+        }
+        char c = part[i];
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        out[i < dot ? i : 8 + i - dot - 1] = c;
+    }
+    return RZOS_ALL_OK;
+}
+
+static void fat_file_from_dirent(struct fat_volume* vol, struct fat_dirent* entry, struct fat_file* file)
+{
+    file->first_cluster = entry->cluster_low;
+    if (vol->type == FAT_TYPE_32) {
+        file->first_cluster |= (uint32_t)entry->cluster_high << 16;
+    }
+    // ".." of a top-level directory says 0 for the root
+    if (file->first_cluster == 0 && (entry->attr & FAT_ATTR_DIRECTORY)) {
+        file->first_cluster = vol->root_cluster;
+    }
+    file->size = entry->size;
+    file->attr = entry->attr;
+    file->cur_cluster = 0;
+    file->cur_index = 0;
+}
+
+static int fat_open(void* volume, const char* path, FILE_MODE mode, void** out)
+{
+    struct fat_volume* vol = volume;
+    if (mode != FILE_MODE_READ) {
+        return -ERDONLY;
+    }
+    struct fat_file* file = kzalloc(sizeof(struct fat_file));
+    if (!file) {
+        return -ENOMEM;
+    }
+    file->volume = vol;
+    file->first_cluster = vol->root_cluster;
+    file->attr = FAT_ATTR_DIRECTORY;
+
+    while (*path) {
+        uint32_t len = 0;
+        while (path[len] && path[len] != '/') {
+            len++;
+        }
+        if (len > 0) {
+            uint8_t name[11];
+            struct fat_dirent entry;
+            int res = fat_short_name(path, len, name);
+            if (res == RZOS_ALL_OK) {
+                res = (file->attr & FAT_ATTR_DIRECTORY) ? fat_dir_find(file, name, &entry) : -EBADPATH;
+            }
+            if (res < 0) {
+                kfree(file);
+                return res;
+            }
+            fat_file_from_dirent(vol, &entry, file);
+        }
+        path += path[len] ? len + 1 : len;
+    }
+    *out = file;
+    return RZOS_ALL_OK;
+}
+
+static int fat_read(void* volume, void* private, uint32_t offset, uint32_t size, void* out)
+{
+    struct fat_volume* vol = volume;
+    struct fat_file* file = private;
+    if (file->attr & FAT_ATTR_DIRECTORY) {
+        return -EINVARG;
+    }
+    fat_stats.reads++;
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+
+    uint8_t* ptr = out;
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t cluster;
+        uint32_t in_cluster = offset % vol->bytes_per_cluster;
+        int res = fat_cluster_at(file, offset / vol->bytes_per_cluster, &cluster);
+        if (res < 0) {
+            return -EIO;
+        }
+        uint32_t n = vol->bytes_per_cluster - in_cluster;
+        if (n > size - done) {
+            n = size - done;
+        }
+        if (fat_read_bytes(vol, fat_cluster_lba(vol, cluster), in_cluster, n, ptr) < 0) {
+            return -EIO;
+        }
+        ptr += n;
+        offset += n;
+        done += n;
+    }
+    return done;
+}
+
+static int fat_stat(void* volume, void* private, struct file_stat* stat)
+{
+    struct fat_file* file = private;
+    stat->filesize = file->size;
+    stat->flags = 0;
+    if (file->attr & FAT_ATTR_READ_ONLY) {
+        stat->flags |= FILE_STAT_READ_ONLY;
+    }
+    if (file->attr & FAT_ATTR_DIRECTORY) {
+        stat->flags |= FILE_STAT_DIRECTORY;
+    }
+    return RZOS_ALL_OK;
+}
+
+// The sector under offset and the bytes left in its cluster
+static int fat_bmap(void* volume, void* private, uint32_t offset, uint32_t* lba, uint32_t* contiguous)
+{
+    struct fat_volume* vol = volume;
+    struct fat_file* file = private;
+    if ((file->attr & FAT_ATTR_DIRECTORY) || offset >= file->size) {
+        return -EINVARG;
+    }
+    uint32_t cluster;
+    if (fat_cluster_at(file, offset / vol->bytes_per_cluster, &cluster) < 0) {
+        return -EIO;
+    }
+    uint32_t in_cluster = offset % vol->bytes_per_cluster;
+    *lba = fat_cluster_lba(vol, cluster) + in_cluster / RZOS_SECTOR_SIZE;
+    *contiguous = vol->bytes_per_cluster - in_cluster;
+    return RZOS_ALL_OK;
+}
+
+static int fat_close(void* private)
+{
+    kfree(private);
+    return RZOS_ALL_OK;
+}
+
+void fat_print_stats()
+{
+    print_serial("FAT: ");
+    kputdec(fat_stats.reads);
+    print_serial(" reads, ");
+    kputdec(fat_stats.chain_steps);
+    print_serial(" chain steps, ");
+    kputdec(fat_stats.chain_restarts);
+    print_serial(" restarts, FAT sector cache ");
+    kputdec(fat_stats.cache_hits);
+    print_serial(" hits/");
+    kputdec(fat_stats.cache_misses);
+    print_serial(" misses\n");
+}
@@ -0,0 +1,146 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "fs/file.h"
+#include "ssd/block.h"
+
+// FAT16 and FAT32, read-only, 8.3 names. Long-name entries are skipped.
+
+#define FAT_TYPE_16 16
+#define FAT_TYPE_32 32
+
+// Fewer clusters than these makes a volume FAT12 or FAT16
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+#define FAT16_EOC 0xFFF8
+#define FAT32_EOC 0x0FFFFFF8
+#define FAT32_ENTRY_MASK 0x0FFFFFFF
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT_ATTR_LONG_NAME 0x0F
+
+#define FAT_DIRENT_END 0x00
+#define FAT_DIRENT_FREE 0xE5
+
+// FAT sectors kept per volume, direct-mapped by LBA
+#define FAT_CACHE_SECTORS 16
+
+// Devices may also hold an MBR with the volume in one of its partitions
+#define FAT_MBR_PARTITION_TABLE 0x1BE
+
+struct fat_bpb {
+    uint8_t jmp[3];
+    uint8_t oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t fat_copies;
+    uint16_t root_dir_entries;
+    uint16_t total_sectors16;
+    uint8_t media_type;
+    uint16_t sectors_per_fat16;
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors32;
+} __attribute__((packed));
+
+// Follows the BPB on FAT32 volumes
+struct fat32_bpb_ext {
+    uint32_t sectors_per_fat32;
+    uint16_t flags;
+    uint16_t version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;
+    uint16_t backup_boot_sector;
+} __attribute__((packed));
+
+struct fat_dirent {
+    uint8_t name[11];
+    uint8_t attr;
+    uint8_t reserved;
+    uint8_t ctime_tenths;
+    uint16_t ctime;
+    uint16_t cdate;
+    uint16_t adate;
+    uint16_t cluster_high;
+    uint16_t mtime;
+    uint16_t mdate;
+    uint16_t cluster_low;
+    uint32_t size;
+} __attribute__((packed));
+
+struct fat_mbr_partition {
+    uint8_t status;
+    uint8_t chs_first[3];
+    uint8_t type;
+    uint8_t chs_last[3];
+    uint32_t lba;
+    uint32_t sectors;
+} __attribute__((packed));
+
+struct fat_cache_sector {
+    uint32_t lba;
+    bool valid;
+    uint8_t* data;
+};
+
+// A mounted volume, all LBAs are absolute on dev
+struct fat_volume {
+    struct block_device* dev;
+    int type;
+    uint32_t start;
+    uint32_t sectors_per_cluster;
+    uint32_t bytes_per_cluster;
+    uint32_t fat_start;
+    // FAT16 keeps the root directory in a fixed area before the data
+    uint32_t root_start;
+    uint32_t root_sectors;
+    // FAT32 keeps it in a cluster chain starting here
+    uint32_t root_cluster;
+    // Cluster 2, the first data cluster
+    uint32_t data_start;
+    uint32_t clusters;
+    struct fat_cache_sector cache[FAT_CACHE_SECTORS];
+    // Partial sectors of file data and directory sectors go through here
+    uint8_t* bounce;
+};
+
+// An open file or directory. A read remembers the cluster it ended in, so
+// the next one at or past it continues the chain from there.
+struct fat_file {
+    struct fat_volume* volume;
+    // 0 is the FAT16 root directory
+    uint32_t first_cluster;
+    uint32_t size;
+    uint8_t attr;
+    uint32_t cur_cluster;
+    uint32_t cur_index;
+};
+
+struct fat_stats {
+    uint32_t reads;
+    // FAT entries followed to find the cluster of a file offset
+    uint32_t chain_steps;
+    // Reads that walked the chain from the first cluster again
+    uint32_t chain_restarts;
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+};
+
+extern struct fat_stats fat_stats;
+
+struct filesystem* fat_init();
+void fat_set_position_cache(bool enable);
+void fat_print_stats();
+
+#endif
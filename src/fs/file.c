@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "fs/file.h"
+#include "fs/fat/fat.h"
+#include "fs/cpio/cpio.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "status.h"
+
+static struct filesystem* filesystems[RZOS_MAX_FILESYSTEMS];
+static struct fs_volume fs_volumes[BLOCK_MAX_DEVICES];
+static struct file_descriptor* file_descriptors[RZOS_MAX_FILE_DESCRIPTORS];
+
+int fs_insert_filesystem(struct filesystem* filesystem)
+{
+    if (!filesystem) {
+        return -EINVARG;
+    }
+    for (int i = 0; i < RZOS_MAX_FILESYSTEMS; i++) {
+        if (!filesystems[i]) {
+            filesystems[i] = filesystem;
+            return RZOS_ALL_OK;
+        }
+    }
+    return -ENOMEM;
+}
+
+void fs_init()
+{
+    memset(filesystems, 0, sizeof(filesystems));
+    memset(fs_volumes, 0, sizeof(fs_volumes));
+    memset(file_descriptors, 0, sizeof(file_descriptors));
+    // cpio only takes ramdisks, asking it first keeps FAT from reading them
+    fs_insert_filesystem(cpio_init());
+    fs_insert_filesystem(fat_init());
+}
+
+// Asks each driver in turn whether dev holds its filesystem
+int fs_mount(struct block_device* dev)
+{
+    if (!dev || dev->id >= BLOCK_MAX_DEVICES) {
+        return -EINVARG;
+    }
+    if (fs_volumes[dev->id].filesystem) {
+        return -EISTKN;
+    }
+    for (int i = 0; i < RZOS_MAX_FILESYSTEMS; i++) {
+        if (!filesystems[i]) {
+            continue;
+        }
+        void* private = NULL;
+        if (filesystems[i]->resolve(dev, &private) == RZOS_ALL_OK) {
+            fs_volumes[dev->id].filesystem = filesystems[i];
+            fs_volumes[dev->id].dev = dev;
+            fs_volumes[dev->id].private = private;
+            return RZOS_ALL_OK;
+        }
+    }
+    return -EFSNOTUS;
+}
+
+void fs_mount_all()
+{
+    for (uint32_t id = 0; id < BLOCK_MAX_DEVICES; id++) {
+        struct block_device* dev = block_get(id);
+        if (!dev || fs_mount(dev) != RZOS_ALL_OK) {
+            continue;
+        }
+        print_serial(dev->name);
+        print_serial(": ");
+        print_serial(fs_volumes[id].filesystem->name);
+        print_serial(" volume mounted\n");
+    }
+}
+
+static struct file_descriptor* file_get_descriptor(int fd)
+{
+    if (fd <= 0 || fd > RZOS_MAX_FILE_DESCRIPTORS) {
+        return NULL;
+    }
+    return file_descriptors[fd - 1];
+}
+
+static int file_new_descriptor(struct file_descriptor** out)
+{
+    for (int i = 0; i < RZOS_MAX_FILE_DESCRIPTORS; i++) {
+        if (file_descriptors[i]) {
+            continue;
+        }
+        struct file_descriptor* desc = kzalloc(sizeof(struct file_descriptor));
+        if (!desc) {
+            return -ENOMEM;
+        }
+        desc->index = i + 1;
+        desc->refs = 1;
+        file_descriptors[i] = desc;
+        *out = desc;
+        return RZOS_ALL_OK;
+    }
+    return -ENOMEM;
+}
+
+// Drops a reference, the last one closes the file
+static int file_release(struct file_descriptor* desc)
+{
+    if (--desc->refs) {
+        return RZOS_ALL_OK;
+    }
+    int res = desc->volume->filesystem->close(desc->private);
+    kfree(desc);
+    return res;
+}
+
+static FILE_MODE file_get_mode_by_string(const char* str)
+{
+    if (str[0] == 'r' && str[1] == 0) {
+        return FILE_MODE_READ;
+    }
+    if (str[0] == 'w' && str[1] == 0) {
+        return FILE_MODE_WRITE;
+    }
+    if (str[0] == 'a' && str[1] == 0) {
+        return FILE_MODE_APPEND;
+    }
+    return FILE_MODE_INVALID;
+}
+
+// Splits "N:/rest" into the volume on device N and the path within it
+static int file_resolve_path(const char* filename, struct fs_volume** volume, const char** path)
+{
+    int len = 0;
+    while (filename[len]) {
+        if (++len >= RZOS_MAX_PATH) {
+            return -EBADPATH;
+        }
+    }
+    if (len < 3 || filename[0] < '0' || filename[0] > '9' || filename[1] != ':' || filename[2] != '/') {
+        return -EBADPATH;
+    }
+    uint32_t id = filename[0] - '0';
+    if (id >= BLOCK_MAX_DEVICES || !fs_volumes[id].filesystem) {
+        return -EIO;
+    }
+    *volume = &fs_volumes[id];
+    *path = filename + 3;
+    return RZOS_ALL_OK;
+}
+
+// Returns a descriptor above 0, or a negative status
+int fopen(const char* filename, const char* mode_str)
+{
+    struct fs_volume* volume;
+    const char* path;
+    int res = file_resolve_path(filename, &volume, &path);
+    if (res < 0) {
+        return res;
+    }
+    FILE_MODE mode = file_get_mode_by_string(mode_str);
+    if (mode == FILE_MODE_INVALID) {
+        return -EINVARG;
+    }
+
+    void* private = NULL;
+    res = volume->filesystem->open(volume->private, path, mode, &private);
+    if (res < 0) {
+        return res;
+    }
+    struct file_descriptor* desc = NULL;
+    res = file_new_descriptor(&desc);
+    if (res < 0) {
+        volume->filesystem->close(private);
+        return res;
+    }
+    desc->volume = volume;
+    desc->private = private;
+    desc->pos = 0;
+    return desc->index;
+}
+
+// Reads nmemb items of size bytes from the file position and advances it.
+// Returns the number of whole items read, fewer than nmemb at end of file.
+int fread(void* ptr, uint32_t size, uint32_t nmemb, int fd)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc || !ptr || size == 0) {
+        return -EINVARG;
+    }
+    uint64_t total = (uint64_t)size * nmemb;
+    if (total > 0x7FFFFFFF) {
+        return -EINVARG;
+    }
+    int res = desc->volume->filesystem->read(desc->volume->private, desc->private, desc->pos, total, ptr);
+    if (res < 0) {
+        return res;
+    }
+    desc->pos += res;
+    return res / size;
+}
+
+int fseek(int fd, int offset, FILE_SEEK_MODE whence)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc) {
+        return -EINVARG;
+    }
+    int64_t base;
+    switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = desc->pos;
+            break;
+        case SEEK_END: {
+            struct file_stat stat;
+            int res = desc->volume->filesystem->stat(desc->volume->private, desc->private, &stat);
+            if (res < 0) {
+                return res;
+            }
+            base = stat.filesize;
+            break;
+        }
+        default:
+            return -EINVARG;
+    }
+    int64_t pos = base + offset;
+    if (pos < 0 || pos > 0xFFFFFFFF) {
+        return -EINVARG;
+    }
+    desc->pos = pos;
+    return RZOS_ALL_OK;
+}
+
+int fstat(int fd, struct file_stat* stat)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc || !stat) {
+        return -EINVARG;
+    }
+    return desc->volume->filesystem->stat(desc->volume->private, desc->private, stat);
+}
+
+int fclose(int fd)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc) {
+        return -EINVARG;
+    }
+    file_descriptors[desc->index - 1] = NULL;
+    return file_release(desc);
+}
+
+int file_hold(int fd, struct file_descriptor** out)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc) {
+        return -EINVARG;
+    }
+    desc->refs++;
+    *out = desc;
+    return RZOS_ALL_OK;
+}
+
+void file_put(struct file_descriptor* desc)
+{
+    file_release(desc);
+}
+
+// Positional read that leaves the file position alone, returns the bytes read
+int file_read_at(struct file_descriptor* desc, uint32_t offset, uint32_t size, void* out)
+{
+    return desc->volume->filesystem->read(desc->volume->private, desc->private, offset, size, out);
+}
+
+int file_bmap(struct file_descriptor* desc, uint32_t offset, uint32_t* lba, uint32_t* contiguous)
+{
+    if (!desc->volume->filesystem->bmap) {
+        return -EUNIMP;
+    }
+    return desc->volume->filesystem->bmap(desc->volume->private, desc->private, offset, lba, contiguous);
+}
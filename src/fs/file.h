@@ -0,0 +1,93 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+#include "config.h"
+#include "ssd/block.h"
+
+// Paths name the block device by number, "0:/DIR/FILE.TXT" is on the boot
+// disk. Each device holds at most one volume, mounted by fs_mount.
+
+typedef unsigned int FILE_SEEK_MODE;
+enum {
+    SEEK_SET,
+    SEEK_CUR,
+    SEEK_END
+};
+
+typedef unsigned int FILE_MODE;
+enum {
+    FILE_MODE_READ,
+    FILE_MODE_WRITE,
+    FILE_MODE_APPEND,
+    FILE_MODE_INVALID
+};
+
+typedef unsigned int FILE_STAT_FLAGS;
+enum {
+    FILE_STAT_READ_ONLY = 0x01,
+    FILE_STAT_DIRECTORY = 0x02
+};
+
+struct file_stat {
+    FILE_STAT_FLAGS flags;
+    uint32_t filesize;
+};
+
+// Driver hooks. resolve returns -EFSNOTUS when dev doesn't hold the driver's
+// filesystem, otherwise its per-volume state in *out. Reads are positional,
+// the file position lives in the descriptor, and return the bytes read.
+typedef int (*FS_RESOLVE_FUNCTION)(struct block_device* dev, void** out);
+typedef int (*FS_OPEN_FUNCTION)(void* volume, const char* path, FILE_MODE mode, void** out);
+typedef int (*FS_READ_FUNCTION)(void* volume, void* file, uint32_t offset, uint32_t size, void* out);
+typedef int (*FS_STAT_FUNCTION)(void* volume, void* file, struct file_stat* stat);
+typedef int (*FS_CLOSE_FUNCTION)(void* file);
+// Optional. Finds the device sector holding byte offset of the file and how
+// many bytes from there on are contiguous on the device.
+typedef int (*FS_BMAP_FUNCTION)(void* volume, void* file, uint32_t offset, uint32_t* lba, uint32_t* contiguous);
+
+struct filesystem {
+    FS_RESOLVE_FUNCTION resolve;
+    FS_OPEN_FUNCTION open;
+    FS_READ_FUNCTION read;
+    FS_STAT_FUNCTION stat;
+    FS_CLOSE_FUNCTION close;
+    FS_BMAP_FUNCTION bmap;
+    char name[20];
+};
+
+struct fs_volume {
+    struct filesystem* filesystem;
+    struct block_device* dev;
+    void* private;
+};
+
+struct file_descriptor {
+    // Descriptors handed out start at 1
+    int index;
+    struct fs_volume* volume;
+    void* private;
+    uint32_t pos;
+    // The table's reference plus one per file_hold, the file is closed when
+    // the last one goes
+    uint32_t refs;
+};
+
+void fs_init();
+int fs_insert_filesystem(struct filesystem* filesystem);
+int fs_mount(struct block_device* dev);
+void fs_mount_all();
+
+int fopen(const char* filename, const char* mode_str);
+int fread(void* ptr, uint32_t size, uint32_t nmemb, int fd);
+int fseek(int fd, int offset, FILE_SEEK_MODE whence);
+int fstat(int fd, struct file_stat* stat);
+int fclose(int fd);
+
+// For mappings, which keep using a file after its descriptor is closed
+int file_hold(int fd, struct file_descriptor** out);
+void file_put(struct file_descriptor* desc);
+int file_read_at(struct file_descriptor* desc, uint32_t offset, uint32_t size, void* out);
+int file_bmap(struct file_descriptor* desc, uint32_t offset, uint32_t* lba, uint32_t* contiguous);
+
+#endif
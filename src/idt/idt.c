@@ -3,10 +3,6 @@
 #include "idt/idt.h"
 #include "shell/shell.h"
 
-/* extern ASM stubs for specific ISRs (defined in isr.asm) */
-extern void isr14();
-extern void isr_common(void); /* if you use a common stub */
-
 /* IDT array and pointer */
 static struct idt_entry idt_entries[256];
 static struct idt_ptr   idt_ptr;
@@ -27,8 +23,8 @@ void idt_init(void) {
         idt_set_gate(i, 0, 0x08, 0x00);
     }
 
-    /* Set the page fault gate (interrupt 14) to our stub */
-    idt_set_gate(14, (uint32_t)isr14, 0x08, 0x8E);
+    /* CPU exceptions, the page fault one resolves demand paging */
+    isr_install();
 
     /* Fill idt_ptr and load */
     idt_ptr.limit = (sizeof(struct idt_entry) * 256) - 1;
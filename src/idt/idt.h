@@ -23,8 +23,8 @@ void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags);
 // Install ISRs
 void isr_install();
 
-// Page fault handler
-void page_fault_handler(uint32_t fault_addr);
+// Page fault handler, resolves demand-zero faults through vm_handle_fault
+void page_fault_handler(uint32_t fault_addr, uint32_t err_code);
 
 
 
@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "idt/irq.h"
+#include "idt/idt.h"
+#include "io/io.h"
+#include "status.h"
+
+extern void irq0();
+extern void irq1();
+extern void irq2();
+extern void irq3();
+extern void irq4();
+extern void irq5();
+extern void irq6();
+extern void irq7();
+extern void irq8();
+extern void irq9();
+extern void irq10();
+extern void irq11();
+extern void irq12();
+extern void irq13();
+extern void irq14();
+extern void irq15();
+
+struct irq_stats irq_stats;
+static IRQ_HANDLER irq_handlers[IRQ_COUNT][IRQ_MAX_SHARED];
+
+// A write to an unused port gives the PIC time to settle between init words
+static void pic_wait()
+{
+    outb(0x80, 0);
+}
+
+static void pic_remap()
+{
+    // ICW1: start init, ICW4 follows
+    outb(PIC1_COMMAND, 0x11);
+    pic_wait();
+    outb(PIC2_COMMAND, 0x11);
+    pic_wait();
+    // ICW2: vector offsets
+    outb(PIC1_DATA, IRQ_VECTOR_BASE);
+    pic_wait();
+    outb(PIC2_DATA, IRQ_VECTOR_BASE + 8);
+    pic_wait();
+    // ICW3: slave on IRQ2
+    outb(PIC1_DATA, 1 << IRQ_CASCADE);
+    pic_wait();
+    outb(PIC2_DATA, IRQ_CASCADE);
+    pic_wait();
+    // ICW4: 8086 mode
+    outb(PIC1_DATA, 0x01);
+    pic_wait();
+    outb(PIC2_DATA, 0x01);
+    pic_wait();
+
+    // Everything masked except the cascade, drivers unmask their own line
+    outb(PIC1_DATA, 0xFF & ~(1 << IRQ_CASCADE));
+    outb(PIC2_DATA, 0xFF);
+}
+
+void irq_init()
+{
+    pic_remap();
+    idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E);
+    idt_set_gate(33, (uint32_t)irq1, 0x08, 0x8E);
+    idt_set_gate(34, (uint32_t)irq2, 0x08, 0x8E);
+    idt_set_gate(35, (uint32_t)irq3, 0x08, 0x8E);
+    idt_set_gate(36, (uint32_t)irq4, 0x08, 0x8E);
+    idt_set_gate(37, (uint32_t)irq5, 0x08, 0x8E);
+    idt_set_gate(38, (uint32_t)irq6, 0x08, 0x8E);
+    idt_set_gate(39, (uint32_t)irq7, 0x08, 0x8E);
+    idt_set_gate(40, (uint32_t)irq8, 0x08, 0x8E);
+    idt_set_gate(41, (uint32_t)irq9, 0x08, 0x8E);
+    idt_set_gate(42, (uint32_t)irq10, 0x08, 0x8E);
+    idt_set_gate(43, (uint32_t)irq11, 0x08, 0x8E);
+    idt_set_gate(44, (uint32_t)irq12, 0x08, 0x8E);
+    idt_set_gate(45, (uint32_t)irq13, 0x08, 0x8E);
+    idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
+    idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
+    for (int i = 0; i < IRQ_COUNT; i++) {
+        isr_register_handler(IRQ_VECTOR_BASE + i, irq_dispatch);
+    }
+}
+
+// Adds handler to the line, or clears the line when handler is NULL
+int irq_register_handler(int irq, IRQ_HANDLER handler)
+{
+    if (irq < 0 || irq >= IRQ_COUNT) {
+        return -EINVARG;
+    }
+    for (int i = 0; i < IRQ_MAX_SHARED; i++) {
+        if (!handler) {
+            irq_handlers[irq][i] = NULL;
+        } else if (!irq_handlers[irq][i]) {
+            irq_handlers[irq][i] = handler;
+            return RZOS_ALL_OK;
+        }
+    }
+    return handler ? -EISTKN : RZOS_ALL_OK;
+}
+
+void irq_mask(int irq)
+{
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, insb(port) | (1 << (irq & 7)));
+}
+
+void irq_unmask(int irq)
+{
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, insb(port) & ~(1 << (irq & 7)));
+}
+
+// IRQ 7 and 15 can fire without a real request behind them. The in-service
+// register tells the two apart, and a spurious one must not get an EOI.
+static int irq_is_spurious(int irq)
+{
+    if (irq == 7) {
+        outb(PIC1_COMMAND, 0x0B);
+        return !(insb(PIC1_COMMAND) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, 0x0B);
+        if (!(insb(PIC2_COMMAND) & 0x80)) {
+            // The master still saw the cascade line go up
+            outb(PIC1_COMMAND, PIC_EOI);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void irq_dispatch(registers_t* regs)
+{
+    int irq = regs->int_no - IRQ_VECTOR_BASE;
+    if (irq_is_spurious(irq)) {
+        irq_stats.spurious++;
+        return;
+    }
+
+    irq_stats.count[irq]++;
+    for (int i = 0; i < IRQ_MAX_SHARED && irq_handlers[irq][i]; i++) {
+        irq_handlers[irq][i](regs);
+    }
+
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
@@ -0,0 +1,73 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "idt/isr.h"
+
+// The two 8259 PICs are remapped so IRQ 0-15 land on vectors 32-47,
+// clear of the CPU exceptions
+#define IRQ_VECTOR_BASE 32
+#define IRQ_COUNT 16
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+
+#define IRQ_CASCADE 2
+#define IRQ_ATA_PRIMARY 14
+// PCI interrupt lines can be shared, every handler on a line runs and checks
+// its own device
+#define IRQ_MAX_SHARED 4
+
+typedef void (*IRQ_HANDLER)(registers_t* regs);
+
+struct irq_stats {
+    uint32_t count[IRQ_COUNT];
+    uint32_t spurious;
+};
+
+extern struct irq_stats irq_stats;
+
+void irq_init();
+int irq_register_handler(int irq, IRQ_HANDLER handler);
+void irq_mask(int irq);
+void irq_unmask(int irq);
+void irq_dispatch(registers_t* regs);
+
+// Interrupt enable flag in EFLAGS
+#define EFLAGS_IF 0x200
+
+static inline bool irq_enabled()
+{
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0" : "=r"(flags) :: "memory");
+    return flags & EFLAGS_IF;
+}
+
+static inline void irq_enable()
+{
+    __asm__ volatile("sti" ::: "memory");
+}
+
+static inline void irq_disable()
+{
+    __asm__ volatile("cli" ::: "memory");
+}
+
+// Saves EFLAGS and disables interrupts, pair with irq_restore
+static inline uint32_t irq_save()
+{
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+    __asm__ volatile("push %0; popf" :: "r"(flags) : "memory", "cc");
+}
+
+#endif
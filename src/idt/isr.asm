@@ -4,12 +4,18 @@ global isr8, isr9, isr10, isr11, isr12, isr13, isr14, isr15
 global isr16, isr17, isr18, isr19, isr20, isr21, isr22, isr23
 global isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31
 global isr_common_stub
+global irq0, irq1, irq2, irq3, irq4, irq5, irq6, irq7
+global irq8, irq9, irq10, irq11, irq12, irq13, irq14, irq15
+global isr48, isr255
 
 extern isr_handler  ; C handler
 
 isr_common_stub:
     pusha
+    cld          ; the C code expects DF clear
+    push esp     ; registers_t* for isr_handler
     call isr_handler
+    add esp, 4
     popa
     add esp, 8   ; remove error code + int number
     iretd
@@ -21,6 +27,14 @@ isr%1:
     jmp isr_common_stub
 %endmacro
 
+; Hardware interrupts, remapped by the PIC to vectors 32-47
+%macro IRQ 2
+irq%1:
+    push dword 0
+    push dword %2
+    jmp isr_common_stub
+%endmacro
+
 %macro ISR_ERR 1
 isr%1:
     push dword %1
@@ -44,11 +58,11 @@ ISR_ERR   13
 ISR_ERR   14
 ISR_NOERR 15
 ISR_NOERR 16
-ISR_NOERR 17
+ISR_ERR   17
 ISR_NOERR 18
 ISR_NOERR 19
 ISR_NOERR 20
-ISR_NOERR 21
+ISR_ERR   21
 ISR_NOERR 22
 ISR_NOERR 23
 ISR_NOERR 24
@@ -56,6 +70,27 @@ ISR_NOERR 25
 ISR_NOERR 26
 ISR_NOERR 27
 ISR_NOERR 28
-ISR_NOERR 29
-ISR_NOERR 30
+ISR_ERR   29
+ISR_ERR   30
 ISR_NOERR 31
+
+IRQ 0, 32
+IRQ 1, 33
+IRQ 2, 34
+IRQ 3, 35
+IRQ 4, 36
+IRQ 5, 37
+IRQ 6, 38
+IRQ 7, 39
+IRQ 8, 40
+IRQ 9, 41
+IRQ 10, 42
+IRQ 11, 43
+IRQ 12, 44
+IRQ 13, 45
+IRQ 14, 46
+IRQ 15, 47
+
+; Local APIC timer and spurious vectors, see idt/timer.h
+ISR_NOERR 48
+ISR_NOERR 255
@@ -3,6 +3,11 @@
 #include "utils.h"
 
 #include "idt/idt.h"
+#include "idt/isr.h"
+#include "idt/irq.h"
+#include "memory/page.h"
+#include "memory/memory.h"
+#include "status.h"
 
 extern void isr0();
 extern void isr1();
@@ -37,6 +42,8 @@ extern void isr29();
 extern void isr30();
 extern void isr31();
 
+static void isr_page_fault(registers_t* r);
+
 /* Install ISRs into the IDT */
 void isr_install(void) {
     idt_set_gate(0,  (uint32_t)isr0,  0x08, 0x8E);
@@ -71,25 +78,78 @@ void isr_install(void) {
     idt_set_gate(29, (uint32_t)isr29, 0x08, 0x8E);
     idt_set_gate(30, (uint32_t)isr30, 0x08, 0x8E);
     idt_set_gate(31, (uint32_t)isr31, 0x08, 0x8E);
+    isr_register_handler(ISR_PAGE_FAULT, isr_page_fault);
+}
+
+
+void page_fault_handler(uint32_t fault_addr, uint32_t err_code) {
+    if (vm_handle_fault(fault_addr, err_code) == RZOS_ALL_OK) {
+        return;
+    }
+
+    print_serial("Page Fault! addr ");
+    kputhex(fault_addr);
+    print_serial(" err ");
+    kputhex(err_code);
+    print_serial("\n");
+    // Returning would just fault again
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
 }
 
+// The fault may have hit a store in memcpy_sse2 or memset_sse2, and
+// resolving it runs them again, so the XMM registers are put back before the
+// store restarts
+static void isr_page_fault(registers_t* r) {
+    uint32_t cr2;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    struct memory_sse_state sse;
+    memory_sse_save(&sse);
+    page_fault_handler(cr2, r->err_code);
+    memory_sse_restore(&sse);
+}
+
+// Handlers per vector, isr_handler only indexes this. Interrupts reach it
+// with IF clear, the gates are all interrupt gates.
+static ISR_HANDLER isr_handlers[ISR_VECTORS];
+struct isr_stats isr_stats;
 
-struct regs {
-    uint32_t gs, fs, es, ds;
-    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
-    uint32_t int_no, err_code;
-    uint32_t eip, cs, eflags, useresp, ss;
-};
+// Sets the handler of a vector, or clears it when handler is NULL
+int isr_register_handler(int vector, ISR_HANDLER handler) {
+    if (vector < 0 || vector >= ISR_VECTORS) {
+        return -EINVARG;
+    }
+    if (handler && isr_handlers[vector]) {
+        return -EISTKN;
+    }
+    isr_handlers[vector] = handler;
+    return RZOS_ALL_OK;
+}
 
-void isr_handler(struct regs *r) {
-    print_serial("Interrupt received: ");
-    char buf[16];
-    int_to_hex(r->int_no,buf);
-    print_serial(buf);
+// An exception nobody handles would only fault again on return
+static void isr_unhandled(registers_t* r) {
+    isr_stats.unhandled++;
+    if (r->int_no >= ISR_EXCEPTIONS) {
+        return;
+    }
+    print_serial("Exception ");
+    kputdec(r->int_no);
+    print_serial(" err ");
+    kputhex(r->err_code);
+    print_serial(" eip ");
+    kputhex(r->eip);
     print_serial("\n");
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
 
-    if (r->int_no == 14) {
-        print_serial("Page Fault!\n");
-        // handle page fault here
+void isr_handler(registers_t *r) {
+    ISR_HANDLER handler = isr_handlers[r->int_no & (ISR_VECTORS - 1)];
+    if (handler) {
+        handler(r);
+        return;
     }
+    isr_unhandled(r);
 }
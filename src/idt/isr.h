@@ -3,14 +3,27 @@
 #include "utils.h"
 #include <stdint.h>
 
-/* registers structure used by isr_handler (optional) */
+/* registers structure used by isr_handler, as laid out by isr_common_stub */
 typedef struct {
-    uint32_t ds;
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
     uint32_t int_no, err_code;
     uint32_t eip, cs, eflags, useresp, ss;
 } registers_t;
 
+#define ISR_VECTORS 256
+#define ISR_EXCEPTIONS 32
+#define ISR_BREAKPOINT 3
+#define ISR_PAGE_FAULT 14
+
+typedef void (*ISR_HANDLER)(registers_t* regs);
+
+struct isr_stats {
+    // Interrupts on a vector with a gate but no handler
+    uint32_t unhandled;
+};
+
+extern struct isr_stats isr_stats;
+
 /* Declare ASM ISR stubs so C can refer to them */
 extern void isr0(void);
 extern void isr1(void);
@@ -44,9 +57,12 @@ extern void isr28(void);
 extern void isr29(void);
 extern void isr30(void);
 extern void isr31(void);
+extern void isr48(void);
+extern void isr255(void);
 
 /* C install function & handler */
 void isr_install(void);
-void isr_handler(registers_t regs);
+int isr_register_handler(int vector, ISR_HANDLER handler);
+void isr_handler(registers_t *regs);
 
 #endif
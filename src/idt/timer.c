@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "idt/timer.h"
+#include "idt/idt.h"
+#include "idt/isr.h"
+#include "idt/irq.h"
+#include "io/io.h"
+#include "memory/page.h"
+#include "shell/shell.h"
+#include "utils.h"
+#include "status.h"
+
+#define CPUID_FEATURE_APIC (1 << 9)
+
+struct timer_stats timer_stats;
+static volatile uint32_t* lapic = NULL;
+
+static uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+}
+
+static uint64_t timer_rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void timer_lapic_handler(registers_t* regs)
+{
+    timer_stats.ticks++;
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+// Spurious APIC interrupts must not get an EOI
+static void timer_lapic_spurious(registers_t* regs)
+{
+    timer_stats.spurious++;
+}
+
+// The PIC EOI is sent by irq_dispatch
+static void timer_pit_handler(registers_t* regs)
+{
+    timer_stats.ticks++;
+}
+
+// Maps the local APIC and counts its timer against the TSC. Fails when there
+// is no APIC or the firmware turned it off, which only a reset undoes.
+static int timer_lapic_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!RZOS_TIMER_USE_LAPIC || !(edx & CPUID_FEATURE_APIC)) {
+        return -EUNIMP;
+    }
+    uint64_t base = timer_rdmsr(LAPIC_BASE_MSR);
+    if (!(base & LAPIC_BASE_ENABLE)) {
+        return -EUNIMP;
+    }
+    lapic = paging_map_mmio((uint32_t)base & LAPIC_BASE_MASK, PAGE_SIZE);
+    if (!lapic) {
+        return -ENOMEM;
+    }
+
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uint32_t)isr48, 0x08, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint32_t)isr255, 0x08, 0x8E);
+    isr_register_handler(LAPIC_TIMER_VECTOR, timer_lapic_handler);
+    isr_register_handler(LAPIC_SPURIOUS_VECTOR, timer_lapic_spurious);
+    // Software enable, the firmware's LINT0 setup keeps passing PIC interrupts
+    lapic_write(LAPIC_REG_SVR, lapic_read(LAPIC_REG_SVR) | LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TPR, 0);
+
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t end = rdtsc() + (uint64_t)tsc_mhz * LAPIC_CALIBRATE_US;
+    while (rdtsc() < end) {
+    }
+    uint32_t counted = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+    timer_stats.lapic_counts_per_ms = (uint32_t)udiv64((uint64_t)counted * 1000, LAPIC_CALIBRATE_US);
+    if (timer_stats.lapic_counts_per_ms == 0) {
+        return -EIO;
+    }
+    timer_stats.lapic = true;
+    return RZOS_ALL_OK;
+}
+
+// Changes the period of a running timer
+int timer_set_frequency(uint32_t hz)
+{
+    if (hz == 0) {
+        return -EINVARG;
+    }
+    if (timer_stats.lapic) {
+        uint32_t count = (uint32_t)udiv64((uint64_t)timer_stats.lapic_counts_per_ms * 1000, hz);
+        if (count == 0) {
+            return -EINVARG;
+        }
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_REG_TIMER_INITIAL, count);
+    } else {
+        uint32_t divisor = PIT_FREQUENCY / hz;
+        if (divisor == 0 || divisor > 0xFFFF) {
+            return -EINVARG;
+        }
+        // Channel 0, lobyte/hibyte, mode 2 rate generator
+        outb(PIT_COMMAND, 0x34);
+        outb(PIT_CHANNEL0, divisor & 0xFF);
+        outb(PIT_CHANNEL0, divisor >> 8);
+    }
+    timer_stats.hz = hz;
+    return RZOS_ALL_OK;
+}
+
+// Needs the IDT, the PIC, paging and a calibrated TSC. Ticks start once
+// interrupts are enabled.
+int timer_init(uint32_t hz)
+{
+    if (timer_lapic_init() != RZOS_ALL_OK) {
+        timer_stats.lapic = false;
+        int res = irq_register_handler(IRQ_TIMER, timer_pit_handler);
+        if (res < 0) {
+            return res;
+        }
+        irq_unmask(IRQ_TIMER);
+    }
+    return timer_set_frequency(hz);
+}
+
+uint32_t timer_ticks()
+{
+    return *(volatile uint32_t*)&timer_stats.ticks;
+}
+
+void timer_print_stats()
+{
+    print_serial("timer: ");
+    print_serial(timer_stats.lapic ? "local APIC" : "PIT");
+    print_serial(" at ");
+    kputdec(timer_stats.hz);
+    print_serial(" Hz, ");
+    kputdec(timer_ticks());
+    print_serial(" ticks");
+    if (timer_stats.lapic) {
+        print_serial(", ");
+        kputdec(timer_stats.lapic_counts_per_ms);
+        print_serial(" counts/ms, ");
+        kputdec(timer_stats.spurious);
+        print_serial(" spurious");
+    }
+    print_serial("\n");
+}
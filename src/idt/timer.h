@@ -0,0 +1,58 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+// Periodic timer interrupt. The local APIC timer is used when the CPU has
+// one, PIT channel 0 on IRQ 0 otherwise. Either way each period bumps the
+// tick count and wakes a halted CPU.
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define IRQ_TIMER 0
+
+// Vectors of the isr48 and isr255 stubs
+#define LAPIC_TIMER_VECTOR 48
+#define LAPIC_SPURIOUS_VECTOR 255
+
+#define LAPIC_BASE_MSR 0x1B
+#define LAPIC_BASE_ENABLE 0x800
+#define LAPIC_BASE_MASK 0xFFFFF000
+
+// Register offsets
+#define LAPIC_REG_TPR 0x80
+#define LAPIC_REG_EOI 0xB0
+#define LAPIC_REG_SVR 0xF0
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+// Divide configuration 3 counts the bus clock divided by 16
+#define LAPIC_TIMER_DIVIDE_16 0x3
+// How long the APIC timer is counted against the TSC
+#define LAPIC_CALIBRATE_US 1000
+
+struct timer_stats {
+    uint32_t ticks;
+    uint32_t hz;
+    bool lapic;
+    // APIC timer counts per millisecond, after the divider
+    uint32_t lapic_counts_per_ms;
+    uint32_t spurious;
+};
+
+extern struct timer_stats timer_stats;
+
+int timer_init(uint32_t hz);
+int timer_set_frequency(uint32_t hz);
+uint32_t timer_ticks();
+void timer_print_stats();
+
+#endif
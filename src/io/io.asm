@@ -4,6 +4,10 @@ global insb
 global insw
 global outb
 global outw
+global insl
+global outl
+global insw_buffer
+global outsw_buffer
 
 
 insb:
@@ -49,4 +53,57 @@ outw:
 	out dx,ax
 
 	pop ebp
-	ret	
\ No newline at end of file
+	ret
+
+insl:
+	push ebp
+	mov ebp,esp
+
+	mov edx,[ebp+8]
+	in eax,dx
+
+	pop ebp
+	ret
+
+outl:
+	push ebp
+	mov ebp,esp
+
+	mov eax,[ebp+12]
+	mov edx,[ebp+8]
+	out dx,eax
+
+	pop ebp
+	ret
+
+; insw_buffer(port, buf, words): read a run of words from one port
+insw_buffer:
+	push ebp
+	mov ebp,esp
+	push edi
+
+	mov edx,[ebp+8]
+	mov edi,[ebp+12]
+	mov ecx,[ebp+16]
+	cld
+	rep insw
+
+	pop edi
+	pop ebp
+	ret
+
+; outsw_buffer(port, buf, words): write a run of words to one port
+outsw_buffer:
+	push ebp
+	mov ebp,esp
+	push esi
+
+	mov edx,[ebp+8]
+	mov esi,[ebp+12]
+	mov ecx,[ebp+16]
+	cld
+	rep outsw
+
+	pop esi
+	pop ebp
+	ret
@@ -3,8 +3,15 @@
 
 unsigned char insb(unsigned short port);
 unsigned short insw(unsigned short port);
+unsigned int insl(unsigned short port);
 
 void outb(unsigned short port,unsigned char val);
 void outw(unsigned short port,unsigned short val);
+void outl(unsigned short port,unsigned int val);
+
+// Reads words from port into buf with rep insw
+void insw_buffer(unsigned short port,void* buf,unsigned int words);
+// Writes words from buf to port with rep outsw
+void outsw_buffer(unsigned short port,void* buf,unsigned int words);
 
 #endif
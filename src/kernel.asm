@@ -3,10 +3,21 @@
 global _start
 extern kernel_main
 extern kernel_end
+extern kernel_image_end
+extern kernel_image_sectors
 CODE_SEG equ 0x08
 DATA_SEG equ 0x10
 
 _start:
+    jmp short kernel_entry
+    align 4, db 0
+
+;struct kernel_header in boot/boot_info.h, boot.asm reads it to size the load
+kernel_header:
+    dd 0x484B5A52
+    dd kernel_image_sectors
+
+kernel_entry:
     mov ax,DATA_SEG
     mov ds,ax  
     mov es,ax 
@@ -20,8 +31,28 @@ _start:
     in al, 0x92
     or al, 2
     out 0x92, al
-    
+
+    ;The loader only read the image, clear the .bss behind it
+    mov edi,kernel_image_end
+    mov ecx,kernel_end
+    sub ecx,edi
+    shr ecx,2
+    xor eax,eax
+    rep stosd
+
+    ;ebx has the boot info from the loader
+    push ebx
     call kernel_main
     jmp $
 
-times 512-($ - $$) db 0
\ No newline at end of file
+times 512-($ - $$) db 0
+
+%ifndef KERNEL_PAD_SECTORS
+%define KERNEL_PAD_SECTORS 0
+%endif
+%if KERNEL_PAD_SECTORS
+;Dead weight to time the loader against larger kernels, see KERNEL_PAD_SECTORS
+;in the Makefile
+section .rodata
+    times KERNEL_PAD_SECTORS * 512 db 0
+%endif
@@ -4,17 +4,26 @@
 #include "shell/shell.h"
 #include "memory/memory.h"
 #include "memory/page.h"
+#include "memory/frame.h"
+#include "memory/zpool.h"
 #include "idt/idt.h"
 #include "idt/isr.h"
+#include "idt/irq.h"
+#include "idt/timer.h"
 #include "utils.h" 
 #include "proc/proc.h"
 #include "config.h" 
 #include "status.h"
 #include "ssd/ssd.h"
-#define kernel_end  0x10a000
-#define total_ram_kb 1024*500
-#define KERNEL_DIRECT_MAP_OFFSET 0xC0000000 
-uint32_t total_physical_bytes = total_ram_kb * 1024;
+#include "ssd/ata.h"
+#include "ssd/virtio_blk.h"
+#include "ssd/ahci.h"
+#include "ssd/ramdisk.h"
+#include "ssd/bcache.h"
+#include "fs/file.h"
+#include "pci/pci.h"
+#include "bench.h"
+#include "boot/boot_info.h"
 bool g_is_paging_enabled = false;
 uint16_t* video_mem = 0;
 uint16_t terminal_row=0;
@@ -37,42 +46,223 @@ void print(const char * str){
     }
 }
 static struct paging_chunk_4gb * kernel_chunk = 0;
+static struct boot_info kernel_boot_info;
+static struct frame_range memory_ranges[RZOS_MAX_MEMORY_RANGES];
 
-void kernel_main(){
-    kheap_init();
+// Usable RAM in the loader's E820 map from RZOS_FRAME_POOL_START up to limit,
+// sorted, with adjacent and overlapping ranges merged. Returns the count.
+static int kernel_memory_ranges(const struct boot_info* boot, uint32_t limit, struct frame_range* ranges, int max){
+    int count = 0;
+    for (uint32_t i = 0; i < boot->e820_count && i < BOOT_E820_MAX && count < max; i++) {
+        const struct e820_entry* entry = &boot->e820[i];
+        // Bit 0 of the ACPI 3.0 attributes clear means ignore the entry
+        if (entry->type != E820_USABLE || !(entry->acpi & 1)) {
+            continue;
+        }
+        uint64_t start = entry->base;
+        uint64_t end = entry->base + entry->length;
+        if (start < RZOS_FRAME_POOL_START) {
+            start = RZOS_FRAME_POOL_START;
+        }
+        if (end > limit) {
+            end = limit;
+        }
+        if (end <= start) {
+            continue;
+        }
+        int j = count++;
+        while (j > 0 && ranges[j - 1].start > start) {
+            ranges[j] = ranges[j - 1];
+            j--;
+        }
+        ranges[j].start = start;
+        ranges[j].end = end;
+    }
+
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged && ranges[i].start <= ranges[merged - 1].end) {
+            if (ranges[i].end > ranges[merged - 1].end) {
+                ranges[merged - 1].end = ranges[i].end;
+            }
+            continue;
+        }
+        ranges[merged++] = ranges[i];
+    }
+    return merged;
+}
+
+// Deferred work runs here once boot is done, the CPU halts when there is none
+// left and the next timer tick at the latest wakes it to look again
+static void kernel_idle(){
+    for(;;){
+        bcache_writeback_tick();
+        if(zpool_refill(RZOS_ZERO_POOL_REFILL_BATCH) == 0){
+            __asm__ volatile("hlt");
+        }
+    }
+}
+
+void kernel_main(struct boot_info* boot){
+    uint64_t kernel_start = rdtsc();
+    prof_begin("kernel_main");
+    memory_enable_sse();
+    // The loader left it in low memory, keep a copy before anything reuses it
+    if (boot && boot->magic == BOOT_INFO_MAGIC) {
+        memcpy(&kernel_boot_info, boot, sizeof(kernel_boot_info));
+    }
+    prof_begin("tsc_calibrate");
+    tsc_calibrate();
+    prof_end("tsc_calibrate");
+    // Usable RAM the direct map can reach above the kernel's low memory is
+    // handed to the frame allocator. Page tables and the kernel heap draw from it.
+    int memory_range_count = kernel_memory_ranges(&kernel_boot_info, KERNEL_DIRECT_MAP_MAX_BYTES, memory_ranges, RZOS_MAX_MEMORY_RANGES);
+    if (memory_range_count == 0) {
+        print_serial("No E820 memory map, assuming ");
+        kputdec(RZOS_FALLBACK_MEMORY_MB);
+        print_serial(" MiB\n");
+        memory_ranges[0].start = RZOS_FRAME_POOL_START;
+        memory_ranges[0].end = RZOS_FALLBACK_MEMORY_MB * 1024 * 1024;
+        memory_range_count = 1;
+    }
+    uint32_t usable_bytes = 0;
+    for (int i = 0; i < memory_range_count; i++) {
+        usable_bytes += memory_ranges[i].end - memory_ranges[i].start;
+    }
+    uint32_t direct_map_end = (memory_ranges[memory_range_count - 1].end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    prof_begin("frame_init");
+    frame_init(memory_ranges, memory_range_count);
+    prof_end("frame_init");
+    prof_begin("idt_init");
     idt_init();
-    char *ptr = kzalloc(40);
-    ptr[0] = 'E';
-    kernel_chunk = paging_chunk(PAGE_USER | PAGE_RW | PAGE_PRESENT);
+    prof_end("idt_init");
+    prof_begin("irq_init");
+    irq_init();
+    prof_end("irq_init");
+    prof_begin("pci_init");
+    pci_init();
+    prof_end("pci_init");
+    kernel_chunk = paging_kernel_chunk();
     if (kernel_chunk == NULL) {
         print_serial("Failed to create kernel paging chunk!\n");
         for(;;); // Halt on error
     }
 
-    if (paging_map_to(kernel_chunk, (void*)0x0, (void*)0x0, (void*)(0x300000), PAGE_USER | PAGE_RW | PAGE_PRESENT) != RZOS_ALL_OK) {
+    uint64_t map_start = rdtsc();
+    prof_begin("identity map");
+    if (paging_map_to(kernel_chunk, (void*)0x0, (void*)0x0, (void*)(0x300000), PAGE_USER | PAGE_RW | PAGE_PRESENT | PAGE_GLOBAL) != RZOS_ALL_OK) {
         print_serial("Failed to identity map first 4MB!\n");
         for(;;);
     }
-    if (paging_map_to(kernel_chunk,(void*)0xC0000000, (void*)0x300000, (void*)total_physical_bytes, PAGE_PRESENT | PAGE_RW) != RZOS_ALL_OK) {
+    prof_end("identity map");
+    prof_begin("direct map");
+    if (paging_map_to(kernel_chunk,(void*)KERNEL_DIRECT_MAP_OFFSET, (void*)KERNEL_DIRECT_MAP_PHYS_START, (void*)direct_map_end, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL) != RZOS_ALL_OK) {
         print_serial("Failed to map direct physical memory to higher half with offset!\n");
         for(;;);
     }
-    
-
-     
-    
+    uint64_t map_cycles = rdtsc() - map_start;
+    prof_end("direct map");
 
+    prof_begin("enable_paging");
     paging_switch(get_dir_chunk4gb(kernel_chunk));
     enable_paging();
     g_is_paging_enabled = true;
-    kheap_init();
+    paging_set_global(true);
+    prof_end("enable_paging");
+    prof_begin("kheap_init");
+    kheap_init(usable_bytes / RZOS_HEAP_RAM_SHARE);
+    prof_end("kheap_init");
+    prof_begin("ata_init");
+    if (ata_init() != RZOS_ALL_OK) {
+        print_serial("No ATA drive on the primary channel\n");
+    }
+    prof_end("ata_init");
+    prof_begin("virtio_blk_init");
+    if (virtio_blk_init() == RZOS_ALL_OK) {
+        print_serial("virtio-blk disk registered as vda\n");
+    }
+    prof_end("virtio_blk_init");
+    prof_begin("ahci_init");
+    if (ahci_init() == RZOS_ALL_OK) {
+        print_serial("AHCI disk registered as sda\n");
+    }
+    prof_end("ahci_init");
+    prof_begin("bcache_init");
+    bcache_init(RZOS_BCACHE_SIZE_KB * 1024);
+    prof_end("bcache_init");
+    prof_begin("timer_init");
+    if (timer_init(RZOS_TIMER_HZ) != RZOS_ALL_OK) {
+        print_serial("No periodic timer\n");
+    }
+    prof_end("timer_init");
+    irq_enable();
+#if RZOS_LOAD_INITRD
+    prof_begin("initrd");
+    if (ramdisk_load_initrd(block_get(0), kernel_boot_info.initrd_lba) == RZOS_ALL_OK) {
+        ramdisk_print_stats();
+    }
+    prof_end("initrd");
+#endif
+    prof_begin("fs_mount_all");
+    fs_init();
+    fs_mount_all();
+    prof_end("fs_mount_all");
+    char *ptr = kzalloc(40);
+    ptr[0] = 'E';
 
+    // Serial output is slow enough to show up in the profile
+    prof_begin("boot report");
     kputs("Paging enabled and working!\n");
+    kputs("Boot loader: ");
+    kputdec(kernel_boot_info.kernel_sectors);
+    kputs(" kernel sectors, ");
+    kputdec((uint32_t)tsc_cycles_to_us(kernel_boot_info.loader_end_tsc - kernel_boot_info.loader_start_tsc));
+    kputs(" us\n");
+    kputs("Memory: ");
+    kputdec(usable_bytes / (1024 * 1024));
+    kputs(" MiB usable in ");
+    kputdec(memory_range_count);
+    kputs(" ranges, ");
+    kputdec(kernel_boot_info.e820_count);
+    kputs(" E820 entries, direct map ");
+    kputdec(direct_map_end / (1024 * 1024));
+    kputs(" MiB\n");
+    kputs("Boot mappings: ");
+    kputdec((uint32_t)map_cycles);
+    kputs(" cycles, ");
+    kputdec(paging_stats.page_tables);
+    kputs(" page tables, ");
+    kputdec(paging_stats.ptes);
+    kputs(" PTEs, ");
+    kputdec(paging_stats.large_pages);
+    kputs(" 4MiB pages\n");
+    frame_print_stats();
+    kheap_print_stats();
+    prof_end("boot report");
     char *ptr2 = (char*)kzalloc(50);
-    char *ptr3 = (char*)kzalloc(10);
+    // read_sector fills a whole sector, so the buffer must be at least that big
+    char *ptr3 = (char*)kzalloc(RZOS_SECTOR_SIZE);
     for(int i=0;i<20;i++)ptr2[i]=i+'A';
+    prof_begin("read_sector");
     read_sector(0,1,ptr3);
+    prof_end("read_sector");
     kputs("Reading from disk:");
     kputs(ptr3);
+    // The TSC counts from reset, so the first figure includes the BIOS and
+    // the boot loader
+    uint64_t boot_end = rdtsc();
+    prof_end("kernel_main");
+    kputs("Boot to prompt: ");
+    kputdec((uint32_t)tsc_cycles_to_us(boot_end) / 1000);
+    kputs(" ms, kernel_main ");
+    kputdec((uint32_t)tsc_cycles_to_us(boot_end - kernel_start) / 1000);
+    kputs(" ms\n");
+#if RZOS_RUN_BENCHMARKS
+    bench_run_all();
+#endif
+    zpool_print_stats();
+    timer_print_stats();
     terminal_initialize();
+    prof_print();
+    kernel_idle();
 }
@@ -3,7 +3,8 @@
 #define KERNEL_H
 // #define VGA_WIDTH 80
 // #define VGA_HEIGHT 20
-void kernel_main();
+struct boot_info;
+void kernel_main(struct boot_info* boot);
 void print(const char * str);
 size_t strlen(const char* str);
 #endif
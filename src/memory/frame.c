@@ -0,0 +1,233 @@
+#include "memory/frame.h"
+#include "memory/page.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "utils.h"
+
+// Free blocks are linked through their own first frame, by physical address
+struct frame_node
+{
+    uintptr_t next;
+    uintptr_t prev;
+};
+
+static struct frame_area frame_area;
+static uint8_t frame_state[FRAME_MAX_FRAMES];
+
+static struct frame_node* frame_node(uintptr_t phys)
+{
+    return (struct frame_node*)paging_phys_to_virt(phys);
+}
+
+static uint32_t frame_index(uintptr_t phys)
+{
+    return (phys - frame_area.base) / PAGE_SIZE;
+}
+
+static uintptr_t frame_address(uint32_t index)
+{
+    return frame_area.base + index * PAGE_SIZE;
+}
+
+static void frame_list_push(uintptr_t phys, int order)
+{
+    struct frame_node* node = frame_node(phys);
+    node->prev = 0;
+    node->next = frame_area.free_list[order];
+    if (node->next)
+    {
+        frame_node(node->next)->prev = phys;
+    }
+    frame_area.free_list[order] = phys;
+    frame_area.free_count[order]++;
+    frame_state[frame_index(phys)] = FRAME_STATE_FREE | order;
+}
+
+static void frame_list_remove(uintptr_t phys, int order)
+{
+    struct frame_node* node = frame_node(phys);
+    if (node->prev)
+    {
+        frame_node(node->prev)->next = node->next;
+    }
+    else
+    {
+        frame_area.free_list[order] = node->next;
+    }
+
+    if (node->next)
+    {
+        frame_node(node->next)->prev = node->prev;
+    }
+    frame_area.free_count[order]--;
+    frame_state[frame_index(phys)] = 0;
+}
+
+// Carves a range of frame indices into the largest blocks that are aligned
+// (relative to base) and fit
+static void frame_add_range(uint32_t index, uint32_t end)
+{
+    while (index < end)
+    {
+        int order = FRAME_MAX_ORDER;
+        while (order > 0 &&
+               ((index & ((1u << order) - 1)) != 0 || index + (1u << order) > end))
+        {
+            order--;
+        }
+        frame_list_push(frame_address(index), order);
+        index += (1u << order);
+    }
+}
+
+// ranges must be sorted and must not overlap
+void frame_init(const struct frame_range* ranges, int count)
+{
+    if (count <= 0)
+    {
+        print_serial("frame_init: empty range\n");
+        return;
+    }
+    uintptr_t start = (ranges[0].start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uintptr_t end = ranges[count - 1].end & ~(PAGE_SIZE - 1);
+    if (end <= start)
+    {
+        print_serial("frame_init: empty range\n");
+        return;
+    }
+    if ((end - start) / PAGE_SIZE > FRAME_MAX_FRAMES)
+    {
+        end = start + FRAME_MAX_FRAMES * PAGE_SIZE;
+    }
+
+    memset(&frame_area, 0, sizeof(frame_area));
+    memset(frame_state, 0, sizeof(frame_state));
+    frame_area.base = start;
+    frame_area.end = end;
+    frame_area.total_frames = (end - start) / PAGE_SIZE;
+
+    for (int i = 0; i < count; i++)
+    {
+        uintptr_t range_start = (ranges[i].start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uintptr_t range_end = ranges[i].end & ~(PAGE_SIZE - 1);
+        if (range_start < start)
+        {
+            range_start = start;
+        }
+        if (range_end > end)
+        {
+            range_end = end;
+        }
+        if (range_end <= range_start)
+        {
+            continue;
+        }
+        frame_add_range(frame_index(range_start), frame_index(range_end));
+        frame_area.usable_frames += (range_end - range_start) / PAGE_SIZE;
+    }
+
+    // Pushing onto the head leaves every list in descending address order,
+    // flip them so that low memory is handed out first
+    for (int order = 0; order <= FRAME_MAX_ORDER; order++)
+    {
+        uintptr_t phys = frame_area.free_list[order];
+        uintptr_t last = 0;
+        while (phys)
+        {
+            struct frame_node* node = frame_node(phys);
+            uintptr_t next = node->next;
+            node->next = node->prev;
+            node->prev = next;
+            last = phys;
+            phys = next;
+        }
+        frame_area.free_list[order] = last;
+    }
+}
+
+uintptr_t frame_alloc(int order)
+{
+    if (order < 0 || order > FRAME_MAX_ORDER)
+    {
+        return 0;
+    }
+
+    int current = order;
+    while (current <= FRAME_MAX_ORDER && !frame_area.free_list[current])
+    {
+        current++;
+    }
+    if (current > FRAME_MAX_ORDER)
+    {
+        return 0;
+    }
+
+    uintptr_t phys = frame_area.free_list[current];
+    frame_list_remove(phys, current);
+
+    // Split off the upper halves until the block is the requested size
+    while (current > order)
+    {
+        current--;
+        frame_list_push(phys + ((uintptr_t)PAGE_SIZE << current), current);
+    }
+    return phys;
+}
+
+void frame_free(uintptr_t phys, int order)
+{
+    if (order < 0 || order > FRAME_MAX_ORDER || phys < frame_area.base || phys >= frame_area.end)
+    {
+        return;
+    }
+
+    uint32_t index = frame_index(phys);
+    while (order < FRAME_MAX_ORDER)
+    {
+        uint32_t buddy = index ^ (1u << order);
+        if (buddy + (1u << order) > frame_area.total_frames ||
+            frame_state[buddy] != (FRAME_STATE_FREE | order))
+        {
+            break;
+        }
+
+        frame_list_remove(frame_address(buddy), order);
+        index &= ~(1u << order);
+        order++;
+    }
+    frame_list_push(frame_address(index), order);
+}
+
+uint32_t frame_free_blocks(int order)
+{
+    if (order < 0 || order > FRAME_MAX_ORDER)
+    {
+        return 0;
+    }
+    return frame_area.free_count[order];
+}
+
+uint32_t frame_free_frames()
+{
+    uint32_t total = 0;
+    for (int order = 0; order <= FRAME_MAX_ORDER; order++)
+    {
+        total += frame_area.free_count[order] << order;
+    }
+    return total;
+}
+
+void frame_print_stats()
+{
+    print_serial("frames free per order:");
+    for (int order = 0; order <= FRAME_MAX_ORDER; order++)
+    {
+        print_serial(" ");
+        kputdec(frame_area.free_count[order]);
+    }
+    print_serial("\nframes free/total: ");
+    kputdec(frame_free_frames());
+    print_serial("/");
+    kputdec(frame_area.usable_frames);
+    print_serial("\n");
+}
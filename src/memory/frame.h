@@ -0,0 +1,44 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+// Buddy orders 0..10, i.e. blocks of 4 KiB up to 4 MiB
+#define FRAME_MAX_ORDER 10
+#define FRAME_MAX_FRAMES ((RZOS_MAX_PHYSICAL_MEMORY_MB * 1024 * 1024) / PAGE_SIZE)
+
+// Per frame state byte, only meaningful for the first frame of a free block
+#define FRAME_STATE_FREE 0x80
+#define FRAME_STATE_ORDER_MASK 0x0F
+
+// A physical range of usable RAM
+struct frame_range
+{
+    uintptr_t start;
+    uintptr_t end;
+};
+
+struct frame_area
+{
+    // Physical span handed to the buddy allocator, holes between the usable
+    // ranges in it are never free
+    uintptr_t base;
+    uintptr_t end;
+    uint32_t total_frames;
+    uint32_t usable_frames;
+
+    // Physical address of the first free block of every order, 0 when empty
+    uintptr_t free_list[FRAME_MAX_ORDER + 1];
+    uint32_t free_count[FRAME_MAX_ORDER + 1];
+};
+
+void frame_init(const struct frame_range* ranges, int count);
+uintptr_t frame_alloc(int order);
+void frame_free(uintptr_t phys, int order);
+uint32_t frame_free_blocks(int order);
+uint32_t frame_free_frames();
+void frame_print_stats();
+
+#endif
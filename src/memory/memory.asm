@@ -0,0 +1,64 @@
+[BITS 32]
+
+section .asm
+
+global memcpy_sse2
+global memset_sse2
+
+; Both clobber XMM registers that interrupt handlers don't save, callers run
+; them with interrupts off. A store can still page fault, the page fault
+; handler saves and restores XMM state around resolving it.
+
+; void memcpy_sse2(void* dest, void* src, uint32_t blocks)
+; Copies blocks * 64 bytes. dest must be 16 byte aligned, src may be unaligned.
+memcpy_sse2:
+    push ebp
+    mov ebp,esp
+    push esi
+    push edi
+
+    mov edi,[ebp+8]
+    mov esi,[ebp+12]
+    mov ecx,[ebp+16]
+.next_block:
+    movdqu xmm0,[esi]
+    movdqu xmm1,[esi+16]
+    movdqu xmm2,[esi+32]
+    movdqu xmm3,[esi+48]
+    movdqa [edi],xmm0
+    movdqa [edi+16],xmm1
+    movdqa [edi+32],xmm2
+    movdqa [edi+48],xmm3
+    add esi,64
+    add edi,64
+    dec ecx
+    jnz .next_block
+
+    pop edi
+    pop esi
+    pop ebp
+    ret
+
+; void memset_sse2(void* dest, uint32_t pattern, uint32_t blocks)
+; Fills blocks * 64 bytes with a repeated 32 bit pattern. dest must be 16 byte aligned.
+memset_sse2:
+    push ebp
+    mov ebp,esp
+    push edi
+
+    mov edi,[ebp+8]
+    movd xmm0,[ebp+12]
+    pshufd xmm0,xmm0,0
+    mov ecx,[ebp+16]
+.next_block:
+    movdqa [edi],xmm0
+    movdqa [edi+16],xmm0
+    movdqa [edi+32],xmm0
+    movdqa [edi+48],xmm0
+    add edi,64
+    dec ecx
+    jnz .next_block
+
+    pop edi
+    pop ebp
+    ret
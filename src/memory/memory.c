@@ -2,21 +2,138 @@
 #include "kernel.h"
 #include "status.h"
 #include "memory/memory.h"
+#include "memory/slab.h"
+#include "memory/zpool.h"
+#include "utils.h"
+#include "idt/irq.h"
 #include <stdbool.h>
+// Bulk memory kernels. Aligned bulk work goes through rep stosd/movsd, or
+// through the SSE2 routines in memory.asm once memory_enable_sse() has run.
+#define MEMORY_SSE_THRESHOLD 256
+// Interrupt handlers do not save XMM state, so SSE work runs with interrupts
+// off, in chunks of at most this many 64 byte blocks. That doesn't hold off
+// exceptions: a store can page fault on a demand-paged or mapped destination,
+// and resolving the fault zeroes and copies pages through these same kernels.
+// The page fault handler brackets its work with memory_sse_save/restore.
+#define MEMORY_SSE_CHUNK_BLOCKS 64
+
+#define CPUID_FEATURE_FXSR (1 << 24)
+#define CPUID_FEATURE_SSE2 (1 << 26)
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR4_OSFXSR 0x200
+#define CR4_OSXMMEXCPT 0x400
+
+typedef uint32_t __attribute__((may_alias)) memory_word_t;
+
+extern void memcpy_sse2(void* dest, void* src, uint32_t blocks);
+extern void memset_sse2(void* dest, uint32_t pattern, uint32_t blocks);
+
+static bool memory_sse_enabled = false;
+
+// Sets up CR0/CR4 so that SSE instructions can run in kernel context
+int memory_enable_sse()
+{
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!RZOS_USE_SSE || !(edx & CPUID_FEATURE_SSE2) || !(edx & CPUID_FEATURE_FXSR))
+    {
+        return -EUNIMP;
+    }
+
+    uint32_t cr0, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP;
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+
+    memory_sse_enabled = true;
+    return RZOS_ALL_OK;
+}
+
+static void* memory_sse_area(struct memory_sse_state* state)
+{
+    return (void*)(((uintptr_t)state->area + 15) & ~15);
+}
+
+void memory_sse_save(struct memory_sse_state* state)
+{
+    if (memory_sse_enabled)
+    {
+        __asm__ volatile("fxsave (%0)" :: "r"(memory_sse_area(state)) : "memory");
+    }
+}
+
+void memory_sse_restore(struct memory_sse_state* state)
+{
+    if (memory_sse_enabled)
+    {
+        __asm__ volatile("fxrstor (%0)" :: "r"(memory_sse_area(state)) : "memory");
+    }
+}
+
 void* memset(void* ptr, int c, size_t size)
 {
-    char* c_ptr = (char*) ptr;
-    for (int i = 0; i < size; i++)
+    uint8_t* p = (uint8_t*) ptr;
+    uint8_t byte = (uint8_t) c;
+    uint32_t pattern = byte * 0x01010101u;
+
+    if (memory_sse_enabled && size >= MEMORY_SSE_THRESHOLD)
+    {
+        while ((uintptr_t)p & 15)
+        {
+            *p++ = byte;
+            size--;
+        }
+        while (size >= 64)
+        {
+            uint32_t blocks = size / 64;
+            if (blocks > MEMORY_SSE_CHUNK_BLOCKS)
+            {
+                blocks = MEMORY_SSE_CHUNK_BLOCKS;
+            }
+            uint32_t flags = irq_save();
+            memset_sse2(p, pattern, blocks);
+            irq_restore(flags);
+            p += blocks * 64;
+            size -= blocks * 64;
+        }
+    }
+    else if (size >= 4)
     {
-        c_ptr[i] = (char) c;
+        while ((uintptr_t)p & 3)
+        {
+            *p++ = byte;
+            size--;
+        }
+        size_t words = size / 4;
+        __asm__ volatile("cld; rep stosl" : "+D"(p), "+c"(words) : "a"(pattern) : "memory");
+        size &= 3;
+    }
+
+    while (size--)
+    {
+        *p++ = byte;
     }
     return ptr;
 }
 
 int memcmp(void* s1, void* s2, int count)
 {
-    char* c1 = s1;
-    char* c2 = s2;
+    uint8_t* c1 = s1;
+    uint8_t* c2 = s2;
+
+    // Skip the equal prefix a word at a time, then find the differing byte
+    while (count >= 4 && *(memory_word_t*)c1 == *(memory_word_t*)c2)
+    {
+        c1 += 4;
+        c2 += 4;
+        count -= 4;
+    }
+
     while(count-- > 0)
     {
         if (*c1++ != *c2++)
@@ -30,12 +147,46 @@ int memcmp(void* s1, void* s2, int count)
 
 void* memcpy(void* dest, void* src, int len)
 {
-    char *d = dest;
-    char *s = src;
-    while(len--)
+    uint8_t *d = dest;
+    uint8_t *s = src;
+    size_t n = len > 0 ? (size_t)len : 0;
+
+    if (memory_sse_enabled && n >= MEMORY_SSE_THRESHOLD)
     {
-        *d++ = *s++;
+        while ((uintptr_t)d & 15)
+        {
+            *d++ = *s++;
+            n--;
+        }
+        while (n >= 64)
+        {
+            uint32_t blocks = n / 64;
+            if (blocks > MEMORY_SSE_CHUNK_BLOCKS)
+            {
+                blocks = MEMORY_SSE_CHUNK_BLOCKS;
+            }
+            uint32_t flags = irq_save();
+            memcpy_sse2(d, s, blocks);
+            irq_restore(flags);
+            d += blocks * 64;
+            s += blocks * 64;
+            n -= blocks * 64;
+        }
+    }
+    else if (n >= 4)
+    {
+        // Align the destination, the CPU copes with an unaligned source
+        while ((uintptr_t)d & 3)
+        {
+            *d++ = *s++;
+            n--;
+        }
+        size_t words = n / 4;
+        __asm__ volatile("cld; rep movsl" : "+D"(d), "+S"(s), "+c"(words) :: "memory");
+        n &= 3;
     }
+
+    __asm__ volatile("cld; rep movsb" : "+D"(d), "+S"(s), "+c"(n) :: "memory");
     return dest;
 }
 
@@ -45,7 +196,7 @@ static int heap_validate_table(void* ptr, void* end, struct heap_table* table)
 
     size_t table_size = (size_t)(end - ptr);
     size_t total_blocks = table_size / RZOS_HEAP_BLOCK_SIZE;
-    if (table->total != total_blocks)
+    if (table->total != total_blocks || total_blocks > HEAP_MAX_BLOCKS)
     {
         res = -EINVARG;
         goto out;
@@ -60,6 +211,80 @@ static bool heap_validate_alignment(void* ptr)
     return ((unsigned int)ptr % RZOS_HEAP_BLOCK_SIZE) == 0;
 }
 
+static void heap_index_set_range(struct heap* heap, uint32_t start, uint32_t count, bool free)
+{
+    uint32_t block = start;
+    uint32_t end = start + count;
+    while (block < end)
+    {
+        uint32_t word = block / 32;
+        uint32_t bit = block % 32;
+        uint32_t span = 32 - bit;
+        if (span > end - block)
+        {
+            span = end - block;
+        }
+
+        uint32_t mask = (span == 32) ? 0xFFFFFFFF : (((1u << span) - 1) << bit);
+        if (free)
+        {
+            heap->free_map[word] |= mask;
+        }
+        else
+        {
+            heap->free_map[word] &= ~mask;
+        }
+
+        if (heap->free_map[word])
+        {
+            heap->free_summary[word / 32] |= (1u << (word % 32));
+        }
+        else
+        {
+            heap->free_summary[word / 32] &= ~(1u << (word % 32));
+        }
+        block += span;
+    }
+
+    if (free)
+    {
+        heap->free_blocks += count;
+    }
+    else
+    {
+        heap->free_blocks -= count;
+    }
+}
+
+// Returns the index of the first free_map word at or after 'word' that has a free block
+static int heap_index_next_word(struct heap* heap, uint32_t word, uint32_t total_words)
+{
+    while (word < total_words)
+    {
+        uint32_t summary = heap->free_summary[word / 32] & (0xFFFFFFFF << (word % 32));
+        if (summary)
+        {
+            word = (word & ~31u) + __builtin_ctz(summary);
+            return word < total_words ? (int)word : -1;
+        }
+        word = (word & ~31u) + 32;
+    }
+    return -1;
+}
+
+// Finds 'total_blocks' consecutive set bits inside one free_map word
+static int heap_index_run_in_word(uint32_t bits, uint32_t total_blocks)
+{
+    uint32_t len = 1;
+    while (bits && len < total_blocks)
+    {
+        uint32_t shift = (total_blocks - len < len) ? total_blocks - len : len;
+        bits &= bits >> shift;
+        len += shift;
+    }
+    return bits ? __builtin_ctz(bits) : -1;
+}
+
 int heap_create(struct heap* heap, void* ptr, void* end, struct heap_table* table)
 {
     int res = 0;
@@ -82,6 +307,7 @@ int heap_create(struct heap* heap, void* ptr, void* end, struct heap_table* tabl
 
     size_t table_size = sizeof(HEAP_BLOCK_TABLE_ENTRY) * table->total;
     memset(table->entries, HEAP_BLOCK_TABLE_ENTRY_FREE, table_size);
+    heap_index_set_range(heap, 0, table->total, true);
 
 out:
     return res;
@@ -107,37 +333,77 @@ static int heap_get_entry_type(HEAP_BLOCK_TABLE_ENTRY entry)
 int heap_get_start_block(struct heap* heap, uint32_t total_blocks)
 {
     struct heap_table* table = heap->table;
-    int bc = 0;
-    int bs = -1;
+    uint32_t total_words = (table->total + 31) / 32;
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
 
-    for (size_t i = 0; i < table->total; i++)
+    if (total_blocks == 0 || total_blocks > heap->free_blocks)
     {
-        if (heap_get_entry_type(table->entries[i]) != HEAP_BLOCK_TABLE_ENTRY_FREE)
+        return -ENOMEM;
+    }
+
+    int next = heap_index_next_word(heap, 0, total_words);
+    uint32_t word = next;
+    while (next >= 0 && word < total_words)
+    {
+        uint32_t bits = heap->free_map[word];
+        if (bits == 0)
         {
-            bc = 0;
-            bs = -1;
+            // Nothing free here, jump straight to the next word with a free block
+            run_len = 0;
+            next = heap_index_next_word(heap, word + 1, total_words);
+            word = next;
             continue;
         }
 
-        // If this is the first block
-        if (bs == -1)
+        if (bits == 0xFFFFFFFF)
+        {
+            if (run_len == 0)
+            {
+                run_start = word * 32;
+            }
+            run_len += 32;
+        }
+        else
         {
-            bs = i;
+            // Free blocks at the bottom of this word extend the run from the previous word
+            uint32_t low = __builtin_ctz(~bits);
+            if (run_len > 0 && run_len + low >= total_blocks)
+            {
+                run_len += low;
+                break;
+            }
+
+            if (total_blocks <= 32)
+            {
+                int bit = heap_index_run_in_word(bits, total_blocks);
+                if (bit >= 0)
+                {
+                    run_start = word * 32 + bit;
+                    run_len = total_blocks;
+                    break;
+                }
+            }
+
+            // Only the free blocks at the top of this word can start a longer run
+            uint32_t high = 31 - __builtin_clz(~bits);
+            run_len = 31 - high;
+            run_start = word * 32 + high + 1;
         }
-        bc++;
-        if (bc == total_blocks)
+
+        if (run_len >= total_blocks)
         {
             break;
         }
+        word++;
     }
 
-    if (bs == -1)
+    if (run_len < total_blocks || run_start + total_blocks > table->total)
     {
         return -ENOMEM;
     }
-    
-    return bs;
 
+    return run_start;
 }
 
 void* heap_block_to_address(struct heap* heap, int block)
@@ -164,6 +430,8 @@ void heap_mark_blocks_taken(struct heap* heap, int start_block, int total_blocks
             entry |= HEAP_BLOCK_HAS_NEXT;
         }
     }
+
+    heap_index_set_range(heap, start_block, total_blocks, false);
 }
 
 void* heap_malloc_blocks(struct heap* heap, uint32_t total_blocks)
@@ -188,15 +456,24 @@ out:
 void heap_mark_blocks_free(struct heap* heap, int starting_block)
 {
     struct heap_table* table = heap->table;
+    int freed = 0;
     for (int i = starting_block; i < (int)table->total; i++)
     {
         HEAP_BLOCK_TABLE_ENTRY entry = table->entries[i];
+        if (heap_get_entry_type(entry) != HEAP_BLOCK_TABLE_ENTRY_TAKEN)
+        {
+            break;
+        }
         table->entries[i] = HEAP_BLOCK_TABLE_ENTRY_FREE;
+        freed++;
         if (!(entry & HEAP_BLOCK_HAS_NEXT))
         {
             break;
         }
     }
+
+    // Neighbouring free runs merge implicitly once their bits are set again
+    heap_index_set_range(heap, starting_block, freed, true);
 }
 
 int heap_address_to_block(struct heap* heap, void* address)
@@ -216,35 +493,213 @@ void heap_free(struct heap* heap, void* ptr)
     heap_mark_blocks_free(heap, heap_address_to_block(heap, ptr));
 }
 
+// Extends the allocation at 'ptr' from old_blocks to new_blocks when the blocks
+// right after it are free. Returns -ENOMEM and changes nothing otherwise.
+int heap_grow_in_place(struct heap* heap, void* ptr, uint32_t old_blocks, uint32_t new_blocks)
+{
+    struct heap_table* table = heap->table;
+    int start = heap_address_to_block(heap, ptr);
+    uint32_t end = start + new_blocks;
+    if (old_blocks == 0 || new_blocks <= old_blocks || end > table->total)
+    {
+        return -EINVARG;
+    }
+
+    for (uint32_t i = start + old_blocks; i < end; i++)
+    {
+        if (heap_get_entry_type(table->entries[i]) != HEAP_BLOCK_TABLE_ENTRY_FREE)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    // The old last block now continues into the new ones
+    table->entries[start + old_blocks - 1] |= HEAP_BLOCK_HAS_NEXT;
+    for (uint32_t i = start + old_blocks; i < end; i++)
+    {
+        HEAP_BLOCK_TABLE_ENTRY entry = HEAP_BLOCK_TABLE_ENTRY_TAKEN;
+        if (i != end - 1)
+        {
+            entry |= HEAP_BLOCK_HAS_NEXT;
+        }
+        table->entries[i] = entry;
+    }
+    heap_index_set_range(heap, start + old_blocks, new_blocks - old_blocks, false);
+    return RZOS_ALL_OK;
+}
+
+// Gives the tail blocks of the allocation at 'ptr' back to the heap
+int heap_shrink_in_place(struct heap* heap, void* ptr, uint32_t old_blocks, uint32_t new_blocks)
+{
+    struct heap_table* table = heap->table;
+    int start = heap_address_to_block(heap, ptr);
+    if (new_blocks == 0 || new_blocks >= old_blocks)
+    {
+        return -EINVARG;
+    }
+
+    table->entries[start + new_blocks - 1] &= ~HEAP_BLOCK_HAS_NEXT;
+    for (uint32_t i = start + new_blocks; i < start + old_blocks; i++)
+    {
+        table->entries[i] = HEAP_BLOCK_TABLE_ENTRY_FREE;
+    }
+    heap_index_set_range(heap, start + new_blocks, old_blocks - new_blocks, true);
+    return RZOS_ALL_OK;
+}
+
+// Returns how many blocks the allocation starting at 'ptr' spans
+uint32_t heap_allocation_blocks(struct heap* heap, void* ptr)
+{
+    struct heap_table* table = heap->table;
+    uint32_t total = 0;
+    for (int i = heap_address_to_block(heap, ptr); i < (int)table->total; i++)
+    {
+        HEAP_BLOCK_TABLE_ENTRY entry = table->entries[i];
+        if (heap_get_entry_type(entry) != HEAP_BLOCK_TABLE_ENTRY_TAKEN)
+        {
+            break;
+        }
+        total++;
+        if (!(entry & HEAP_BLOCK_HAS_NEXT))
+        {
+            break;
+        }
+    }
+    return total;
+}
+
 
 struct heap kernel_heap;
 struct heap_table kernel_heap_table;
-extern bool g_is_paging_enabled;
-uintptr_t KERNEL_HEAP_BASE = RZOS_HEAP_ADDRESS;
-void kheap_init()
-{
-    int total_table_entries = RZOS_HEAP_SIZE_BYTES / RZOS_HEAP_BLOCK_SIZE;
-    kernel_heap_table.entries = (HEAP_BLOCK_TABLE_ENTRY*)(RZOS_HEAP_TABLE_ADDRESS);
-    kernel_heap_table.total = total_table_entries;
-    if(g_is_paging_enabled){
-        KERNEL_HEAP_BASE = 0xC0000000;
-    }
-    void* end = (void*)(RZOS_HEAP_ADDRESS + RZOS_HEAP_SIZE_BYTES);
-    int res = heap_create(&kernel_heap, (void*)(KERNEL_HEAP_BASE), end, &kernel_heap_table);
+struct kheap_stats kheap_stats;
+struct krealloc_stats krealloc_stats;
+static HEAP_BLOCK_TABLE_ENTRY kernel_heap_entries[HEAP_MAX_BLOCKS];
+
+// Unmaps the pages behind [addr, addr + total_blocks) and returns their frames
+static void kheap_decommit(void* addr, uint32_t total_blocks)
+{
+    uint32_t* directory = get_dir_chunk4gb(paging_kernel_chunk());
+    for (uint32_t i = 0; i < total_blocks; i++)
+    {
+        void* page = addr + i * RZOS_HEAP_BLOCK_SIZE;
+        uint32_t entry = paging_get(directory, page);
+        if (!(entry & PAGE_PRESENT))
+        {
+            continue;
+        }
+        paging_set(directory, page, 0);
+        paging_invalidate_page(page);
+        free_page((void*)(entry & 0xFFFFF000));
+        kheap_stats.committed_bytes -= RZOS_HEAP_BLOCK_SIZE;
+    }
+}
+
+// Backs [addr, addr + total_blocks) with frames. Heap blocks are page sized,
+// so every taken block owns exactly one frame. 'zeroed' takes the frames from
+// the pre-zeroed pool.
+static int kheap_commit(void* addr, uint32_t total_blocks, bool zeroed)
+{
+    uint32_t* directory = get_dir_chunk4gb(paging_kernel_chunk());
+    for (uint32_t i = 0; i < total_blocks; i++)
+    {
+        void* page = addr + i * RZOS_HEAP_BLOCK_SIZE;
+        void* frame = zeroed ? (void*)zpool_alloc_page() : alloc_page();
+        if (!frame)
+        {
+            kheap_decommit(addr, i);
+            return -ENOMEM;
+        }
+
+        int res = paging_set(directory, page, (uint32_t)frame | PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL);
+        if (res < 0)
+        {
+            free_page(frame);
+            kheap_decommit(addr, i);
+            return res;
+        }
+        kheap_stats.committed_bytes += RZOS_HEAP_BLOCK_SIZE;
+    }
+
+    if (kheap_stats.committed_bytes > kheap_stats.peak_committed_bytes)
+    {
+        kheap_stats.peak_committed_bytes = kheap_stats.committed_bytes;
+    }
+    return RZOS_ALL_OK;
+}
+
+// Needs paging and the frame allocator. The heap window only takes address
+// space here, frames are mapped in by kmalloc as the heap grows. It is bytes
+// long, in whole page tables, up to KERNEL_HEAP_SIZE_MB.
+void kheap_init(size_t bytes)
+{
+    bytes &= ~(PAGE_LARGE_SIZE - 1);
+    if (bytes < PAGE_LARGE_SIZE)
+    {
+        bytes = PAGE_LARGE_SIZE;
+    }
+    if (bytes > HEAP_MAX_BLOCKS * RZOS_HEAP_BLOCK_SIZE)
+    {
+        bytes = HEAP_MAX_BLOCKS * RZOS_HEAP_BLOCK_SIZE;
+    }
+    kernel_heap_table.entries = kernel_heap_entries;
+    kernel_heap_table.total = bytes / RZOS_HEAP_BLOCK_SIZE;
+
+    void* start = (void*)KERNEL_HEAP_START_VIRTUAL_ADDRESS;
+    void* end = start + bytes;
+    int res = heap_create(&kernel_heap, start, end, &kernel_heap_table);
     if (res < 0)
     {
         print("Failed to create heap\n");
+        return;
+    }
+
+    // Create the page tables for the whole window now, so that every address
+    // space linking the kernel half sees the heap as it grows
+    res = paging_prepare_range(get_dir_chunk4gb(paging_kernel_chunk()), start, end - start);
+    if (res < 0)
+    {
+        print("Failed to create heap page tables\n");
+        return;
+    }
+
+    memset(&kheap_stats, 0, sizeof(kheap_stats));
+    kheap_stats.reserved_bytes = end - start;
+    slab_init();
+}
+
+static void* kheap_alloc(size_t size, bool zeroed)
+{
+    void* ptr = heap_malloc(&kernel_heap, size);
+    if (!ptr)
+    {
+        return 0;
     }
 
+    if (kheap_commit(ptr, heap_allocation_blocks(&kernel_heap, ptr), zeroed) < 0)
+    {
+        heap_free(&kernel_heap, ptr);
+        return 0;
+    }
+    return ptr;
 }
 
 void* kmalloc(size_t size)
 {
-    return heap_malloc(&kernel_heap, size);
+    if (size > 0 && size <= SLAB_MAX_SIZE)
+    {
+        return slab_alloc(size);
+    }
+    return kheap_alloc(size, false);
 }
 
 void* kzalloc(size_t size)
 {
+    // Whole pages come straight from the zero pool, no clearing needed here
+    if (size > SLAB_MAX_SIZE)
+    {
+        return kheap_alloc(size, true);
+    }
+
     void* ptr = kmalloc(size);
     if (!ptr)
         return 0;
@@ -255,5 +710,108 @@ void* kzalloc(size_t size)
 
 void kfree(void* ptr)
 {
+    if (!ptr)
+    {
+        return;
+    }
+
+    // Heap allocations are always block aligned, slab objects never are
+    if ((uintptr_t)ptr % RZOS_HEAP_BLOCK_SIZE)
+    {
+        slab_free(ptr);
+        return;
+    }
+    kheap_decommit(ptr, heap_allocation_blocks(&kernel_heap, ptr));
     heap_free(&kernel_heap, ptr);
+}
+
+// Resizes an allocation, in place whenever the block table allows it:
+// slab objects that still fit stay put, heap allocations shrink by releasing
+// their tail blocks and grow into free blocks right behind them. Only when
+// none of that works is the data copied to a new allocation.
+void* krealloc(void* ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return kmalloc(size);
+    }
+    if (size == 0)
+    {
+        kfree(ptr);
+        return 0;
+    }
+
+    krealloc_stats.calls++;
+    size_t old_size;
+    if ((uintptr_t)ptr % RZOS_HEAP_BLOCK_SIZE)
+    {
+        old_size = slab_object_size(ptr);
+        if (size <= old_size)
+        {
+            krealloc_stats.in_place++;
+            return ptr;
+        }
+    }
+    else
+    {
+        uint32_t old_blocks = heap_allocation_blocks(&kernel_heap, ptr);
+        uint32_t new_blocks = heap_align_value_to_upper(size) / RZOS_HEAP_BLOCK_SIZE;
+        old_size = old_blocks * RZOS_HEAP_BLOCK_SIZE;
+
+        if (new_blocks == old_blocks)
+        {
+            krealloc_stats.in_place++;
+            return ptr;
+        }
+
+        if (new_blocks < old_blocks)
+        {
+            kheap_decommit(ptr + new_blocks * RZOS_HEAP_BLOCK_SIZE, old_blocks - new_blocks);
+            heap_shrink_in_place(&kernel_heap, ptr, old_blocks, new_blocks);
+            krealloc_stats.in_place++;
+            return ptr;
+        }
+
+        if (heap_grow_in_place(&kernel_heap, ptr, old_blocks, new_blocks) == RZOS_ALL_OK)
+        {
+            if (kheap_commit(ptr + old_size, new_blocks - old_blocks, false) == RZOS_ALL_OK)
+            {
+                krealloc_stats.in_place++;
+                return ptr;
+            }
+            heap_shrink_in_place(&kernel_heap, ptr, new_blocks, old_blocks);
+        }
+    }
+
+    void* new_ptr = kmalloc(size);
+    if (!new_ptr)
+    {
+        return 0;
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    kfree(ptr);
+    krealloc_stats.copied++;
+    return new_ptr;
+}
+
+void krealloc_print_stats()
+{
+    kputs("krealloc calls ");
+    kputdec(krealloc_stats.calls);
+    kputs(", in place ");
+    kputdec(krealloc_stats.in_place);
+    kputs(", copied ");
+    kputdec(krealloc_stats.copied);
+    kputs("\n");
+}
+
+void kheap_print_stats()
+{
+    kputs("kheap committed ");
+    kputdec(kheap_stats.committed_bytes / 1024);
+    kputs(" KiB (peak ");
+    kputdec(kheap_stats.peak_committed_bytes / 1024);
+    kputs(" KiB) of ");
+    kputdec(kheap_stats.reserved_bytes / 1024);
+    kputs(" KiB reserved\n");
 }
\ No newline at end of file
@@ -13,6 +13,11 @@
 
 typedef unsigned char HEAP_BLOCK_TABLE_ENTRY;
 
+// Largest heap a block table can describe, and the size of its free index
+#define HEAP_MAX_BLOCKS ((KERNEL_HEAP_SIZE_MB * 1024 * 1024) / RZOS_HEAP_BLOCK_SIZE)
+#define HEAP_FREE_MAP_WORDS ((HEAP_MAX_BLOCKS + 31) / 32)
+#define HEAP_FREE_SUMMARY_WORDS ((HEAP_FREE_MAP_WORDS + 31) / 32)
+
 struct heap_table
 {
     HEAP_BLOCK_TABLE_ENTRY* entries;
@@ -26,18 +31,61 @@ struct heap
 
     // Start address of the heap data pool
     void* saddr;
+
+    // Two-level free index over the block table.
+    // free_map has one bit per block (set = free), free_summary has one
+    // bit per free_map word (set = that word has at least one free block)
+    uint32_t free_map[HEAP_FREE_MAP_WORDS];
+    uint32_t free_summary[HEAP_FREE_SUMMARY_WORDS];
+    uint32_t free_blocks;
 };
 
 int heap_create(struct heap* heap, void* ptr, void* end, struct heap_table* table);
 void* heap_malloc(struct heap* heap, size_t size);
 void heap_free(struct heap* heap, void* ptr);
+int heap_get_start_block(struct heap* heap, uint32_t total_blocks);
+uint32_t heap_allocation_blocks(struct heap* heap, void* ptr);
+int heap_grow_in_place(struct heap* heap, void* ptr, uint32_t old_blocks, uint32_t new_blocks);
+int heap_shrink_in_place(struct heap* heap, void* ptr, uint32_t old_blocks, uint32_t new_blocks);
+
+// Kernel heap address space: reserved up front, committed block by block
+struct kheap_stats
+{
+    uint32_t reserved_bytes;
+    uint32_t committed_bytes;
+    uint32_t peak_committed_bytes;
+};
+extern struct kheap_stats kheap_stats;
+extern struct heap kernel_heap;
+void kheap_print_stats();
+
+struct krealloc_stats
+{
+    uint32_t calls;
+    uint32_t in_place;
+    uint32_t copied;
+};
+extern struct krealloc_stats krealloc_stats;
 
 
-void kheap_init();
+void kheap_init(size_t bytes);
 void* kmalloc(size_t size);
 void* kzalloc(size_t size);
 void kfree(void* ptr);
+void* krealloc(void* ptr, size_t size);
+void krealloc_print_stats();
+
+int memory_enable_sse();
+
+// FPU and XMM state as fxsave lays it out. fxsave wants 16 byte alignment,
+// which the interrupt stack doesn't promise, so the area has room to align.
+struct memory_sse_state
+{
+    uint8_t area[512 + 15];
+};
 
+void memory_sse_save(struct memory_sse_state* state);
+void memory_sse_restore(struct memory_sse_state* state);
 void* memset(void* ptr, int c, size_t size);
 int memcmp(void* s1, void* s2, int count);
 void* memcpy(void* dest, void* src, int len);
@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "memory/mmap.h"
+#include "memory/memory.h"
+#include "memory/zpool.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+#if RZOS_BCACHE_BLOCK_SIZE != PAGE_SIZE
+#error "mmap maps block cache buffers as pages"
+#endif
+
+struct mmap_stats mmap_stats;
+
+static int mmap_fault(struct vm_region* region, uintptr_t va);
+static void mmap_release(struct vm_region* region);
+
+static struct vm_ops mmap_ops = {
+    .fault = mmap_fault,
+    .release = mmap_release
+};
+
+static void mmap_unmap_page(struct vm_region* region, struct mmap_page* page)
+{
+    paging_set(region->directory, (void*)page->va, 0);
+    if (page->buf) {
+        brelse(page->buf);
+    } else {
+        free_page((void*)page->frame);
+    }
+    region->resident_pages--;
+}
+
+// Finds the cache block that holds the page at offset as is: the whole page
+// is inside the file, starts on a block boundary and is contiguous on disk
+static bool mmap_block_of(struct mmap_region* mm, uint32_t offset, uint32_t* block)
+{
+    if (!mm->file) {
+        *block = offset / RZOS_BCACHE_BLOCK_SIZE;
+        return true;
+    }
+    if (offset + PAGE_SIZE > mm->size) {
+        return false;
+    }
+    uint32_t lba;
+    uint32_t contiguous;
+    if (file_bmap(mm->file, offset, &lba, &contiguous) < 0 || lba % BCACHE_SECTORS_PER_BLOCK) {
+        return false;
+    }
+    for (uint32_t done = contiguous; done < PAGE_SIZE; done += contiguous) {
+        uint32_t next;
+        if (file_bmap(mm->file, offset + done, &next, &contiguous) < 0 || next != lba + done / RZOS_SECTOR_SIZE) {
+            return false;
+        }
+    }
+    *block = lba / BCACHE_SECTORS_PER_BLOCK;
+    return true;
+}
+
+// Maps the page at va, making room by unmapping the oldest resident page
+static int mmap_fault(struct vm_region* region, uintptr_t va)
+{
+    struct mmap_region* mm = region->private;
+    mmap_stats.faults++;
+    if (mm->count == RZOS_MMAP_RESIDENT_PAGES) {
+        mmap_unmap_page(region, &mm->pages[mm->head]);
+        mm->head = (mm->head + 1) % RZOS_MMAP_RESIDENT_PAGES;
+        mm->count--;
+        mmap_stats.evictions++;
+    }
+
+    uint32_t offset = mm->offset + (va - region->start);
+    struct mmap_page page = { .va = va, .frame = 0, .buf = NULL };
+    uint32_t block;
+    if (offset < mm->size && mmap_block_of(mm, offset, &block)) {
+        page.buf = bread(mm->dev, block);
+        if (!page.buf) {
+            return -EIO;
+        }
+        page.frame = virt_to_phys((uintptr_t)page.buf->data);
+        mmap_stats.shared_pages++;
+    } else {
+        // Past the end the page stays zero
+        page.frame = zpool_alloc_page();
+        if (!page.frame) {
+            return -ENOMEM;
+        }
+        if (offset < mm->size) {
+            uint32_t n = mm->size - offset;
+            if (n > PAGE_SIZE) {
+                n = PAGE_SIZE;
+            }
+            if (file_read_at(mm->file, offset, n, paging_phys_to_virt(page.frame)) < 0) {
+                free_page((void*)page.frame);
+                return -EIO;
+            }
+        }
+        mmap_stats.copied_pages++;
+    }
+
+    int res = paging_set(region->directory, (void*)va, page.frame | region->flags);
+    if (res < 0) {
+        if (page.buf) {
+            brelse(page.buf);
+        } else {
+            free_page((void*)page.frame);
+        }
+        return res;
+    }
+    mm->pages[(mm->head + mm->count) % RZOS_MMAP_RESIDENT_PAGES] = page;
+    mm->count++;
+    region->resident_pages++;
+    return RZOS_ALL_OK;
+}
+
+static void mmap_release(struct vm_region* region)
+{
+    struct mmap_region* mm = region->private;
+    while (mm->count) {
+        mmap_unmap_page(region, &mm->pages[mm->head]);
+        mm->head = (mm->head + 1) % RZOS_MMAP_RESIDENT_PAGES;
+        mm->count--;
+    }
+    if (mm->file) {
+        file_put(mm->file);
+    }
+    kfree(mm);
+}
+
+static int mmap_reserve(struct paging_chunk_4gb* chunk, void* virt, size_t size, uint32_t flags, struct mmap_region* mm)
+{
+    if (flags & PAGE_RW) {
+        return -ERDONLY;
+    }
+    if (mm->offset % PAGE_SIZE || (uintptr_t)virt + size > KERNEL_DIRECT_MAP_OFFSET) {
+        return -EINVARG;
+    }
+    return vm_reserve_backed(chunk, virt, size, flags, &mmap_ops, mm);
+}
+
+// Maps size bytes of the file from offset at virt in chunk's address space.
+// The mapping holds on to the file, fd can be closed right after.
+int mmap_file(struct paging_chunk_4gb* chunk, void* virt, size_t size, uint32_t flags, int fd, uint32_t offset)
+{
+    struct file_stat stat;
+    int res = fstat(fd, &stat);
+    if (res < 0) {
+        return res;
+    }
+    if (stat.flags & FILE_STAT_DIRECTORY) {
+        return -EINVARG;
+    }
+    struct mmap_region* mm = kzalloc(sizeof(struct mmap_region));
+    if (!mm) {
+        return -ENOMEM;
+    }
+    file_hold(fd, &mm->file);
+    mm->dev = mm->file->volume->dev;
+    mm->offset = offset;
+    mm->size = stat.filesize;
+    res = mmap_reserve(chunk, virt, size, flags, mm);
+    if (res < 0) {
+        file_put(mm->file);
+        kfree(mm);
+    }
+    return res;
+}
+
+// Same for a whole block device, offset in bytes
+int mmap_device(struct paging_chunk_4gb* chunk, void* virt, size_t size, uint32_t flags, struct block_device* dev, uint32_t offset)
+{
+    if (!dev) {
+        return -EINVARG;
+    }
+    struct mmap_region* mm = kzalloc(sizeof(struct mmap_region));
+    if (!mm) {
+        return -ENOMEM;
+    }
+    mm->dev = dev;
+    mm->offset = offset;
+    mm->size = dev->sectors < 0x800000 ? dev->sectors * RZOS_SECTOR_SIZE : 0xFFFFF000;
+    int res = mmap_reserve(chunk, virt, size, flags, mm);
+    if (res < 0) {
+        kfree(mm);
+    }
+    return res;
+}
+
+void mmap_print_stats()
+{
+    print_serial("mmap: ");
+    kputdec(mmap_stats.faults);
+    print_serial(" faults, ");
+    kputdec(mmap_stats.shared_pages);
+    print_serial(" cache pages mapped, ");
+    kputdec(mmap_stats.copied_pages);
+    print_serial(" copied, ");
+    kputdec(mmap_stats.evictions);
+    print_serial(" unmapped to make room\n");
+}
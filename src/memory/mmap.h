@@ -0,0 +1,54 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "memory/page.h"
+#include "ssd/block.h"
+#include "ssd/bcache.h"
+#include "fs/file.h"
+
+// Read-only mappings of files and block devices. A page that is a whole
+// aligned block cache block is mapped straight to the cached buffer, which
+// stays pinned while it is mapped. Anything else, like the tail of a file or
+// a page whose clusters aren't contiguous, is copied into a frame of its own.
+// Mappings live in the user half and are taken down with vm_release. Paging
+// runs with CR0.WP, so a write through one faults in ring 0 too.
+
+// One resident page. buf is the pinned cache buffer, NULL for a copied frame.
+struct mmap_page {
+    uintptr_t va;
+    uint32_t frame;
+    struct bcache_buf* buf;
+};
+
+struct mmap_region {
+    struct block_device* dev;
+    // NULL when the device itself is mapped
+    struct file_descriptor* file;
+    // Byte offset of the first page in the file or on the device
+    uint32_t offset;
+    // Bytes of the file or device there are to map, past them pages are zero
+    uint32_t size;
+    // Resident pages oldest first, a ring of RZOS_MMAP_RESIDENT_PAGES
+    struct mmap_page pages[RZOS_MMAP_RESIDENT_PAGES];
+    uint32_t head;
+    uint32_t count;
+};
+
+struct mmap_stats {
+    uint32_t faults;
+    // Pages mapped to a block cache buffer vs copied into a frame
+    uint32_t shared_pages;
+    uint32_t copied_pages;
+    uint32_t evictions;
+};
+
+extern struct mmap_stats mmap_stats;
+
+int mmap_file(struct paging_chunk_4gb* chunk, void* virt, size_t size, uint32_t flags, int fd, uint32_t offset);
+int mmap_device(struct paging_chunk_4gb* chunk, void* virt, size_t size, uint32_t flags, struct block_device* dev, uint32_t offset);
+void mmap_print_stats();
+
+#endif
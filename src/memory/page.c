@@ -2,28 +2,43 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "memory/page.h"
-#include "utils.h" // For print_serial, itoa if needed
-#include "memory/memory.h" // For kheap_alloc and kheap_free (used for page allocation)
-#include "status.h" // For error codes like -EINVARG
-
-// --- External Prototypes and Stubs (replace with your actual implementations if they exist) ---
-extern void print_serial(char *s);
-extern void* kmalloc(size_t size);
-extern void kfree(void* ptr);
-extern void* memset(void* ptr, int c, size_t size);
-
-// A simple page frame allocator stub (returns a 4KB aligned physical address)
+#include "memory/memory.h"
+#include "memory/frame.h"
+#include "memory/zpool.h"
+#include "shell/shell.h"
+#include "utils.h"
+#include "status.h"
+#include "config.h"
+
+// Set by kernel_main once CR0.PG is on
+extern bool g_is_paging_enabled;
+
+// Page sized frames come from the buddy allocator, never from the kernel heap.
+// Returns the PHYSICAL address of the frame.
 void* alloc_page(void) {
-    void* page = kmalloc(PAGE_SIZE); 
+    uintptr_t page = frame_alloc(0);
+    if (!page) {
+        // Pre-zeroed frames are still frames
+        page = zpool_take_page();
+    }
     if (!page) {
         return NULL;
     }
-    return page;
+    return (void*)page;
 }
 
-// A simple page frame deallocator stub
 void free_page(void* ptr) {
-    kfree(ptr);
+    frame_free((uintptr_t)ptr, 0);
+}
+
+// Returns a pointer through which the kernel can reach physical address 'phys'.
+// Before paging everything is identity mapped, afterwards the higher half
+// direct map covers it.
+void* paging_phys_to_virt(uintptr_t phys) {
+    if (!g_is_paging_enabled || phys < KERNEL_DIRECT_MAP_PHYS_START) {
+        return (void*)phys;
+    }
+    return (void*)(phys - KERNEL_DIRECT_MAP_PHYS_START + KERNEL_DIRECT_MAP_OFFSET);
 }
 // -----------------------------------------------------------------------------------------
 
@@ -32,11 +47,6 @@ void free_page(void* ptr) {
 uint32_t *current_page_directory_phys = NULL;
 
 
-/* Zero 4KiB page at physical address 'phys' */
-static void zero_page_phys(uint32_t phys) {
-    uint32_t *p = (uint32_t*)(uintptr_t)phys;
-    for (int i = 0; i < PAGE_SIZE / sizeof(uint32_t); ++i) p[i] = 0;
-}
 
 
 // Implements the virt_to_phys() function.
@@ -47,14 +57,18 @@ uintptr_t virt_to_phys(uintptr_t va) {
     uint32_t pd_index = va >> 22;          
     uint32_t pt_index = (va >> 12) & 0x3FF;
 
-    uint32_t *pd = (uint32_t*)(cr3_val & 0xFFFFF000); 
+    uint32_t *pd = (uint32_t*)paging_phys_to_virt(cr3_val & 0xFFFFF000);
     uint32_t pde = pd[pd_index];
 
     if (!(pde & PAGE_PRESENT)) {
         return (uintptr_t)-1; 
     }
 
-    uint32_t *pt = (uint32_t*)(pde & 0xFFFFF000); 
+    if (pde & PAGE_PS) {
+        return (pde & 0xFFC00000) | (va & 0x3FFFFF);
+    }
+
+    uint32_t *pt = (uint32_t*)paging_phys_to_virt(pde & 0xFFFFF000);
     uint32_t pte = pt[pt_index];
 
     if (!(pte & PAGE_PRESENT)) {
@@ -65,24 +79,158 @@ uintptr_t virt_to_phys(uintptr_t va) {
 }
 
 // Switches the active page directory. This function takes a PHYSICAL address.
+// Global kernel translations survive the CR3 reload once CR4.PGE is set.
 void paging_switch(uint32_t* directory_phys_addr) {
     current_page_directory_phys = directory_phys_addr;
     __asm__ volatile("mov %0, %%cr3" :: "r"(directory_phys_addr) : "memory");
 }
 
+// Turns CR4.PGE on or off. Clearing it also drops every global TLB entry.
+void paging_set_global(bool enable) {
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (enable && RZOS_PAGING_USE_GLOBAL) {
+        cr4 |= CR4_PGE;
+    } else {
+        cr4 &= ~CR4_PGE;
+    }
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+// Drops the TLB entry for one page, global or not.
+void paging_invalidate_page(void* virt) {
+    __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+void paging_invalidate_range(void* virt, size_t size) {
+    uintptr_t va = (uintptr_t)virt & ~(PAGE_SIZE - 1);
+    uintptr_t end = (uintptr_t)virt + size;
+    for (; va < end; va += PAGE_SIZE) {
+        paging_invalidate_page((void*)va);
+    }
+}
+
+// Flushes every non-global translation
+void paging_flush_tlb(void) {
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+// Flushes everything, global kernel translations included
+void paging_flush_tlb_global(void) {
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        __asm__ volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+        __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    } else {
+        paging_flush_tlb();
+    }
+}
+
+// Invalidates 'va' if the CPU may hold a translation for it: 'pd_phys' is the
+// directory in use right now, or 'va' is in the kernel half. Every directory
+// shares the kernel half's page tables and its entries are global, so they
+// outlive a CR3 switch whichever directory they were changed through.
+static void paging_invalidate_if_live(uintptr_t pd_phys, uintptr_t va) {
+    if (g_is_paging_enabled && (va >= KERNEL_DIRECT_MAP_OFFSET || pd_phys == (uintptr_t)current_page_directory_phys)) {
+        paging_invalidate_page((void*)va);
+    }
+}
+
+// The directory every other address space takes its kernel mappings from
+static struct paging_chunk_4gb kernel_chunk;
+
+// Gives a new directory the kernel's view of memory. The kernel half is linked,
+// so every address space shares the same page tables and 4MiB entries there.
+// The low identity map shares its directory slots with user space, so its
+// page tables are copied instead.
+static int paging_share_kernel(uint32_t* pd_phys) {
+    if (kernel_chunk.directory_entry == NULL) {
+        return RZOS_ALL_OK;
+    }
+
+    uint32_t *kernel_pd = (uint32_t*)paging_phys_to_virt((uintptr_t)kernel_chunk.directory_entry);
+    uint32_t *pd = (uint32_t*)paging_phys_to_virt((uintptr_t)pd_phys);
+
+    for (int i = PAGING_KERNEL_FIRST_PDE; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++) {
+        pd[i] = kernel_pd[i];
+    }
+
+    for (int i = 0; i < PAGING_KERNEL_FIRST_PDE; i++) {
+        uint32_t pde = kernel_pd[i];
+        if (!(pde & PAGE_PRESENT) || (pde & PAGE_PS)) {
+            pd[i] = pde;
+            continue;
+        }
+
+        uint32_t table_phys = (uint32_t)alloc_page();
+        if (table_phys == 0) {
+            return -ENOMEM;
+        }
+        memcpy(paging_phys_to_virt(table_phys), paging_phys_to_virt(pde & 0xFFFFF000), PAGE_SIZE);
+        pd[i] = table_phys | (pde & 0xFFF);
+    }
+    return RZOS_ALL_OK;
+}
+
+// Allocates a zeroed directory that already carries the kernel mappings
+static uint32_t* paging_new_directory(void) {
+    uint32_t *pd_phys = (uint32_t*)zpool_alloc_page(); 
+    if (pd_phys == NULL) {
+        return NULL;
+    }
+
+    if (paging_share_kernel(pd_phys) < 0) {
+        paging_free_directory(pd_phys);
+        return NULL;
+    }
+    return pd_phys;
+}
+
+// Frees a directory and the page tables it owns. Kernel half tables are shared and stay.
+void paging_free_directory(uint32_t* pd_phys) {
+    uint32_t *pd = (uint32_t*)paging_phys_to_virt((uintptr_t)pd_phys);
+    for (int i = 0; i < PAGING_KERNEL_FIRST_PDE; i++) {
+        if ((pd[i] & PAGE_PRESENT) && !(pd[i] & PAGE_PS)) {
+            free_page((void*)(pd[i] & 0xFFFFF000));
+        }
+    }
+    free_page(pd_phys);
+}
+
+// Allocates the kernel's own directory. Directories made later by paging_chunk
+// and create_page_directory share its kernel half.
+struct paging_chunk_4gb * paging_kernel_chunk(void) {
+    if (kernel_chunk.directory_entry != NULL) {
+        return &kernel_chunk;
+    }
+
+    uint32_t *pd_phys = (uint32_t*)zpool_alloc_page();
+    if (pd_phys == NULL) {
+        return NULL;
+    }
+    kernel_chunk.directory_entry = pd_phys;
+    return &kernel_chunk;
+}
+
+// Returns the PHYSICAL address of a new page directory for a process
+uintptr_t create_page_directory(void) {
+    return (uintptr_t)paging_new_directory();
+}
+
 // Allocates and initializes a new page directory.
 // Returns a chunk struct containing the PHYSICAL address of the new directory.
 struct paging_chunk_4gb * paging_chunk(uint8_t flags) {
-    uint32_t *pd_phys = (uint32_t*)alloc_page(); 
+    uint32_t *pd_phys = paging_new_directory();
     if (pd_phys == NULL) {
         return NULL;
     }
-    
-    zero_page_phys((uint32_t)pd_phys);
 
     struct paging_chunk_4gb *chunk = (struct paging_chunk_4gb *)kmalloc(sizeof(struct paging_chunk_4gb));
     if (chunk == NULL) {
-        free_page(pd_phys);
+        paging_free_directory(pd_phys);
         return NULL;
     }
     chunk->directory_entry = pd_phys; 
@@ -90,6 +238,14 @@ struct paging_chunk_4gb * paging_chunk(uint8_t flags) {
     return chunk;
 }
 
+void paging_chunk_free(struct paging_chunk_4gb *chunk) {
+    if (chunk == NULL || chunk == &kernel_chunk) {
+        return;
+    }
+    paging_free_directory(chunk->directory_entry);
+    kfree(chunk);
+}
+
 // Returns the PHYSICAL address of the page directory from the paging_chunk struct.
 uint32_t * get_dir_chunk4gb(struct paging_chunk_4gb *chunk) {
     if (chunk == NULL) {
@@ -99,6 +255,47 @@ uint32_t * get_dir_chunk4gb(struct paging_chunk_4gb *chunk) {
 }
 
 
+struct paging_stats paging_stats;
+
+// Sets CR4.PSE so that page directory entries with PAGE_PS map 4MiB directly
+static void paging_enable_pse(void) {
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (!(cr4 & CR4_PSE)) {
+        cr4 |= CR4_PSE;
+        __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+    }
+}
+
+// Returns the page table covering pd_index, creating it when missing.
+// A 4MiB page in the way is split into an equivalent page table first.
+static uint32_t* paging_get_table(uint32_t *page_directory, uint32_t pd_index) {
+    uint32_t pde = page_directory[pd_index];
+
+    if ((pde & PAGE_PRESENT) && !(pde & PAGE_PS)) {
+        return (uint32_t*)paging_phys_to_virt(pde & 0xFFFFF000);
+    }
+
+    // New tables come from the pre-zeroed pool, split tables get overwritten anyway
+    uint32_t page_table_phys = (pde & PAGE_PS) ? (uint32_t)alloc_page() : (uint32_t)zpool_alloc_page();
+    if (page_table_phys == 0) {
+        return NULL;
+    }
+    uint32_t *page_table = (uint32_t*)paging_phys_to_virt(page_table_phys);
+    paging_stats.page_tables++;
+
+    if (pde & PAGE_PS) {
+        uint32_t base = pde & 0xFFC00000;
+        uint32_t flags = pde & 0xFFF & ~PAGE_PS;
+        for (int i = 0; i < PAGING_TOTAL_ENTRIES_PER_TABLE; i++) {
+            page_table[i] = (base + i * PAGE_SIZE) | flags;
+        }
+    }
+
+    page_directory[pd_index] = page_table_phys | PAGE_PRESENT | PAGE_RW | PAGE_USER;
+    return page_table;
+}
+
 // Maps a single virtual address to a single physical address with specified flags.
 // pd_phys: Physical address of the page directory.
 // va: Virtual address to map.
@@ -112,63 +309,65 @@ int map_page_to(uintptr_t pd_phys, uintptr_t va, uintptr_t pa, uint32_t flags) {
     uint32_t pd_index = va >> 22;           
     uint32_t pt_index = (va >> 12) & 0x3FF; 
 
-    uint32_t *page_directory = (uint32_t*)pd_phys;
-    uint32_t pde = page_directory[pd_index];
-
-    uint32_t *page_table;
-
-    if (!(pde & PAGE_PRESENT)) {
-        page_table = (uint32_t*)alloc_page();
-        if (page_table == NULL) {
-            return -ENOMEM;
-        }
-        zero_page_phys((uint32_t)page_table);
-
-        page_directory[pd_index] = (uint32_t)page_table | PAGE_PRESENT | PAGE_RW | PAGE_USER;
-    } else {
-        page_table = (uint32_t*)(pde & 0xFFFFF000);
+    uint32_t *page_directory = (uint32_t*)paging_phys_to_virt(pd_phys);
+    uint32_t *page_table = paging_get_table(page_directory, pd_index);
+    if (page_table == NULL) {
+        return -ENOMEM;
     }
 
     page_table[pt_index] = (uint32_t)pa | flags;
+    paging_stats.ptes++;
+    paging_invalidate_if_live(pd_phys, va);
 
     return RZOS_ALL_OK;
 }
 
-
-int paging_map_to(struct paging_chunk_4gb *directory_chunk, void *virt_start, void *phys_start, void *phys_end, int flags) {
-    if(phys_end!=(void*)0x300000){
-    if (directory_chunk == NULL || virt_start == NULL || phys_start == NULL || phys_end == NULL) {
-        return -EINVARG;
-    }
-}
-else{
-    uintptr_t current_virt = (uintptr_t)virt_start;
-    uintptr_t current_phys = (uintptr_t)phys_start;
-    uintptr_t last_phys = (uintptr_t)phys_end;
-    uintptr_t pd_phys_addr = (uintptr_t)directory_chunk->directory_entry;
-    while (current_phys < last_phys) {
-        int res = map_page_to(pd_phys_addr, current_virt, current_phys, flags);
-        if (res != RZOS_ALL_OK) {
-            return res; 
-        }
-        current_virt += PAGE_SIZE;
-        current_phys += PAGE_SIZE;
+// Maps a whole 4MiB page with a single page directory entry.
+// Only used when the directory slot is still empty, so no page table gets lost.
+static bool map_large_page_to(uintptr_t pd_phys, uintptr_t va, uintptr_t pa, uint32_t flags) {
+    uint32_t *page_directory = (uint32_t*)paging_phys_to_virt(pd_phys);
+    uint32_t pd_index = va >> 22;
+    if (page_directory[pd_index] & PAGE_PRESENT) {
+        return false;
     }
-    return RZOS_ALL_OK;
 
+    page_directory[pd_index] = (uint32_t)pa | flags | PAGE_PS;
+    paging_stats.large_pages++;
+    paging_invalidate_if_live(pd_phys, va);
+    return true;
 }
 
+// Maps [phys_start, phys_end) at virt_start. 4MiB pages are used wherever both
+// addresses are 4MiB aligned and a full large page fits, 4KiB pages at the edges.
+int paging_map_to(struct paging_chunk_4gb *directory_chunk, void *virt_start, void *phys_start, void *phys_end, int flags) {
     uintptr_t current_virt = (uintptr_t)virt_start;
     uintptr_t current_phys = (uintptr_t)phys_start;
     uintptr_t last_phys = (uintptr_t)phys_end;
-    
+
+    if (directory_chunk == NULL || last_phys <= current_phys) {
+        return -EINVARG;
+    }
     if ((current_virt % PAGE_SIZE) != 0 || (current_phys % PAGE_SIZE) != 0) {
         return -EINVARG;
     }
 
     uintptr_t pd_phys_addr = (uintptr_t)directory_chunk->directory_entry;
+    bool use_large = RZOS_PAGING_USE_PSE &&
+                     (current_virt % PAGE_LARGE_SIZE) == (current_phys % PAGE_LARGE_SIZE);
+    if (use_large) {
+        paging_enable_pse();
+    }
 
     while (current_phys < last_phys) {
+        if (use_large &&
+            (current_virt % PAGE_LARGE_SIZE) == 0 &&
+            last_phys - current_phys >= PAGE_LARGE_SIZE &&
+            map_large_page_to(pd_phys_addr, current_virt, current_phys, flags)) {
+            current_virt += PAGE_LARGE_SIZE;
+            current_phys += PAGE_LARGE_SIZE;
+            continue;
+        }
+
         int res = map_page_to(pd_phys_addr, current_virt, current_phys, flags);
         if (res != RZOS_ALL_OK) {
             return res; 
@@ -179,6 +378,30 @@ else{
     return RZOS_ALL_OK;
 }
 
+// Next free address in the MMIO window, mappings are never taken down
+static uintptr_t paging_mmio_next = KERNEL_MMIO_VIRTUAL_ADDRESS;
+
+// Maps a device's register range into the kernel half with caching off and
+// returns the address of phys in it. Meant for boot time, directories made
+// before the call don't see page tables it had to add.
+void* paging_map_mmio(uintptr_t phys, size_t size) {
+    uintptr_t base = phys & ~(PAGE_SIZE - 1);
+    uintptr_t end = (phys + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uintptr_t virt = paging_mmio_next;
+    if (size == 0 || end - base > KERNEL_MMIO_VIRTUAL_ADDRESS + KERNEL_MMIO_SIZE_MB * 1024 * 1024 - virt) {
+        return NULL;
+    }
+
+    uintptr_t pd_phys = (uintptr_t)paging_kernel_chunk()->directory_entry;
+    for (uintptr_t pa = base; pa < end; pa += PAGE_SIZE) {
+        if (map_page_to(pd_phys, virt + (pa - base), pa, PAGE_PRESENT | PAGE_RW | PAGE_CD | PAGE_WTH | PAGE_GLOBAL) < 0) {
+            return NULL;
+        }
+    }
+    paging_mmio_next = virt + (end - base);
+    return (void*)(virt + (phys - base));
+}
+
 // Maps a single virtual address to a single physical address.
 int paging_map(struct paging_chunk_4gb* directory, void* virt, void* phys, int flags)
 {
@@ -198,27 +421,238 @@ int paging_set(uint32_t* directory_phys_addr, void* virt_add, uint32_t val) {
     uint32_t pd_index = va >> 22;
     uint32_t pt_index = (va >> 12) & 0x3FF;
 
-    uint32_t *page_directory = (uint32_t*)(uintptr_t)directory_phys_addr;
-    uint32_t pde = page_directory[pd_index];
+    uint32_t *page_directory = (uint32_t*)paging_phys_to_virt((uintptr_t)directory_phys_addr);
+    uint32_t *page_table = paging_get_table(page_directory, pd_index);
+    if (page_table == NULL) {
+        return -ENOMEM;
+    }
 
-    uint32_t *page_table;
+    page_table[pt_index] = pa_and_flags;
+    paging_invalidate_if_live((uintptr_t)directory_phys_addr, va);
+    return RZOS_ALL_OK;
+}
 
-    if (!(pde & PAGE_PRESENT)) {
-        page_table = (uint32_t*)alloc_page(); 
-        if (page_table == NULL) {
+bool is_page_aligned(void *addr) {
+    return ((uintptr_t)addr % PAGE_SIZE) == 0;
+}
+
+// Makes sure page tables exist for every directory slot covering [virt, virt + size)
+int paging_prepare_range(uint32_t* directory_phys_addr, void* virt, size_t size) {
+    uint32_t *page_directory = (uint32_t*)paging_phys_to_virt((uintptr_t)directory_phys_addr);
+    uintptr_t va = (uintptr_t)virt & ~(PAGE_LARGE_SIZE - 1);
+    uintptr_t end = (uintptr_t)virt + size;
+    for (; va < end; va += PAGE_LARGE_SIZE) {
+        if (paging_get_table(page_directory, va >> 22) == NULL) {
             return -ENOMEM;
         }
-        zero_page_phys((uint32_t)page_table);
+        if (va + PAGE_LARGE_SIZE < va) {
+            break;
+        }
+    }
+    return RZOS_ALL_OK;
+}
 
-        page_directory[pd_index] = (uint32_t)page_table | PAGE_PRESENT | PAGE_RW | PAGE_USER;
-    } else {
-        page_table = (uint32_t*)(pde & 0xFFFFF000);
+// Returns the page table entry for 'virt', 0 when nothing is mapped there.
+uint32_t paging_get(uint32_t* directory_phys_addr, void* virt_add) {
+    uintptr_t va = (uintptr_t)virt_add;
+    uint32_t *page_directory = (uint32_t*)paging_phys_to_virt((uintptr_t)directory_phys_addr);
+    uint32_t pde = page_directory[va >> 22];
+
+    if (!(pde & PAGE_PRESENT)) {
+        return 0;
     }
-    
-    page_table[pt_index] = pa_and_flags;
+    if (pde & PAGE_PS) {
+        return (pde & 0xFFC00000) + (va & 0x3FF000) + (pde & 0xFFF & ~PAGE_PS);
+    }
+
+    uint32_t *page_table = (uint32_t*)paging_phys_to_virt(pde & 0xFFFFF000);
+    return page_table[(va >> 12) & 0x3FF];
+}
+
+// ---------------------------------------------------------------------------
+// Demand-zero regions: address space reserved up front, frames on first touch
+// ---------------------------------------------------------------------------
+static struct vm_region vm_regions[RZOS_MAX_VM_REGIONS];
+struct vm_stats vm_stats;
+
+int vm_reserve(struct paging_chunk_4gb *chunk, void *virt, size_t size, uint32_t flags) {
+    return vm_reserve_backed(chunk, virt, size, flags, NULL, NULL);
+}
+
+// Reserves a region whose pages come from ops instead of the zero pool
+int vm_reserve_backed(struct paging_chunk_4gb *chunk, void *virt, size_t size, uint32_t flags, struct vm_ops *ops, void *private) {
+    uintptr_t start = (uintptr_t)virt;
+    uintptr_t end = start + size;
+    if (chunk == NULL || size == 0 || !is_page_aligned(virt) || (size % PAGE_SIZE) != 0 || end < start) {
+        return -EINVARG;
+    }
+
+    struct vm_region *free_region = NULL;
+    for (int i = 0; i < RZOS_MAX_VM_REGIONS; i++) {
+        struct vm_region *region = &vm_regions[i];
+        if (!region->used) {
+            if (free_region == NULL) {
+                free_region = region;
+            }
+            continue;
+        }
+        if (region->directory == chunk->directory_entry && start < region->end && region->start < end) {
+            return -EISTKN;
+        }
+    }
+    if (free_region == NULL) {
+        return -ENOMEM;
+    }
+
+    memset(free_region, 0, sizeof(struct vm_region));
+    free_region->used = true;
+    free_region->directory = chunk->directory_entry;
+    free_region->start = start;
+    free_region->end = end;
+    free_region->flags = (flags | PAGE_PRESENT) & 0xFFF;
+    free_region->ops = ops;
+    free_region->private = private;
     return RZOS_ALL_OK;
 }
 
-bool is_page_aligned(void *addr) {
-    return ((uintptr_t)addr % PAGE_SIZE) == 0;
+// Unmaps a region and hands every frame it faulted in back to the frame
+// allocator. Backed regions give their pages back through their ops.
+int vm_release(struct paging_chunk_4gb *chunk, void *virt) {
+    struct vm_region *region = NULL;
+    for (int i = 0; i < RZOS_MAX_VM_REGIONS; i++) {
+        if (vm_regions[i].used && vm_regions[i].directory == chunk->directory_entry &&
+            vm_regions[i].start == (uintptr_t)virt) {
+            region = &vm_regions[i];
+            break;
+        }
+    }
+    if (region == NULL) {
+        return -EINVARG;
+    }
+
+    if (region->ops) {
+        region->ops->release(region);
+        region->used = false;
+        return RZOS_ALL_OK;
+    }
+
+    for (uintptr_t va = region->start; va < region->end && region->resident_pages; va += PAGE_SIZE) {
+        uint32_t pte = paging_get(region->directory, (void*)va);
+        if (!(pte & PAGE_PRESENT)) {
+            continue;
+        }
+        paging_set(region->directory, (void*)va, 0);
+        free_page((void*)(pte & 0xFFFFF000));
+        region->resident_pages--;
+    }
+    region->used = false;
+    return RZOS_ALL_OK;
+}
+
+// Regions in the kernel half belong to the kernel directory but are reachable from every directory
+static struct vm_region* vm_find_region(uint32_t* directory, uintptr_t va) {
+    for (int i = 0; i < RZOS_MAX_VM_REGIONS; i++) {
+        struct vm_region *region = &vm_regions[i];
+        if (!region->used || va < region->start || va >= region->end) {
+            continue;
+        }
+        if (region->directory == directory ||
+            (va >= KERNEL_DIRECT_MAP_OFFSET && region->directory == kernel_chunk.directory_entry)) {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+// Called from the page fault handler. Returns RZOS_ALL_OK when the fault was
+// resolved and the faulting instruction can simply be restarted.
+int vm_handle_fault(uintptr_t fault_addr, uint32_t err_code) {
+    vm_stats.faults++;
+
+    // Protection faults on present pages are never demand-zero faults
+    if (err_code & PAGE_FAULT_PRESENT) {
+        vm_stats.unhandled++;
+        return -EINVARG;
+    }
+
+    uint32_t *directory = current_page_directory_phys;
+    struct vm_region *region = vm_find_region(directory, fault_addr);
+    if (region == NULL) {
+        vm_stats.unhandled++;
+        return -ENOFOUND;
+    }
+
+    // Backed regions map into their own directory
+    if (region->ops) {
+        int res = region->ops->fault(region, fault_addr & ~(PAGE_SIZE - 1));
+        if (res < 0) {
+            vm_stats.unhandled++;
+            return res;
+        }
+        region->faults++;
+        return RZOS_ALL_OK;
+    }
+
+    // Kernel half regions live in the kernel directory. This directory may
+    // have been created before the page table covering the fault was.
+    uint32_t *target = directory;
+    uint32_t *pd = (uint32_t*)paging_phys_to_virt((uintptr_t)directory);
+    uint32_t *kernel_pd = (uint32_t*)paging_phys_to_virt((uintptr_t)kernel_chunk.directory_entry);
+    uint32_t pd_index = fault_addr >> 22;
+    if (fault_addr >= KERNEL_DIRECT_MAP_OFFSET && directory != kernel_chunk.directory_entry) {
+        target = kernel_chunk.directory_entry;
+        if (paging_get(target, (void*)fault_addr) & PAGE_PRESENT) {
+            pd[pd_index] = kernel_pd[pd_index];
+            paging_invalidate_page((void*)fault_addr);
+            return RZOS_ALL_OK;
+        }
+    }
+
+    uint32_t frame = (uint32_t)zpool_alloc_page();
+    if (frame == 0) {
+        vm_stats.unhandled++;
+        return -ENOMEM;
+    }
+
+    void *page = (void*)(fault_addr & ~(PAGE_SIZE - 1));
+    int res = paging_set(target, page, frame | region->flags);
+    if (res < 0) {
+        free_page((void*)frame);
+        vm_stats.unhandled++;
+        return res;
+    }
+    if (target != directory) {
+        pd[pd_index] = kernel_pd[pd_index];
+    }
+    paging_invalidate_page(page);
+
+    region->faults++;
+    region->resident_pages++;
+    vm_stats.demand_zero_pages++;
+    return RZOS_ALL_OK;
+}
+
+void vm_print_stats(void) {
+    print_serial("vm faults ");
+    kputdec(vm_stats.faults);
+    print_serial(", demand-zero pages ");
+    kputdec(vm_stats.demand_zero_pages);
+    print_serial(", unhandled ");
+    kputdec(vm_stats.unhandled);
+    print_serial("\n");
+    for (int i = 0; i < RZOS_MAX_VM_REGIONS; i++) {
+        struct vm_region *region = &vm_regions[i];
+        if (!region->used) {
+            continue;
+        }
+        print_serial("  region ");
+        kputhex(region->start);
+        print_serial(" reserved ");
+        kputdec((region->end - region->start) / 1024);
+        print_serial(" KiB resident ");
+        kputdec(region->resident_pages * (PAGE_SIZE / 1024));
+        print_serial(" KiB faults ");
+        kputdec(region->faults);
+        print_serial("\n");
+    }
 }
@@ -4,18 +4,31 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "config.h"
 /* Page table/directory entry flags */
 #define PAGE_PRESENT   0x1
 #define PAGE_RW        0x2 //page is writable
 #define PAGE_USER      0x4 //access from all
 #define PAGE_WTH       0x8 //write through
 #define PAGE_CD        0x10 //cache disabled
+#define PAGE_PS        0x80 //page directory entry maps a 4MiB page
+#define PAGE_GLOBAL    0x100 //translation survives CR3 reloads (needs CR4.PGE)
+#define PAGE_LARGE_SIZE 0x400000
+
+#define CR4_PSE        0x10
+#define CR4_PGE        0x80
+
+// Directory slots from here up are the kernel half, shared by every address space
+#define PAGING_KERNEL_FIRST_PDE (KERNEL_DIRECT_MAP_OFFSET >> 22)
 #define PAGING_TOTAL_ENTRIES_PER_TABLE 0x400 // 1024
 #define PAGING_PAGE_SIZE 0X400
 #define PAGE_SIZE 0x1000
 
 
 uintptr_t virt_to_phys(uintptr_t va);
+void* paging_phys_to_virt(uintptr_t phys);
+void* alloc_page(void);
+void free_page(void* ptr);
 int map_page_to(uintptr_t pd_phys, uintptr_t va, uintptr_t pa, uint32_t flags);
 void* map_page_to_virt(uintptr_t pa) ;
 
@@ -31,9 +44,79 @@ struct paging_chunk_4gb
 	
 };
 struct paging_chunk_4gb * paging_chunk(uint8_t flags);
+struct paging_chunk_4gb * paging_kernel_chunk(void);
+void paging_chunk_free(struct paging_chunk_4gb *chunk);
+void paging_free_directory(uint32_t* pd_phys);
+
+// TLB maintenance
+void paging_set_global(bool enable);
+void paging_invalidate_page(void* virt);
+void paging_invalidate_range(void* virt, size_t size);
+void paging_flush_tlb(void);
+void paging_flush_tlb_global(void);
 uint32_t * get_dir_chunk4gb(struct paging_chunk_4gb *chunk);
 int paging_set(uint32_t*directory,void*virt_add,uint32_t val);
 bool is_page_aligned(void *addr);
 int paging_map_to(struct paging_chunk_4gb *directory, void *virt, void *phys, void *phys_end, int flags);
+void* paging_map_mmio(uintptr_t phys, size_t size);
+
+// Counts of what the paging code has written so far
+struct paging_stats
+{
+	uint32_t page_tables;
+	uint32_t ptes;
+	uint32_t large_pages;
+};
+extern struct paging_stats paging_stats;
+
+uint32_t paging_get(uint32_t* directory, void* virt);
+int paging_prepare_range(uint32_t* directory, void* virt, size_t size);
+
+// Page fault error code bits
+#define PAGE_FAULT_PRESENT 0x1
+#define PAGE_FAULT_WRITE   0x2
+#define PAGE_FAULT_USER    0x4
+
+struct vm_region;
+
+// Backing for regions that aren't demand-zero. fault maps the page at va into
+// the region's directory, release unmaps whatever is still resident.
+struct vm_ops
+{
+	int (*fault)(struct vm_region *region, uintptr_t va);
+	void (*release)(struct vm_region *region);
+};
+
+// A reserved range of virtual memory that gets zeroed frames on first touch,
+// or pages from its ops when it has them
+struct vm_region
+{
+	bool used;
+	// PHYSICAL address of the directory the region belongs to
+	uint32_t *directory;
+	uintptr_t start;
+	uintptr_t end;
+	uint32_t flags;
+
+	uint32_t resident_pages;
+	uint32_t faults;
+
+	struct vm_ops *ops;
+	void *private;
+};
+
+struct vm_stats
+{
+	uint32_t faults;
+	uint32_t demand_zero_pages;
+	uint32_t unhandled;
+};
+extern struct vm_stats vm_stats;
+
+int vm_reserve(struct paging_chunk_4gb *chunk, void *virt, size_t size, uint32_t flags);
+int vm_reserve_backed(struct paging_chunk_4gb *chunk, void *virt, size_t size, uint32_t flags, struct vm_ops *ops, void *private);
+int vm_release(struct paging_chunk_4gb *chunk, void *virt);
+int vm_handle_fault(uintptr_t fault_addr, uint32_t err_code);
+void vm_print_stats(void);
 
 #endif
@@ -0,0 +1,216 @@
+#include "memory/slab.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "utils.h"
+#include <stdbool.h>
+
+static struct slab_cache slab_caches[SLAB_TOTAL_CACHES];
+
+// Objects start after the page header, rounded up so that small objects stay naturally aligned
+#define SLAB_HEADER_SIZE ((sizeof(struct slab_page) + 15) & ~15)
+
+void slab_init()
+{
+    for (int i = 0; i < SLAB_TOTAL_CACHES; i++)
+    {
+        struct slab_cache* cache = &slab_caches[i];
+        memset(cache, 0, sizeof(struct slab_cache));
+        cache->object_size = SLAB_MIN_SIZE << i;
+        cache->objects_per_page = (RZOS_HEAP_BLOCK_SIZE - SLAB_HEADER_SIZE) / cache->object_size;
+    }
+}
+
+static int slab_cache_index(size_t size)
+{
+    int index = 0;
+    size_t object_size = SLAB_MIN_SIZE;
+    while (object_size < size)
+    {
+        object_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+struct slab_cache* slab_get_cache(int index)
+{
+    if (index < 0 || index >= SLAB_TOTAL_CACHES)
+    {
+        return NULL;
+    }
+    return &slab_caches[index];
+}
+
+static void slab_list_remove(struct slab_page** head, struct slab_page* page)
+{
+    if (page->prev)
+    {
+        page->prev->next = page->next;
+    }
+    else
+    {
+        *head = page->next;
+    }
+
+    if (page->next)
+    {
+        page->next->prev = page->prev;
+    }
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static void slab_list_push(struct slab_page** head, struct slab_page* page)
+{
+    page->prev = NULL;
+    page->next = *head;
+    if (*head)
+    {
+        (*head)->prev = page;
+    }
+    *head = page;
+}
+
+static struct slab_page* slab_page_create(struct slab_cache* cache)
+{
+    // Slab pages are whole heap blocks, so this never recurses into the slab layer
+    struct slab_page* page = kmalloc(RZOS_HEAP_BLOCK_SIZE);
+    if (!page)
+    {
+        return NULL;
+    }
+
+    page->magic = SLAB_PAGE_MAGIC;
+    page->cache = cache;
+    page->prev = NULL;
+    page->next = NULL;
+    page->inuse = 0;
+    page->capacity = cache->objects_per_page;
+
+    // Thread the freelist through the objects, lowest address first
+    char* object = (char*)page + SLAB_HEADER_SIZE;
+    page->freelist = object;
+    for (uint32_t i = 0; i < cache->objects_per_page; i++)
+    {
+        void* next = (i + 1 < cache->objects_per_page) ? object + cache->object_size : NULL;
+        *(void**)object = next;
+        object += cache->object_size;
+    }
+
+    cache->active_pages++;
+    return page;
+}
+
+static struct slab_page* slab_page_of(void* ptr)
+{
+    struct slab_page* page = (struct slab_page*)((uintptr_t)ptr & ~(RZOS_HEAP_BLOCK_SIZE - 1));
+    if (page->magic != SLAB_PAGE_MAGIC)
+    {
+        return NULL;
+    }
+    return page;
+}
+
+void* slab_alloc(size_t size)
+{
+    if (size == 0 || size > SLAB_MAX_SIZE)
+    {
+        return NULL;
+    }
+
+    struct slab_cache* cache = &slab_caches[slab_cache_index(size)];
+    struct slab_page* page = cache->partial;
+    if (!page)
+    {
+        page = slab_page_create(cache);
+        if (!page)
+        {
+            return NULL;
+        }
+        slab_list_push(&cache->partial, page);
+    }
+
+    void* object = page->freelist;
+    page->freelist = *(void**)object;
+    page->inuse++;
+    if (page->inuse == page->capacity)
+    {
+        slab_list_remove(&cache->partial, page);
+        slab_list_push(&cache->full, page);
+    }
+
+    cache->total_allocs++;
+    cache->active_objects++;
+    return object;
+}
+
+void slab_free(void* ptr)
+{
+    struct slab_page* page = slab_page_of(ptr);
+    if (!page)
+    {
+        return;
+    }
+
+    struct slab_cache* cache = page->cache;
+    if (page->inuse == page->capacity)
+    {
+        slab_list_remove(&cache->full, page);
+        slab_list_push(&cache->partial, page);
+    }
+
+    *(void**)ptr = page->freelist;
+    page->freelist = ptr;
+    page->inuse--;
+    cache->total_frees++;
+    cache->active_objects--;
+
+    // Give empty pages back to the heap, but keep one around so a cache that
+    // bounces between zero and one object does not churn the block table
+    if (page->inuse == 0 && (page->prev || page->next))
+    {
+        slab_list_remove(&cache->partial, page);
+        page->magic = 0;
+        cache->active_pages--;
+        kfree(page);
+    }
+}
+
+size_t slab_object_size(void* ptr)
+{
+    struct slab_page* page = slab_page_of(ptr);
+    if (!page)
+    {
+        return 0;
+    }
+    return page->cache->object_size;
+}
+
+void slab_print_stats()
+{
+    print_serial("slab caches (size objects pages allocs frees saved_bytes)\n");
+    for (int i = 0; i < SLAB_TOTAL_CACHES; i++)
+    {
+        struct slab_cache* cache = &slab_caches[i];
+        // Without the slab layer every live object would own a whole heap block
+        uint32_t saved = 0;
+        if (cache->active_objects > cache->active_pages)
+        {
+            saved = (cache->active_objects - cache->active_pages) * RZOS_HEAP_BLOCK_SIZE;
+        }
+
+        print_serial("  ");
+        kputdec(cache->object_size);
+        print_serial(" ");
+        kputdec(cache->active_objects);
+        print_serial(" ");
+        kputdec(cache->active_pages);
+        print_serial(" ");
+        kputdec(cache->total_allocs);
+        print_serial(" ");
+        kputdec(cache->total_frees);
+        print_serial(" ");
+        kputdec(saved);
+        print_serial("\n");
+    }
+}
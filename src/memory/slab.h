@@ -0,0 +1,57 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+// Power of two size classes served from slab pages: 8, 16, ... 1024 bytes.
+// With the page header, a 2048 byte class would fit one object per page,
+// which the heap serves just as well, so larger sizes go there.
+#define SLAB_MIN_SHIFT 3
+#define SLAB_MAX_SHIFT 10
+#define SLAB_MIN_SIZE (1 << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE (1 << SLAB_MAX_SHIFT)
+#define SLAB_TOTAL_CACHES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+#define SLAB_PAGE_MAGIC 0x51AB51AB
+
+// Lives at the start of every slab page, objects follow it
+struct slab_page
+{
+    uint32_t magic;
+    struct slab_cache* cache;
+    struct slab_page* prev;
+    struct slab_page* next;
+
+    // In-page freelist, each free object holds a pointer to the next one
+    void* freelist;
+    uint16_t inuse;
+    uint16_t capacity;
+};
+
+struct slab_cache
+{
+    uint32_t object_size;
+    uint32_t objects_per_page;
+
+    // Pages with at least one free object
+    struct slab_page* partial;
+    // Pages with every object handed out
+    struct slab_page* full;
+
+    // Usage counters
+    uint32_t total_allocs;
+    uint32_t total_frees;
+    uint32_t active_objects;
+    uint32_t active_pages;
+};
+
+void slab_init();
+void* slab_alloc(size_t size);
+void slab_free(void* ptr);
+size_t slab_object_size(void* ptr);
+struct slab_cache* slab_get_cache(int index);
+void slab_print_stats();
+
+#endif
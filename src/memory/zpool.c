@@ -0,0 +1,109 @@
+#include "memory/zpool.h"
+#include "memory/frame.h"
+#include "memory/page.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "utils.h"
+#include "idt/irq.h"
+
+// Physical addresses of zeroed frames, used as a stack
+static uintptr_t zpool_pages[RZOS_ZERO_POOL_PAGES];
+static uint32_t zpool_count = 0;
+struct zpool_stats zpool_stats;
+
+// Pops a zeroed frame, 0 when the pool is empty
+uintptr_t zpool_take_page()
+{
+    uintptr_t page = 0;
+    uint32_t flags = irq_save();
+    if (zpool_count > 0)
+    {
+        page = zpool_pages[--zpool_count];
+    }
+    irq_restore(flags);
+    return page;
+}
+
+// Returns the physical address of a zeroed frame, from the pool when possible
+uintptr_t zpool_alloc_page()
+{
+    uintptr_t page = zpool_take_page();
+    if (page)
+    {
+        zpool_stats.hits++;
+        return page;
+    }
+
+    page = frame_alloc(0);
+    if (!page)
+    {
+        return 0;
+    }
+
+    uint64_t start = rdtsc();
+    memset(paging_phys_to_virt(page), 0, PAGE_SIZE);
+    zpool_stats.inline_zero_cycles += rdtsc() - start;
+    zpool_stats.misses++;
+    return page;
+}
+
+// Zeroes up to 'max_pages' fresh frames into the pool. Meant for the idle
+// loop or other deferred context. Returns how many pages were added.
+uint32_t zpool_refill(uint32_t max_pages)
+{
+    uint32_t added = 0;
+    uint64_t start = rdtsc();
+    while (added < max_pages && zpool_count < RZOS_ZERO_POOL_PAGES)
+    {
+        uintptr_t page = frame_alloc(0);
+        if (!page)
+        {
+            break;
+        }
+        memset(paging_phys_to_virt(page), 0, PAGE_SIZE);
+
+        uint32_t flags = irq_save();
+        bool stored = zpool_count < RZOS_ZERO_POOL_PAGES;
+        if (stored)
+        {
+            zpool_pages[zpool_count++] = page;
+        }
+        irq_restore(flags);
+
+        if (!stored)
+        {
+            frame_free(page, 0);
+            break;
+        }
+        added++;
+    }
+
+    if (added)
+    {
+        zpool_stats.refill_cycles += rdtsc() - start;
+        zpool_stats.refilled_pages += added;
+    }
+    return added;
+}
+
+uint32_t zpool_available()
+{
+    return zpool_count;
+}
+
+void zpool_print_stats()
+{
+    print_serial("zero pool: ");
+    kputdec(zpool_count);
+    print_serial(" ready, ");
+    kputdec(zpool_stats.hits);
+    print_serial(" hits, ");
+    kputdec(zpool_stats.misses);
+    print_serial(" misses, ");
+    kputdec(zpool_stats.refilled_pages);
+    print_serial(" pages zeroed while idle (");
+    kputdec((uint32_t)udiv64(zpool_stats.refill_cycles, zpool_stats.refilled_pages ? zpool_stats.refilled_pages : 1));
+    print_serial(" cycles each), inline zeroing ");
+    kputdec((uint32_t)udiv64(zpool_stats.inline_zero_cycles, zpool_stats.misses ? zpool_stats.misses : 1));
+    print_serial(" cycles each\n");
+}
@@ -0,0 +1,27 @@
+#ifndef ZPOOL_H
+#define ZPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+// Frames zeroed ahead of time, so that page tables and zeroed allocations
+// do not pay for clearing 4KiB on the critical path
+struct zpool_stats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t refilled_pages;
+    // Cycles spent zeroing in the idle loop vs. inline on a miss
+    uint64_t refill_cycles;
+    uint64_t inline_zero_cycles;
+};
+extern struct zpool_stats zpool_stats;
+
+uintptr_t zpool_alloc_page();
+uintptr_t zpool_take_page();
+uint32_t zpool_refill(uint32_t max_pages);
+uint32_t zpool_available();
+void zpool_print_stats();
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "pci/pci.h"
+#include "io/io.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+static struct pci_device pci_devices[PCI_MAX_DEVICES];
+static int pci_total = 0;
+
+static uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+           ((uint32_t)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return insl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    return (uint16_t)(pci_read32(bus, slot, func, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    return (uint8_t)(pci_read32(bus, slot, func, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t val)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t val)
+{
+    uint32_t old = pci_read32(bus, slot, func, offset);
+    uint32_t shift = (offset & 2) * 8;
+    old &= ~(0xFFFF << shift);
+    old |= (uint32_t)val << shift;
+    pci_write32(bus, slot, func, offset, old);
+}
+
+static void pci_add_function(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    if (pci_total >= PCI_MAX_DEVICES) {
+        return;
+    }
+    struct pci_device* dev = &pci_devices[pci_total++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor = pci_read16(bus, slot, func, PCI_VENDOR_ID);
+    dev->device = pci_read16(bus, slot, func, PCI_DEVICE_ID);
+    dev->class_code = pci_read8(bus, slot, func, PCI_CLASS);
+    dev->subclass = pci_read8(bus, slot, func, PCI_SUBCLASS);
+    dev->prog_if = pci_read8(bus, slot, func, PCI_PROG_IF);
+    dev->irq = pci_read8(bus, slot, func, PCI_INTERRUPT_LINE);
+    for (int i = 0; i < 6; i++) {
+        dev->bar[i] = pci_read32(bus, slot, func, PCI_BAR0 + i * 4);
+    }
+}
+
+// Brute-force scan of every bus/slot, good enough for QEMU's handful of devices
+int pci_init()
+{
+    pci_total = 0;
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            if (pci_read16(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) {
+                continue;
+            }
+            int functions = (pci_read8(bus, slot, 0, PCI_HEADER_TYPE) & 0x80) ? 8 : 1;
+            for (int func = 0; func < functions; func++) {
+                if (pci_read16(bus, slot, func, PCI_VENDOR_ID) != 0xFFFF) {
+                    pci_add_function(bus, slot, func);
+                }
+            }
+        }
+    }
+    return pci_total > 0 ? RZOS_ALL_OK : -ENOFOUND;
+}
+
+int pci_device_count()
+{
+    return pci_total;
+}
+
+struct pci_device* pci_get_device(int index)
+{
+    if (index < 0 || index >= pci_total) {
+        return NULL;
+    }
+    return &pci_devices[index];
+}
+
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass)
+{
+    for (int i = 0; i < pci_total; i++) {
+        if (pci_devices[i].class_code == class_code && pci_devices[i].subclass == subclass) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+struct pci_device* pci_find_device(uint16_t vendor, uint16_t device)
+{
+    for (int i = 0; i < pci_total; i++) {
+        if (pci_devices[i].vendor == vendor && pci_devices[i].device == device) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+void pci_enable_bus_master(struct pci_device* dev)
+{
+    uint16_t command = pci_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER;
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, command);
+}
+
+void pci_print_devices()
+{
+    for (int i = 0; i < pci_total; i++) {
+        struct pci_device* dev = &pci_devices[i];
+        print_serial("PCI ");
+        kputdec(dev->bus);
+        print_serial(":");
+        kputdec(dev->slot);
+        print_serial(".");
+        kputdec(dev->func);
+        print_serial(" id ");
+        kputhex(((uint32_t)dev->vendor << 16) | dev->device);
+        print_serial(" class ");
+        kputhex(((uint32_t)dev->class_code << 8) | dev->subclass);
+        print_serial("\n");
+    }
+}
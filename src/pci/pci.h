@@ -0,0 +1,58 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_PROG_IF 0x09
+#define PCI_SUBCLASS 0x0A
+#define PCI_CLASS 0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_MEMORY 0x02
+#define PCI_COMMAND_BUS_MASTER 0x04
+
+#define PCI_BAR_IO 0x01
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+#define PCI_MAX_DEVICES 32
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t irq;
+    uint16_t vendor;
+    uint16_t device;
+    uint32_t bar[6];
+};
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t val);
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t val);
+
+int pci_init();
+int pci_device_count();
+struct pci_device* pci_get_device(int index);
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass);
+struct pci_device* pci_find_device(uint16_t vendor, uint16_t device);
+void pci_enable_bus_master(struct pci_device* dev);
+void pci_print_devices();
+
+#endif
@@ -0,0 +1,555 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/ahci.h"
+#include "ssd/ata.h"
+#include "idt/irq.h"
+#include "shell/shell.h"
+#include "config.h"
+#include "status.h"
+#include "pci/pci.h"
+#include "memory/memory.h"
+#include "memory/page.h"
+#include "ssd/block.h"
+
+struct ahci_stats ahci_stats;
+
+struct ahci_slot {
+    BLOCK_CALLBACK callback;
+    void* ctx;
+};
+
+// The one port the driver uses, the first with an ATA disk behind it.
+// busy has a bit per command slot handed to the HBA and not yet reaped.
+struct ahci_port {
+    volatile uint8_t* regs;
+    uint32_t index;
+    struct ahci_cmd_header* cmd_list;
+    struct ahci_cmd_table* tables[AHCI_MAX_SLOTS];
+    uint32_t slots;
+    bool ncq;
+    uint32_t busy;
+    uint32_t inflight;
+    struct ahci_slot slot[AHCI_MAX_SLOTS];
+};
+
+static volatile uint8_t* ahci_hba = NULL;
+static struct ahci_port ahci_port;
+static bool ahci_ready = false;
+
+static int ahci_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+static int ahci_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+static int ahci_flush(struct block_device* dev);
+static int ahci_submit(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx);
+static void ahci_poll(struct block_device* dev);
+
+static struct block_device ahci_block_device = {
+    .name = "sda",
+    .read = ahci_read,
+    .write = ahci_write,
+    .flush = ahci_flush,
+    .submit = ahci_submit,
+    .poll = ahci_poll,
+};
+
+static uint32_t ahci_hba_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(ahci_hba + reg);
+}
+
+static void ahci_hba_write(uint32_t reg, uint32_t val)
+{
+    *(volatile uint32_t*)(ahci_hba + reg) = val;
+}
+
+static uint32_t ahci_port_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(ahci_port.regs + reg);
+}
+
+static void ahci_port_write(uint32_t reg, uint32_t val)
+{
+    *(volatile uint32_t*)(ahci_port.regs + reg) = val;
+}
+
+// Waits for the bits in mask to clear in a port register
+static int ahci_port_wait_clear(uint32_t reg, uint32_t mask)
+{
+    for (int i = 0; i < AHCI_TIMEOUT; i++) {
+        if (!(ahci_port_read(reg) & mask)) {
+            return RZOS_ALL_OK;
+        }
+    }
+    return -EIO;
+}
+
+static int ahci_port_stop()
+{
+    ahci_port_write(AHCI_PX_CMD, ahci_port_read(AHCI_PX_CMD) & ~AHCI_PX_CMD_ST);
+    if (ahci_port_wait_clear(AHCI_PX_CMD, AHCI_PX_CMD_CR) < 0) {
+        return -EIO;
+    }
+    ahci_port_write(AHCI_PX_CMD, ahci_port_read(AHCI_PX_CMD) & ~AHCI_PX_CMD_FRE);
+    return ahci_port_wait_clear(AHCI_PX_CMD, AHCI_PX_CMD_FR);
+}
+
+static int ahci_port_start()
+{
+    if (ahci_port_wait_clear(AHCI_PX_TFD, AHCI_TFD_BSY | AHCI_TFD_DRQ) < 0) {
+        return -EIO;
+    }
+    ahci_port_write(AHCI_PX_CMD, ahci_port_read(AHCI_PX_CMD) | AHCI_PX_CMD_FRE);
+    ahci_port_write(AHCI_PX_CMD, ahci_port_read(AHCI_PX_CMD) | AHCI_PX_CMD_ST);
+    return RZOS_ALL_OK;
+}
+
+// Fills the slot's PRDT from the segments, one entry per physically
+// contiguous run. Returns the number of entries or a negative error.
+static int ahci_build_prdt(struct ahci_cmd_table* table, struct block_segment* segs, uint32_t nsegs)
+{
+    uint32_t entries = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uintptr_t va = (uintptr_t)segs[i].buf;
+        uint32_t left = segs[i].count * RZOS_SECTOR_SIZE;
+        if (va & 1) {
+            return -EINVARG;
+        }
+        while (left) {
+            uintptr_t pa = virt_to_phys(va);
+            if (pa == (uintptr_t)-1) {
+                return -EINVARG;
+            }
+            uint32_t len = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+            if (len > left) {
+                len = left;
+            }
+
+            struct ahci_prd* last = entries ? &table->prdt[entries - 1] : NULL;
+            uint32_t last_len = last ? (last->dbc & 0x3FFFFF) + 1 : 0;
+            if (last && last->dba + last_len == pa && last_len + len <= AHCI_PRD_MAX_BYTES) {
+                last->dbc = last_len + len - 1;
+            } else {
+                if (entries == AHCI_PRDT_ENTRIES) {
+                    return -ENOMEM;
+                }
+                last = &table->prdt[entries++];
+                last->dba = pa;
+                last->dbau = 0;
+                last->reserved = 0;
+                last->dbc = len - 1;
+            }
+            va += len;
+            left -= len;
+        }
+    }
+    return entries;
+}
+
+static void ahci_build_fis(struct ahci_cmd_table* table, uint8_t command, uint32_t lba, uint32_t count, uint32_t tag)
+{
+    struct fis_reg_h2d* fis = (struct fis_reg_h2d*)table->cfis;
+    memset(fis, 0, sizeof(*fis));
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_COMMAND;
+    fis->command = command;
+    fis->lba0 = lba & 0xFF;
+    fis->lba1 = (lba >> 8) & 0xFF;
+    fis->lba2 = (lba >> 16) & 0xFF;
+    fis->lba3 = (lba >> 24) & 0xFF;
+    // LBA mode
+    fis->device = 0x40;
+    if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+        // NCQ moves the sector count into the features field and the tag
+        // into the count field
+        fis->feature_lo = count & 0xFF;
+        fis->feature_hi = (count >> 8) & 0xFF;
+        fis->count_lo = tag << 3;
+    } else {
+        fis->count_lo = count & 0xFF;
+        fis->count_hi = (count >> 8) & 0xFF;
+    }
+}
+
+static void ahci_fill_header(uint32_t slot, bool write, uint32_t prdtl)
+{
+    struct ahci_cmd_header* header = &ahci_port.cmd_list[slot];
+    header->flags = (sizeof(struct fis_reg_h2d) / 4) | (write ? AHCI_CMD_HEADER_WRITE : 0);
+    header->prdtl = prdtl;
+    header->prdbc = 0;
+}
+
+// Hands back every slot the HBA is done with. On a port error every
+// outstanding command fails and the port is restarted. Runs with interrupts
+// off, from the IRQ handler or a polling caller.
+static void ahci_complete()
+{
+    uint32_t is = ahci_port_read(AHCI_PX_IS);
+    ahci_port_write(AHCI_PX_IS, is);
+    ahci_hba_write(AHCI_IS, 1u << ahci_port.index);
+
+    uint32_t done;
+    int status = RZOS_ALL_OK;
+    if (is & AHCI_PX_IS_ERRORS) {
+        done = ahci_port.busy;
+        status = -EIO;
+        ahci_stats.errors++;
+        ahci_port_stop();
+        ahci_port_write(AHCI_PX_SERR, 0xFFFFFFFF);
+        ahci_port_write(AHCI_PX_IS, 0xFFFFFFFF);
+        ahci_port_start();
+    } else {
+        done = ahci_port.busy & ~(ahci_port_read(AHCI_PX_SACT) | ahci_port_read(AHCI_PX_CI));
+    }
+
+    for (uint32_t slot = 0; done; slot++) {
+        if (!(done & (1u << slot))) {
+            continue;
+        }
+        done &= ~(1u << slot);
+        BLOCK_CALLBACK callback = ahci_port.slot[slot].callback;
+        void* ctx = ahci_port.slot[slot].ctx;
+        ahci_port.busy &= ~(1u << slot);
+        ahci_port.inflight--;
+        if (callback) {
+            callback(status, ctx);
+        }
+    }
+}
+
+static void ahci_poll(struct block_device* dev)
+{
+    uint32_t flags = irq_save();
+    ahci_complete();
+    irq_restore(flags);
+}
+
+static void ahci_irq_handler(registers_t* regs)
+{
+    // The line may be shared, only act on our port's interrupt
+    if (!(ahci_hba_read(AHCI_IS) & (1u << ahci_port.index))) {
+        return;
+    }
+    ahci_stats.irqs++;
+    ahci_complete();
+}
+
+// Issues one command and returns. With NCQ up to slots commands are out at
+// once and the drive may finish them in any order.
+static int ahci_submit(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx)
+{
+    if (!ahci_ready || nsegs == 0) {
+        return -EINVARG;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        count += segs[i].count;
+    }
+    if (count == 0 || count > ATA_MAX_SECTORS_LBA48 || (uint64_t)lba + count > ahci_block_device.sectors) {
+        return -EINVARG;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t slot = 0;
+    while (slot < ahci_port.slots && (ahci_port.busy & (1u << slot))) {
+        slot++;
+    }
+    if (slot == ahci_port.slots) {
+        irq_restore(flags);
+        return -EISTKN;
+    }
+
+    struct ahci_cmd_table* table = ahci_port.tables[slot];
+    int entries = ahci_build_prdt(table, segs, nsegs);
+    if (entries < 0) {
+        irq_restore(flags);
+        return entries;
+    }
+    uint8_t command;
+    if (ahci_port.ncq) {
+        command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    } else {
+        command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+    ahci_build_fis(table, command, lba, count, slot);
+    ahci_fill_header(slot, write, entries);
+
+    ahci_port.slot[slot].callback = callback;
+    ahci_port.slot[slot].ctx = ctx;
+    ahci_port.busy |= 1u << slot;
+    ahci_port.inflight++;
+    if (ahci_port.inflight > ahci_stats.max_inflight) {
+        ahci_stats.max_inflight = ahci_port.inflight;
+    }
+    __asm__ volatile("" ::: "memory");
+    if (ahci_port.ncq) {
+        ahci_port_write(AHCI_PX_SACT, 1u << slot);
+    }
+    ahci_port_write(AHCI_PX_CI, 1u << slot);
+
+    ahci_stats.requests++;
+    ahci_stats.sectors += count;
+    if (write) {
+        ahci_stats.writes++;
+    }
+    irq_restore(flags);
+    return RZOS_ALL_OK;
+}
+
+struct ahci_wait {
+    volatile bool done;
+    int status;
+};
+
+static void ahci_transfer_done(int status, void* ctx)
+{
+    struct ahci_wait* wait = ctx;
+    wait->status = status;
+    wait->done = true;
+}
+
+// Blocking transfer for callers outside the block queue, polls so it also
+// works with interrupts off
+static int ahci_transfer(uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    struct ahci_wait wait = { .done = false, .status = RZOS_ALL_OK };
+    struct block_segment seg = { .buf = buf, .count = count };
+    int res;
+    for (;;) {
+        res = ahci_submit(&ahci_block_device, lba, write, &seg, 1, ahci_transfer_done, &wait);
+        if (res != -EISTKN) {
+            break;
+        }
+        uint32_t flags = irq_save();
+        ahci_complete();
+        irq_restore(flags);
+    }
+    if (res < 0) {
+        return res;
+    }
+    while (!wait.done) {
+        uint32_t flags = irq_save();
+        ahci_complete();
+        irq_restore(flags);
+    }
+    return wait.status;
+}
+
+static int ahci_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return ahci_transfer(lba, count, buf, false);
+}
+
+static int ahci_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return ahci_transfer(lba, count, buf, true);
+}
+
+// FLUSH CACHE EXT can't be queued next to NCQ commands, so it waits for the
+// port to drain and then runs alone from slot 0, polled with interrupts off
+static int ahci_flush(struct block_device* dev)
+{
+    if (!ahci_ready) {
+        return -EIO;
+    }
+    uint32_t flags = irq_save();
+    while (ahci_port.busy) {
+        ahci_complete();
+    }
+
+    struct ahci_cmd_table* table = ahci_port.tables[0];
+    ahci_build_fis(table, ATA_CMD_FLUSH_CACHE_EXT, 0, 0, 0);
+    ahci_fill_header(0, false, 0);
+    ahci_port_write(AHCI_PX_CI, 1);
+    int res = ahci_port_wait_clear(AHCI_PX_CI, 1);
+    uint32_t is = ahci_port_read(AHCI_PX_IS);
+    ahci_port_write(AHCI_PX_IS, is);
+    ahci_hba_write(AHCI_IS, 1u << ahci_port.index);
+    if (res == RZOS_ALL_OK && (is & AHCI_PX_IS_ERRORS)) {
+        res = -EIO;
+    }
+    ahci_stats.flushes++;
+    if (res < 0) {
+        ahci_stats.errors++;
+    }
+    irq_restore(flags);
+    return res;
+}
+
+// Runs IDENTIFY DEVICE from slot 0 before interrupts are set up
+static int ahci_identify()
+{
+    void* page = alloc_page();
+    if (!page) {
+        return -ENOMEM;
+    }
+    uint16_t* id = paging_phys_to_virt((uintptr_t)page);
+
+    struct ahci_cmd_table* table = ahci_port.tables[0];
+    table->prdt[0].dba = (uintptr_t)page;
+    table->prdt[0].dbau = 0;
+    table->prdt[0].reserved = 0;
+    table->prdt[0].dbc = RZOS_SECTOR_SIZE - 1;
+    ahci_build_fis(table, ATA_CMD_IDENTIFY, 0, 0, 0);
+    ((struct fis_reg_h2d*)table->cfis)->device = 0;
+    ahci_fill_header(0, false, 1);
+
+    ahci_port_write(AHCI_PX_IS, 0xFFFFFFFF);
+    ahci_port_write(AHCI_PX_CI, 1);
+    int res = ahci_port_wait_clear(AHCI_PX_CI, 1);
+    if (res == RZOS_ALL_OK && (ahci_port_read(AHCI_PX_IS) & AHCI_PX_IS_ERRORS)) {
+        res = -EIO;
+    }
+    ahci_port_write(AHCI_PX_IS, 0xFFFFFFFF);
+    if (res < 0 || !(id[ATA_ID_COMMAND_SETS] & ATA_ID_LBA48_SUPPORTED)) {
+        free_page(page);
+        return res < 0 ? res : -EUNIMP;
+    }
+
+    uint32_t lo = id[ATA_ID_LBA48_SECTORS] | ((uint32_t)id[ATA_ID_LBA48_SECTORS + 1] << 16);
+    uint32_t hi = id[ATA_ID_LBA48_SECTORS + 2] | ((uint32_t)id[ATA_ID_LBA48_SECTORS + 3] << 16);
+    ahci_block_device.sectors = hi ? 0xFFFFFFFF : lo;
+
+    // Without NCQ commands run one at a time
+    uint32_t depth = 1;
+    if ((ahci_hba_read(AHCI_CAP) & AHCI_CAP_SNCQ) && (id[ATA_ID_SATA_CAPS] & ATA_ID_SATA_NCQ)) {
+        ahci_port.ncq = true;
+        depth = (id[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1;
+    }
+    if (depth < ahci_port.slots) {
+        ahci_port.slots = depth;
+    }
+    free_page(page);
+    return RZOS_ALL_OK;
+}
+
+// Gives the port its command list, FIS receive area and one command table
+// per slot, then starts it
+static int ahci_port_init(uint32_t index)
+{
+    ahci_port.index = index;
+    ahci_port.regs = ahci_hba + AHCI_PORT_BASE + index * AHCI_PORT_SIZE;
+    if (ahci_port_stop() < 0) {
+        return -EIO;
+    }
+
+    // Command list at the start of the page, received FISes at 1 KiB
+    void* page = alloc_page();
+    if (!page) {
+        return -ENOMEM;
+    }
+    uint8_t* mem = paging_phys_to_virt((uintptr_t)page);
+    memset(mem, 0, PAGE_SIZE);
+    ahci_port.cmd_list = (struct ahci_cmd_header*)mem;
+    ahci_port_write(AHCI_PX_CLB, (uintptr_t)page);
+    ahci_port_write(AHCI_PX_CLBU, 0);
+    ahci_port_write(AHCI_PX_FB, (uintptr_t)page + 1024);
+    ahci_port_write(AHCI_PX_FBU, 0);
+
+    for (uint32_t slot = 0; slot < ahci_port.slots; slot++) {
+        void* table = alloc_page();
+        if (!table) {
+            return -ENOMEM;
+        }
+        ahci_port.tables[slot] = paging_phys_to_virt((uintptr_t)table);
+        memset(ahci_port.tables[slot], 0, PAGE_SIZE);
+        ahci_port.cmd_list[slot].ctba = (uintptr_t)table;
+        ahci_port.cmd_list[slot].ctbau = 0;
+    }
+
+    ahci_port_write(AHCI_PX_SERR, 0xFFFFFFFF);
+    ahci_port_write(AHCI_PX_IS, 0xFFFFFFFF);
+    return ahci_port_start();
+}
+
+// First implemented port with an ATA disk linked up behind it
+static int ahci_find_port()
+{
+    uint32_t implemented = ahci_hba_read(AHCI_PI);
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (!(implemented & (1u << i))) {
+            continue;
+        }
+        volatile uint8_t* regs = ahci_hba + AHCI_PORT_BASE + i * AHCI_PORT_SIZE;
+        uint32_t ssts = *(volatile uint32_t*)(regs + AHCI_PX_SSTS);
+        uint32_t sig = *(volatile uint32_t*)(regs + AHCI_PX_SIG);
+        if ((ssts & 0xF) == AHCI_SSTS_DET_PRESENT && ((ssts >> 8) & 0xF) == AHCI_SSTS_IPM_ACTIVE &&
+            sig == AHCI_SIG_ATA) {
+            return i;
+        }
+    }
+    return -ENOFOUND;
+}
+
+int ahci_init()
+{
+    if (pci_device_count() == 0) {
+        pci_init();
+    }
+    struct pci_device* dev = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA);
+    if (!dev || dev->prog_if != PCI_PROG_IF_AHCI || (dev->bar[AHCI_PCI_BAR] & PCI_BAR_IO) || dev->irq >= IRQ_COUNT) {
+        return -ENOFOUND;
+    }
+
+    ahci_hba = paging_map_mmio(dev->bar[AHCI_PCI_BAR] & ~0xF, AHCI_PORT_BASE + AHCI_MAX_PORTS * AHCI_PORT_SIZE);
+    if (!ahci_hba) {
+        return -ENOMEM;
+    }
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND,
+                pci_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND) | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+    ahci_hba_write(AHCI_GHC, ahci_hba_read(AHCI_GHC) | AHCI_GHC_AE);
+
+    int port = ahci_find_port();
+    if (port < 0) {
+        return port;
+    }
+    ahci_port.slots = ((ahci_hba_read(AHCI_CAP) >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    int res = ahci_port_init(port);
+    if (res < 0) {
+        return res;
+    }
+    res = ahci_identify();
+    if (res < 0) {
+        return res;
+    }
+
+    res = irq_register_handler(dev->irq, ahci_irq_handler);
+    if (res < 0) {
+        return res;
+    }
+    ahci_port_write(AHCI_PX_IE, AHCI_PX_IS_DHRS | AHCI_PX_IS_SDBS | AHCI_PX_IS_ERRORS);
+    ahci_hba_write(AHCI_IS, 0xFFFFFFFF);
+    ahci_hba_write(AHCI_GHC, ahci_hba_read(AHCI_GHC) | AHCI_GHC_IE);
+    irq_unmask(dev->irq);
+
+    ahci_block_device.queue_depth = ahci_port.slots;
+    // Worst case every page needs a PRDT entry of its own
+    ahci_block_device.max_pages = AHCI_PRDT_ENTRIES;
+    ahci_ready = true;
+    return block_register(&ahci_block_device);
+}
+
+struct block_device* ahci_device()
+{
+    return ahci_ready ? &ahci_block_device : NULL;
+}
+
+void ahci_print_stats()
+{
+    print_serial("AHCI: ");
+    kputdec(ahci_stats.requests);
+    print_serial(" commands, ");
+    kputdec(ahci_stats.writes);
+    print_serial(" writes, ");
+    kputdec(ahci_stats.flushes);
+    print_serial(" flushes, ");
+    kputdec(ahci_stats.sectors);
+    print_serial(" sectors, ");
+    kputdec(ahci_stats.irqs);
+    print_serial(" irqs, ");
+    kputdec(ahci_stats.errors);
+    print_serial(" errors, NCQ ");
+    print_serial(ahci_port.ncq ? "on" : "off");
+    print_serial(", max in flight ");
+    kputdec(ahci_stats.max_inflight);
+    print_serial("\n");
+}
@@ -0,0 +1,148 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ssd/block.h"
+
+#define PCI_SUBCLASS_SATA 0x06
+#define PCI_PROG_IF_AHCI 0x01
+// ABAR, the HBA's memory mapped registers
+#define AHCI_PCI_BAR 5
+
+// Generic host control
+#define AHCI_CAP 0x00
+#define AHCI_GHC 0x04
+#define AHCI_IS 0x08
+#define AHCI_PI 0x0C
+
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_CAP_NCS_SHIFT 8
+#define AHCI_CAP_NCS_MASK 0x1F
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+// Port registers, offsets from AHCI_PORT_BASE + port * AHCI_PORT_SIZE
+#define AHCI_PORT_BASE 0x100
+#define AHCI_PORT_SIZE 0x80
+#define AHCI_MAX_PORTS 32
+#define AHCI_PX_CLB 0x00
+#define AHCI_PX_CLBU 0x04
+#define AHCI_PX_FB 0x08
+#define AHCI_PX_FBU 0x0C
+#define AHCI_PX_IS 0x10
+#define AHCI_PX_IE 0x14
+#define AHCI_PX_CMD 0x18
+#define AHCI_PX_TFD 0x20
+#define AHCI_PX_SIG 0x24
+#define AHCI_PX_SSTS 0x28
+#define AHCI_PX_SERR 0x30
+#define AHCI_PX_SACT 0x34
+#define AHCI_PX_CI 0x38
+
+#define AHCI_PX_CMD_ST (1u << 0)
+#define AHCI_PX_CMD_FRE (1u << 4)
+#define AHCI_PX_CMD_FR (1u << 14)
+#define AHCI_PX_CMD_CR (1u << 15)
+
+#define AHCI_PX_IS_DHRS (1u << 0)
+#define AHCI_PX_IS_PSS (1u << 1)
+#define AHCI_PX_IS_SDBS (1u << 3)
+#define AHCI_PX_IS_IFS (1u << 27)
+#define AHCI_PX_IS_HBDS (1u << 28)
+#define AHCI_PX_IS_HBFS (1u << 29)
+#define AHCI_PX_IS_TFES (1u << 30)
+#define AHCI_PX_IS_ERRORS (AHCI_PX_IS_IFS | AHCI_PX_IS_HBDS | AHCI_PX_IS_HBFS | AHCI_PX_IS_TFES)
+
+#define AHCI_SSTS_DET_PRESENT 3
+#define AHCI_SSTS_IPM_ACTIVE 1
+#define AHCI_SIG_ATA 0x00000101
+
+#define AHCI_TFD_BSY 0x80
+#define AHCI_TFD_DRQ 0x08
+
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_COMMAND 0x80
+
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+// IDENTIFY DEVICE: queue depth minus one, and the NCQ support bit
+#define ATA_ID_QUEUE_DEPTH 75
+#define ATA_ID_SATA_CAPS 76
+#define ATA_ID_SATA_NCQ (1 << 8)
+
+// Register FIS, host to device
+struct fis_reg_h2d {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t command;
+    uint8_t feature_lo;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t feature_hi;
+    uint8_t count_lo;
+    uint8_t count_hi;
+    uint8_t icc;
+    uint8_t control;
+    uint32_t reserved;
+} __attribute__((packed));
+
+// One slot of the command list
+struct ahci_cmd_header {
+    // FIS length in dwords, write, PRDT length in the top half
+    uint16_t flags;
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed));
+
+#define AHCI_CMD_HEADER_WRITE (1 << 6)
+
+// Byte count is stored minus one, regions must be an even size up to 4 MiB
+struct ahci_prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;
+} __attribute__((packed));
+
+#define AHCI_PRD_MAX_BYTES (4 * 1024 * 1024)
+// Sized so a command table fills exactly one page
+#define AHCI_PRDT_ENTRIES ((PAGE_SIZE - 0x80) / sizeof(struct ahci_prd))
+
+struct ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct ahci_prd prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed));
+
+#define AHCI_MAX_SLOTS 32
+// Polls of CI or the port's busy bits before giving up
+#define AHCI_TIMEOUT 1000000
+
+struct ahci_stats {
+    uint32_t requests;
+    uint32_t writes;
+    uint32_t flushes;
+    uint32_t sectors;
+    uint32_t irqs;
+    uint32_t errors;
+    uint32_t max_inflight;
+};
+
+extern struct ahci_stats ahci_stats;
+
+int ahci_init();
+struct block_device* ahci_device();
+void ahci_print_stats();
+
+#endif
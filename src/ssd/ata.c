@@ -0,0 +1,909 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/ata.h"
+#include "io/io.h"
+#include "idt/irq.h"
+#include "shell/shell.h"
+#include "config.h"
+#include "status.h"
+#include "utils.h"
+#include "pci/pci.h"
+#include "memory/page.h"
+#include "ssd/block.h"
+
+struct ata_stats ata_stats;
+struct ata_drive ata_drive;
+
+// The one request the drive is working on. Requests bigger than a single
+// command allows are issued as a chain of maximal commands, the next one
+// going out from the IRQ handler as soon as the previous finishes.
+// A PIO command raises one interrupt per DRQ block, which is a single sector
+// or ata_drive.multiple sectors under READ/WRITE MULTIPLE. A DMA command
+// raises one interrupt once the bus master has moved every region.
+// Data is scattered over up to BLOCK_MAX_SEGMENTS buffers, seg and seg_off
+// point at the next sector to move.
+struct ata_request {
+    volatile bool active;
+    bool allow_dma;
+    bool write;
+    // Mode of the command in flight
+    bool dma;
+    // Next sector to issue
+    uint32_t lba;
+    struct block_segment segs[BLOCK_MAX_SEGMENTS];
+    uint32_t nsegs;
+    uint32_t seg;
+    uint32_t seg_off;
+    // Sectors not yet issued
+    uint32_t left;
+    // Size of the command in flight and how much of it is still to move
+    uint32_t chunk;
+    uint32_t chunk_left;
+    ATA_CALLBACK callback;
+    void* ctx;
+};
+
+static struct ata_request ata_current;
+static bool ata_irq_ready = false;
+
+static int ata_block_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return ata_read(lba, count, buf);
+}
+
+static int ata_block_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return ata_write(lba, count, buf);
+}
+
+static int ata_block_submit(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx)
+{
+    return ata_submit_sg(lba, write, segs, nsegs, callback, ctx);
+}
+
+static int ata_block_flush(struct block_device* dev)
+{
+    return ata_flush();
+}
+
+static void ata_drain();
+
+static void ata_block_poll(struct block_device* dev)
+{
+    uint32_t flags = irq_save();
+    if (ata_current.active) {
+        ata_drain();
+        if (ata_irq_ready) {
+            outb(ATA_PRIMARY_CTRL, 0);
+        }
+    }
+    irq_restore(flags);
+}
+
+static struct block_device ata_block_device = {
+    .name = "ata0",
+    .read = ata_block_read,
+    .write = ata_block_write,
+    .flush = ata_block_flush,
+    .submit = ata_block_submit,
+    .poll = ata_block_poll,
+};
+
+static int ata_mode = ATA_MODE_PIO;
+static uint16_t ata_bm_base = 0;
+static struct ata_prd* ata_prdt = NULL;
+static uintptr_t ata_prdt_phys = 0;
+
+// Reading the alternate status register doesn't ack the interrupt, four of
+// them cover the 400ns the drive needs before its status is valid
+static void ata_delay()
+{
+    for (int i = 0; i < 4; i++) {
+        insb(ATA_PRIMARY_CTRL);
+    }
+}
+
+static int ata_wait_not_busy()
+{
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        if (!(insb(ATA_PRIMARY_IO + ATA_REG_STATUS) & ATA_SR_BSY)) {
+            return RZOS_ALL_OK;
+        }
+    }
+    return -EIO;
+}
+
+static int ata_wait_data()
+{
+    ata_delay();
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = insb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+        if (status & ATA_SR_BSY) {
+            continue;
+        }
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            return -EIO;
+        }
+        if (status & ATA_SR_DRQ) {
+            return RZOS_ALL_OK;
+        }
+    }
+    return -EIO;
+}
+
+static int ata_check_range(uint32_t lba, uint32_t count)
+{
+    if (count == 0) {
+        return -EINVARG;
+    }
+    uint64_t limit = ata_drive.sectors ? ata_drive.sectors : (uint64_t)ATA_MAX_LBA28 + 1;
+    if ((uint64_t)lba + count > limit) {
+        return -EINVARG;
+    }
+    return RZOS_ALL_OK;
+}
+
+static int ata_check_args(uint32_t lba, uint32_t count, void* buf)
+{
+    if (!buf) {
+        return -EINVARG;
+    }
+    return ata_check_range(lba, count);
+}
+
+// Largest command the drive takes, the PRD table limits DMA further
+static uint32_t ata_max_chunk(bool dma)
+{
+    uint32_t max = ata_drive.lba48 ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+    if (dma && max > ATA_DMA_MAX_SECTORS) {
+        max = ATA_DMA_MAX_SECTORS;
+    }
+    return max;
+}
+
+static uint8_t ata_command(bool dma, bool write)
+{
+    if (dma) {
+        if (write) {
+            return ata_drive.lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+        }
+        return ata_drive.lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+    }
+    if (ata_drive.multiple) {
+        if (write) {
+            return ata_drive.lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        }
+        return ata_drive.lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    }
+    if (write) {
+        return ata_drive.lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+    }
+    return ata_drive.lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+}
+
+static int ata_issue(uint32_t lba, uint32_t count, uint8_t command)
+{
+    if (ata_wait_not_busy() < 0) {
+        return -EIO;
+    }
+    if (ata_drive.lba48) {
+        // The 48-bit registers are two-deep FIFOs, high-order bytes go first.
+        // A count of 65536 and LBA bits 32-47 both come out as 0.
+        outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0x40);
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, (uint8_t)(count >> 8));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA_LO, (uint8_t)(lba >> 24));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA_MID, 0);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA_HI, 0);
+    } else {
+        outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
+    }
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, (uint8_t)count);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_LO, (uint8_t)lba);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_MID, (uint8_t)(lba >> 8));
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_HI, (uint8_t)(lba >> 16));
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, command);
+    ata_stats.commands++;
+    return RZOS_ALL_OK;
+}
+
+static int ata_build_prdt(uint32_t bytes);
+
+static void ata_cursor_advance(uint32_t sectors)
+{
+    uint32_t bytes = sectors * RZOS_SECTOR_SIZE;
+    while (bytes) {
+        uint32_t seg_bytes = ata_current.segs[ata_current.seg].count * RZOS_SECTOR_SIZE;
+        uint32_t step = seg_bytes - ata_current.seg_off;
+        if (step > bytes) {
+            step = bytes;
+        }
+        ata_current.seg_off += step;
+        bytes -= step;
+        if (ata_current.seg_off == seg_bytes) {
+            ata_current.seg++;
+            ata_current.seg_off = 0;
+        }
+    }
+}
+
+// Moves one DRQ block through the data port, a sector at a time since a block
+// may span two segments
+static void ata_pio_block()
+{
+    uint32_t block = ata_drive.multiple ? ata_drive.multiple : 1;
+    if (block > ata_current.chunk_left) {
+        block = ata_current.chunk_left;
+    }
+    for (uint32_t i = 0; i < block; i++) {
+        uint8_t* ptr = (uint8_t*)ata_current.segs[ata_current.seg].buf + ata_current.seg_off;
+        if (ata_current.write) {
+            outsw_buffer(ATA_PRIMARY_IO + ATA_REG_DATA, ptr, RZOS_SECTOR_SIZE / 2);
+        } else {
+            insw_buffer(ATA_PRIMARY_IO + ATA_REG_DATA, ptr, RZOS_SECTOR_SIZE / 2);
+        }
+        ata_cursor_advance(1);
+    }
+    ata_stats.sectors += block;
+    ata_current.chunk_left -= block;
+}
+
+static void ata_complete(int status)
+{
+    ATA_CALLBACK callback = ata_current.callback;
+    void* ctx = ata_current.ctx;
+    if (status != RZOS_ALL_OK) {
+        ata_stats.errors++;
+    }
+    ata_current.active = false;
+    if (callback) {
+        callback(status, ctx);
+    }
+}
+
+// Sends the next command of the current request. Runs with interrupts off,
+// either from ata_submit or from the handler once the previous command is done.
+static int ata_start_chunk()
+{
+    uint32_t count = 0;
+    ata_current.dma = false;
+    if (ata_current.allow_dma && ata_mode == ATA_MODE_DMA) {
+        count = ata_current.left;
+        if (count > ata_max_chunk(true)) {
+            count = ata_max_chunk(true);
+        }
+        ata_current.dma = ata_build_prdt(count * RZOS_SECTOR_SIZE) == RZOS_ALL_OK;
+        if (!ata_current.dma) {
+            ata_stats.pio_fallbacks++;
+        }
+    }
+    if (!ata_current.dma) {
+        count = ata_current.left;
+        if (count > ata_max_chunk(false)) {
+            count = ata_max_chunk(false);
+        }
+    }
+
+    int res;
+    uint8_t command = ata_command(ata_current.dma, ata_current.write);
+    if (ata_current.dma) {
+        uint8_t direction = ata_current.write ? 0 : ATA_BM_CMD_READ;
+        outl(ata_bm_base + ATA_BM_PRDT, ata_prdt_phys);
+        outb(ata_bm_base + ATA_BM_COMMAND, direction);
+        // Status bits are write-one-to-clear
+        outb(ata_bm_base + ATA_BM_STATUS, insb(ata_bm_base + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+        res = ata_issue(ata_current.lba, count, command);
+        if (res == RZOS_ALL_OK) {
+            outb(ata_bm_base + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+            ata_stats.dma_requests++;
+        }
+    } else {
+        res = ata_issue(ata_current.lba, count, command);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    ata_current.lba += count;
+    ata_current.left -= count;
+    ata_current.chunk = count;
+    ata_current.chunk_left = count;
+
+    // A PIO write supplies its first block up front, the interrupts that
+    // follow ask for the rest and then report completion
+    if (ata_current.write && !ata_current.dma) {
+        if (ata_wait_data() < 0) {
+            return -EIO;
+        }
+        ata_pio_block();
+    }
+    return RZOS_ALL_OK;
+}
+
+// The command in flight is done, chain the next one or finish the request
+static void ata_chunk_done()
+{
+    if (ata_current.left == 0) {
+        ata_complete(RZOS_ALL_OK);
+        return;
+    }
+    if (ata_start_chunk() < 0) {
+        ata_complete(-EIO);
+    }
+}
+
+// Moves the request in flight on by one interrupt's worth of work, status
+// is the drive status read for it. Runs with interrupts off, from the IRQ
+// handler or from ata_drain.
+static void ata_service(uint8_t status)
+{
+    if (ata_current.active && ata_current.dma) {
+        uint8_t bm_status = insb(ata_bm_base + ATA_BM_STATUS);
+        if (!(bm_status & (ATA_BM_SR_IRQ | ATA_BM_SR_ERR)) && !(status & (ATA_SR_ERR | ATA_SR_DF))) {
+            // Left over from a command ata_drain already finished
+            return;
+        }
+        outb(ata_bm_base + ATA_BM_COMMAND, 0);
+        outb(ata_bm_base + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+        if ((status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & ATA_BM_SR_ERR)) {
+            ata_complete(-EIO);
+        } else {
+            ata_cursor_advance(ata_current.chunk);
+            ata_stats.sectors += ata_current.chunk;
+            ata_chunk_done();
+        }
+    } else if (ata_current.active) {
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            ata_complete(-EIO);
+        } else if (ata_current.write) {
+            if (ata_current.chunk_left == 0) {
+                ata_chunk_done();
+            } else if (status & ATA_SR_DRQ) {
+                ata_pio_block();
+            }
+        } else if (status & ATA_SR_DRQ) {
+            ata_pio_block();
+            if (ata_current.chunk_left == 0) {
+                ata_chunk_done();
+            }
+        }
+    }
+}
+
+static void ata_irq_handler(registers_t* regs)
+{
+    uint64_t start = rdtsc();
+    // Reading the status register also clears the drive's interrupt
+    uint8_t status = insb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    ata_stats.irqs++;
+    ata_service(status);
+    ata_stats.irq_cycles += rdtsc() - start;
+}
+
+// Waits for the bus master to finish the DMA command in flight
+static int ata_wait_dma()
+{
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        if (insb(ata_bm_base + ATA_BM_STATUS) & (ATA_BM_SR_IRQ | ATA_BM_SR_ERR)) {
+            return RZOS_ALL_OK;
+        }
+    }
+    return -EIO;
+}
+
+// Runs the request in flight, and any the block queue chains on from its
+// completion, to the end with interrupts off. Each step polls the drive for
+// what would have raised the next interrupt and services it the same way.
+// The drive's interrupt stays masked so no stale IRQ14 is left for a later
+// request, callers unmask it when they are done with the drive.
+static void ata_drain()
+{
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    while (ata_current.active) {
+        int res;
+        if (ata_current.dma) {
+            res = ata_wait_dma();
+        } else if (ata_current.chunk_left) {
+            res = ata_wait_data();
+        } else {
+            // A PIO write whose last block is out, done once BSY drops
+            ata_delay();
+            res = ata_wait_not_busy();
+        }
+        if (res < 0) {
+            if (ata_current.dma) {
+                outb(ata_bm_base + ATA_BM_COMMAND, 0);
+            }
+            ata_complete(-EIO);
+            continue;
+        }
+        ata_service(insb(ATA_PRIMARY_IO + ATA_REG_STATUS));
+        ata_stats.drained++;
+    }
+}
+
+// Finds the IDE controller on PCI and sets up its bus-master engine. The PRD
+// table gets a page of its own, so it can never straddle a 64 KiB boundary.
+static int ata_dma_init()
+{
+    if (pci_device_count() == 0) {
+        pci_init();
+    }
+    struct pci_device* dev = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    if (!dev || !(dev->bar[4] & PCI_BAR_IO)) {
+        return -ENOFOUND;
+    }
+
+    void* page = alloc_page();
+    if (!page) {
+        return -ENOMEM;
+    }
+    ata_prdt_phys = (uintptr_t)page;
+    ata_prdt = paging_phys_to_virt(ata_prdt_phys);
+    ata_bm_base = dev->bar[4] & 0xFFFC;
+    pci_enable_bus_master(dev);
+    outb(ata_bm_base + ATA_BM_COMMAND, 0);
+    return RZOS_ALL_OK;
+}
+
+// Walks the next bytes of the request page by page, starting at the data
+// cursor, and emits one descriptor per physically contiguous run. Heap
+// buffers are only virtually contiguous, so neighbouring frames are merged
+// when they happen to line up.
+static int ata_build_prdt(uint32_t bytes)
+{
+    uint32_t seg = ata_current.seg;
+    uint32_t off = ata_current.seg_off;
+    uint32_t entries = 0;
+    uint32_t run_len = 0;
+    while (bytes) {
+        struct block_segment* segment = &ata_current.segs[seg];
+        uintptr_t va = (uintptr_t)segment->buf + off;
+        if (va & 1) {
+            return -EINVARG;
+        }
+        uintptr_t pa = virt_to_phys(va);
+        if (pa == (uintptr_t)-1) {
+            return -EINVARG;
+        }
+        uint32_t len = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+        uint32_t seg_left = segment->count * RZOS_SECTOR_SIZE - off;
+        if (len > seg_left) {
+            len = seg_left;
+        }
+        if (len > bytes) {
+            len = bytes;
+        }
+
+        struct ata_prd* last = entries ? &ata_prdt[entries - 1] : NULL;
+        if (last && last->phys + run_len == pa && (last->phys >> 16) == (pa >> 16) &&
+            run_len + len <= 0x10000) {
+            run_len += len;
+        } else {
+            if (entries == ATA_PRD_MAX_ENTRIES) {
+                return -ENOMEM;
+            }
+            last = &ata_prdt[entries++];
+            last->phys = pa;
+            last->flags = 0;
+            run_len = len;
+        }
+        last->bytes = (uint16_t)run_len;
+
+        bytes -= len;
+        off += len;
+        if (off == segment->count * RZOS_SECTOR_SIZE) {
+            seg++;
+            off = 0;
+        }
+    }
+    ata_prdt[entries - 1].flags = ATA_PRD_EOT;
+    return RZOS_ALL_OK;
+}
+
+int ata_set_mode(int mode)
+{
+    if (mode == ATA_MODE_DMA && !ata_bm_base) {
+        return -EUNIMP;
+    }
+    if (mode != ATA_MODE_PIO && mode != ATA_MODE_DMA) {
+        return -EINVARG;
+    }
+    ata_mode = mode;
+    return RZOS_ALL_OK;
+}
+
+int ata_get_mode()
+{
+    return ata_mode;
+}
+
+// IDENTIFY DEVICE, polled with the drive's interrupt off. Fills ata_drive.
+static int ata_identify()
+{
+    static uint16_t id[RZOS_SECTOR_SIZE / 2];
+
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xA0);
+    ata_delay();
+    // Nothing attached reads back as a floating bus
+    if (insb(ATA_PRIMARY_IO + ATA_REG_STATUS) == 0xFF) {
+        return -EIO;
+    }
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_LO, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_MID, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA_HI, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay();
+    if (insb(ATA_PRIMARY_IO + ATA_REG_STATUS) == 0) {
+        return -EIO;
+    }
+    if (ata_wait_not_busy() < 0) {
+        return -EIO;
+    }
+    // ATAPI and SATA bridges put a signature here instead of answering
+    if (insb(ATA_PRIMARY_IO + ATA_REG_LBA_MID) || insb(ATA_PRIMARY_IO + ATA_REG_LBA_HI)) {
+        return -EUNIMP;
+    }
+    if (ata_wait_data() < 0) {
+        return -EIO;
+    }
+    insw_buffer(ATA_PRIMARY_IO + ATA_REG_DATA, id, RZOS_SECTOR_SIZE / 2);
+
+    ata_drive.lba48 = (id[ATA_ID_COMMAND_SETS] & ATA_ID_LBA48_SUPPORTED) != 0;
+    uint32_t lba28 = id[ATA_ID_LBA28_SECTORS] | ((uint32_t)id[ATA_ID_LBA28_SECTORS + 1] << 16);
+    ata_drive.sectors = lba28;
+    if (ata_drive.lba48) {
+        // Block numbers are 32-bit here, anything past 2 TiB is out of reach
+        uint32_t high = id[ATA_ID_LBA48_SECTORS + 2] | id[ATA_ID_LBA48_SECTORS + 3];
+        ata_drive.sectors = high ? 0xFFFFFFFF :
+            id[ATA_ID_LBA48_SECTORS] | ((uint32_t)id[ATA_ID_LBA48_SECTORS + 1] << 16);
+    }
+
+    // One interrupt per block of sectors instead of one per sector
+    ata_drive.multiple = 0;
+    uint32_t max_multiple = id[ATA_ID_MAX_MULTIPLE] & 0xFF;
+    if (max_multiple > 1) {
+        outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xE0);
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT, max_multiple);
+        outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+        ata_delay();
+        if (ata_wait_not_busy() == RZOS_ALL_OK &&
+            !(insb(ATA_PRIMARY_IO + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF))) {
+            ata_drive.multiple = max_multiple;
+        }
+    }
+    return RZOS_ALL_OK;
+}
+
+int ata_init()
+{
+    int res = ata_identify();
+    if (res < 0) {
+        return res;
+    }
+
+    res = irq_register_handler(IRQ_ATA_PRIMARY, ata_irq_handler);
+    if (res < 0) {
+        return res;
+    }
+    outb(ATA_PRIMARY_CTRL, 0);
+    insb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    irq_unmask(IRQ_ATA_PRIMARY);
+    ata_irq_ready = true;
+
+    if (ata_dma_init() == RZOS_ALL_OK) {
+        ata_mode = ATA_MODE_DMA;
+    }
+
+    ata_block_device.sectors = ata_drive.sectors;
+    return block_register(&ata_block_device);
+}
+
+bool ata_idle()
+{
+    return !ata_current.active;
+}
+
+static int ata_submit(uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, ATA_CALLBACK callback, void* ctx, bool allow_dma)
+{
+    if (!segs || nsegs == 0 || nsegs > BLOCK_MAX_SEGMENTS) {
+        return -EINVARG;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        if (!segs[i].buf || segs[i].count == 0) {
+            return -EINVARG;
+        }
+        count += segs[i].count;
+    }
+    int res = ata_check_range(lba, count);
+    if (res < 0) {
+        return res;
+    }
+    if (!ata_irq_ready) {
+        return -EUNIMP;
+    }
+
+    uint32_t flags = irq_save();
+    if (ata_current.active) {
+        irq_restore(flags);
+        return -EISTKN;
+    }
+    for (uint32_t i = 0; i < nsegs; i++) {
+        ata_current.segs[i] = segs[i];
+    }
+    ata_current.nsegs = nsegs;
+    ata_current.seg = 0;
+    ata_current.seg_off = 0;
+    ata_current.allow_dma = allow_dma;
+    ata_current.write = write;
+    ata_current.lba = lba;
+    ata_current.left = count;
+    ata_current.callback = callback;
+    ata_current.ctx = ctx;
+    ata_current.active = true;
+    res = ata_start_chunk();
+    if (res < 0) {
+        ata_current.active = false;
+    } else {
+        ata_stats.requests++;
+        if (write) {
+            ata_stats.writes++;
+        }
+    }
+    irq_restore(flags);
+    return res;
+}
+
+// Starts a read and returns straight away. callback runs from the IRQ handler
+// once the last sector is in buf, or on the first error. Any count is fine,
+// the request is split into the largest commands the drive takes. Uses DMA when the
+// controller supports it and buf can be described by the PRD table.
+int ata_read_async(uint32_t lba, uint32_t count, void* buf, ATA_CALLBACK callback, void* ctx)
+{
+    struct block_segment seg = { .buf = buf, .count = count };
+    return ata_submit(lba, false, &seg, 1, callback, ctx, true);
+}
+
+// Scatter-gather form of the above, read or write. One request covers
+// consecutive sectors spread over several buffers, this is what lets the
+// block queue merge neighbouring requests into one command.
+int ata_submit_sg(uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, ATA_CALLBACK callback, void* ctx)
+{
+    return ata_submit(lba, write, segs, nsegs, callback, ctx, true);
+}
+
+struct ata_wait {
+    volatile bool done;
+    int status;
+};
+
+static void ata_transfer_done(int status, void* ctx)
+{
+    struct ata_wait* wait = ctx;
+    wait->status = status;
+    wait->done = true;
+}
+
+// Sleeps until the drive is free, an async request such as read-ahead may
+// still be running when a blocking read comes in
+static void ata_wait_idle()
+{
+    for (;;) {
+        irq_disable();
+        if (!ata_current.active) {
+            break;
+        }
+        __asm__ volatile("sti; hlt" ::: "memory");
+    }
+    irq_enable();
+}
+
+static int ata_transfer_wait(uint32_t lba, uint32_t count, void* buf, bool write, bool allow_dma)
+{
+    struct ata_wait wait = { .done = false, .status = RZOS_ALL_OK };
+    struct block_segment seg = { .buf = buf, .count = count };
+    int res;
+    while ((res = ata_submit(lba, write, &seg, 1, ata_transfer_done, &wait, allow_dma)) == -EISTKN) {
+        ata_wait_idle();
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    uint64_t start = rdtsc();
+    for (;;) {
+        irq_disable();
+        if (wait.done) {
+            break;
+        }
+        // sti only takes effect after the next instruction, so an interrupt
+        // arriving between the check and the hlt still wakes us
+        __asm__ volatile("sti; hlt" ::: "memory");
+    }
+    irq_enable();
+    ata_stats.wait_cycles += rdtsc() - start;
+    return wait.status;
+}
+
+static int ata_transfer_polled(uint32_t lba, uint32_t count, void* buf, bool write);
+
+static int ata_transfer(uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    int res = ata_check_args(lba, count, buf);
+    if (res < 0) {
+        return res;
+    }
+    if (!ata_irq_ready || !irq_enabled()) {
+        return ata_transfer_polled(lba, count, buf, write);
+    }
+
+    res = ata_transfer_wait(lba, count, buf, write, true);
+    if (res == -EIO && ata_mode == ATA_MODE_DMA) {
+        // A failed DMA transfer gets one more try over PIO
+        ata_stats.pio_fallbacks++;
+        res = ata_transfer_wait(lba, count, buf, write, false);
+    }
+    return res;
+}
+
+// Blocking read. The CPU halts until IRQ14 finishes the request instead of
+// spinning on the status port. Falls back to polling when interrupts can't
+// be used: before ata_init or with interrupts off, e.g. inside a handler.
+int ata_read(uint32_t lba, uint32_t count, void* buf)
+{
+    return ata_transfer(lba, count, buf, false);
+}
+
+// Blocking write, same rules as ata_read. The data may still sit in the
+// drive's write cache when this returns.
+int ata_write(uint32_t lba, uint32_t count, void* buf)
+{
+    return ata_transfer(lba, count, buf, true);
+}
+
+// Programmed I/O with the drive's interrupt disabled, the CPU spins on the
+// status register for every sector. A request already in flight is drained
+// first rather than turned away.
+static int ata_transfer_polled(uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    int res = ata_check_args(lba, count, buf);
+    if (res < 0) {
+        return res;
+    }
+    // Read-ahead may still be running, e.g. when a page fault lands here
+    // with interrupts off. Finish it first so the drive is free.
+    uint32_t flags = irq_save();
+    if (ata_current.active) {
+        ata_drain();
+    }
+    irq_restore(flags);
+
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    uint8_t command;
+    if (write) {
+        command = ata_drive.lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+    } else {
+        command = ata_drive.lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+    }
+    uint8_t* ptr = buf;
+    ata_stats.requests++;
+    if (write) {
+        ata_stats.writes++;
+    }
+    while (res == RZOS_ALL_OK && count) {
+        uint32_t chunk = count > ata_max_chunk(false) ? ata_max_chunk(false) : count;
+        res = ata_issue(lba, chunk, command);
+        for (uint32_t i = 0; res == RZOS_ALL_OK && i < chunk; i++) {
+            res = ata_wait_data();
+            if (res < 0) {
+                break;
+            }
+            if (write) {
+                outsw_buffer(ATA_PRIMARY_IO + ATA_REG_DATA, ptr, RZOS_SECTOR_SIZE / 2);
+            } else {
+                insw_buffer(ATA_PRIMARY_IO + ATA_REG_DATA, ptr, RZOS_SECTOR_SIZE / 2);
+            }
+            ptr += RZOS_SECTOR_SIZE;
+            ata_stats.sectors++;
+        }
+        if (res == RZOS_ALL_OK && write) {
+            // The last sector is only on the drive once BSY drops
+            ata_delay();
+            res = ata_wait_not_busy();
+            if (res == RZOS_ALL_OK && (insb(ATA_PRIMARY_IO + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF))) {
+                res = -EIO;
+            }
+        }
+        lba += chunk;
+        count -= chunk;
+    }
+    if (res < 0) {
+        ata_stats.errors++;
+    }
+    if (ata_irq_ready) {
+        outb(ATA_PRIMARY_CTRL, 0);
+    }
+    return res;
+}
+
+int ata_read_polled(uint32_t lba, uint32_t count, void* buf)
+{
+    return ata_transfer_polled(lba, count, buf, false);
+}
+
+// FLUSH CACHE, the drive answers once everything written so far is on the
+// medium. Waits for the request in flight, or drains it when called with
+// interrupts off, then polls with interrupts off so no new request can slip
+// in before the flush.
+int ata_flush()
+{
+    if (!ata_drive.sectors) {
+        return -ENOFOUND;
+    }
+    uint32_t flags;
+    for (;;) {
+        flags = irq_save();
+        if (!ata_current.active) {
+            break;
+        }
+        if (!(flags & EFLAGS_IF)) {
+            ata_drain();
+            break;
+        }
+        irq_restore(flags);
+        ata_wait_idle();
+    }
+
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    outb(ATA_PRIMARY_IO + ATA_REG_DRIVE, 0xE0);
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ata_drive.lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+    ata_delay();
+    int res = ata_wait_not_busy();
+    if (res == RZOS_ALL_OK && (insb(ATA_PRIMARY_IO + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF))) {
+        res = -EIO;
+    }
+    ata_stats.flushes++;
+    if (res < 0) {
+        ata_stats.errors++;
+    }
+    if (ata_irq_ready) {
+        outb(ATA_PRIMARY_CTRL, 0);
+    }
+    irq_restore(flags);
+    return res;
+}
+
+void ata_print_stats()
+{
+    print_serial("ATA: ");
+    kputdec(ata_stats.requests);
+    print_serial(" requests (");
+    kputdec(ata_stats.writes);
+    print_serial(" writes, ");
+    kputdec(ata_stats.flushes);
+    print_serial(" flushes), ");
+    kputdec(ata_stats.commands);
+    print_serial(" commands, ");
+    kputdec(ata_stats.sectors);
+    print_serial(" sectors (");
+    kputdec(ata_stats.commands ? ata_stats.sectors / ata_stats.commands : 0);
+    print_serial(" per command), ");
+    kputdec(ata_stats.irqs);
+    print_serial(" irqs, ");
+    kputdec(ata_stats.drained);
+    print_serial(" drained, ");
+    kputdec(ata_stats.dma_requests);
+    print_serial(" DMA, ");
+    kputdec(ata_stats.pio_fallbacks);
+    print_serial(" PIO fallbacks, ");
+    kputdec(ata_stats.errors);
+    print_serial(" errors\n");
+    print_serial("ATA drive: ");
+    kputdec(ata_drive.sectors);
+    print_serial(ata_drive.lba48 ? " sectors, LBA48, " : " sectors, LBA28, ");
+    kputdec(ata_drive.multiple);
+    print_serial(" sectors per block\n");
+}
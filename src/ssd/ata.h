@@ -0,0 +1,135 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ssd/block.h"
+
+// Primary channel, master drive
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_PRIMARY_CTRL 0x3F6
+
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_SECCOUNT 2
+#define ATA_REG_LBA_LO 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HI 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+
+// Device control: nIEN keeps the drive from raising INTRQ
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE 0xC6
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH_CACHE 0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+#define ATA_CMD_IDENTIFY 0xEC
+
+// IDENTIFY DEVICE words
+#define ATA_ID_MAX_MULTIPLE 47
+#define ATA_ID_LBA28_SECTORS 60
+#define ATA_ID_COMMAND_SETS 83
+#define ATA_ID_LBA48_SECTORS 100
+#define ATA_ID_LBA48_SUPPORTED (1 << 10)
+
+// A sector count of 0 in the register means the maximum
+#define ATA_MAX_SECTORS_LBA28 256
+#define ATA_MAX_SECTORS_LBA48 65536
+#define ATA_MAX_LBA28 0x0FFFFFFF
+// Status reads before giving up on BSY/DRQ
+#define ATA_TIMEOUT 1000000
+
+// Bus-master IDE registers for the primary channel, offsets from BAR4
+#define ATA_BM_COMMAND 0
+#define ATA_BM_STATUS 2
+#define ATA_BM_PRDT 4
+
+#define ATA_BM_CMD_START 0x01
+// Direction bit, set when the device writes to memory
+#define ATA_BM_CMD_READ 0x08
+#define ATA_BM_SR_ERR 0x02
+#define ATA_BM_SR_IRQ 0x04
+
+// Physical region descriptor. A byte count of 0 means 64 KiB and no region
+// may cross a 64 KiB boundary.
+struct ata_prd {
+    uint32_t phys;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed));
+
+#define ATA_PRD_EOT 0x8000
+#define ATA_PRD_MAX_ENTRIES (PAGE_SIZE / sizeof(struct ata_prd))
+// Worst case is one region per page plus one for an unaligned start
+#define ATA_DMA_MAX_SECTORS ((ATA_PRD_MAX_ENTRIES - 1) * (PAGE_SIZE / RZOS_SECTOR_SIZE))
+
+#define ATA_MODE_PIO 0
+#define ATA_MODE_DMA 1
+
+// Called from the IRQ14 handler with interrupts off, status is RZOS_ALL_OK or -EIO
+typedef void (*ATA_CALLBACK)(int status, void* ctx);
+
+// What IDENTIFY DEVICE told us about the drive
+struct ata_drive {
+    bool lba48;
+    uint32_t sectors;
+    // Sectors per DRQ block for READ MULTIPLE, 0 when it isn't enabled
+    uint32_t multiple;
+};
+
+struct ata_stats {
+    // Host-level transfers, each may be split into several commands
+    uint32_t requests;
+    uint32_t writes;
+    uint32_t flushes;
+    uint32_t commands;
+    uint32_t sectors;
+    uint32_t irqs;
+    // Interrupts' worth of work done by polling with interrupts off instead
+    uint32_t drained;
+    uint32_t errors;
+    uint32_t dma_requests;
+    // DMA mode was selected but the request went out as PIO
+    uint32_t pio_fallbacks;
+    // Time spent inside the IRQ handler
+    uint64_t irq_cycles;
+    // Time ata_read spent halted waiting for completion, handler included
+    uint64_t wait_cycles;
+};
+
+extern struct ata_stats ata_stats;
+extern struct ata_drive ata_drive;
+
+int ata_init();
+int ata_set_mode(int mode);
+int ata_get_mode();
+int ata_read_async(uint32_t lba, uint32_t count, void* buf, ATA_CALLBACK callback, void* ctx);
+int ata_submit_sg(uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, ATA_CALLBACK callback, void* ctx);
+int ata_read(uint32_t lba, uint32_t count, void* buf);
+int ata_write(uint32_t lba, uint32_t count, void* buf);
+int ata_read_polled(uint32_t lba, uint32_t count, void* buf);
+int ata_flush();
+bool ata_idle();
+void ata_print_stats();
+
+#endif
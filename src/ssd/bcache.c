@@ -0,0 +1,661 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/bcache.h"
+#include "idt/irq.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+struct bcache_stats bcache_stats;
+
+static struct bcache_buf* bcache_bufs = NULL;
+static uint32_t bcache_capacity = 0;
+static struct bcache_buf* bcache_hash[BCACHE_HASH_BUCKETS];
+// Unpinned buffers, least recently released at the head
+static struct bcache_buf* bcache_lru_head = NULL;
+static struct bcache_buf* bcache_lru_tail = NULL;
+
+static bool bcache_readahead_enabled = true;
+static struct bcache_stream bcache_streams[RZOS_READAHEAD_STREAMS];
+static uint32_t bcache_stream_clock = 0;
+
+// Read-ahead buffers whose request has finished. The completion handler
+// pushes, task context takes the whole list and publishes the buffers.
+static struct bcache_buf* volatile bcache_ra_done_list = NULL;
+static uint32_t bcache_ra_inflight = 0;
+
+// Dirty buffers of one write-back, sorted by block
+static struct bcache_buf** bcache_flush_list = NULL;
+
+static uint32_t bcache_bucket(struct block_device* dev, uint32_t block)
+{
+    return ((block * 2654435761u) ^ (dev->id * 0x9E3779B1u)) >> (32 - BCACHE_HASH_BITS);
+}
+
+static void bcache_lru_remove(struct bcache_buf* buf)
+{
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    } else {
+        bcache_lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    } else {
+        bcache_lru_tail = buf->lru_prev;
+    }
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+}
+
+static void bcache_lru_push(struct bcache_buf* buf)
+{
+    buf->lru_prev = bcache_lru_tail;
+    buf->lru_next = NULL;
+    if (bcache_lru_tail) {
+        bcache_lru_tail->lru_next = buf;
+    } else {
+        bcache_lru_head = buf;
+    }
+    bcache_lru_tail = buf;
+}
+
+static void bcache_hash_insert(struct bcache_buf* buf)
+{
+    uint32_t bucket = bcache_bucket(buf->dev, buf->block);
+    buf->hash_next = bcache_hash[bucket];
+    bcache_hash[bucket] = buf;
+}
+
+static void bcache_hash_remove(struct bcache_buf* buf)
+{
+    struct bcache_buf** link = &bcache_hash[bcache_bucket(buf->dev, buf->block)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static struct bcache_buf* bcache_lookup(struct block_device* dev, uint32_t block)
+{
+    struct bcache_buf* buf = bcache_hash[bcache_bucket(dev, block)];
+    while (buf) {
+        if (buf->dev == dev && buf->block == block) {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+// Grows the cache until the budget is used up, after that the least
+// recently used clean unpinned buffer is recycled. When every unpinned buffer
+// is dirty, the least recently used one's device is written back first if
+// the caller can wait for that.
+static struct bcache_buf* bcache_get_free(bool may_write)
+{
+    if (bcache_stats.buffers < bcache_capacity) {
+        struct bcache_buf* buf = &bcache_bufs[bcache_stats.buffers];
+        buf->data = kmalloc(RZOS_BCACHE_BLOCK_SIZE);
+        if (buf->data) {
+            bcache_stats.buffers++;
+            return buf;
+        }
+    }
+
+    struct bcache_buf* buf = bcache_lru_head;
+    while (buf && buf->dirty) {
+        buf = buf->lru_next;
+    }
+    if (!buf && bcache_lru_head && may_write) {
+        bcache_writeback(bcache_lru_head->dev);
+        buf = bcache_lru_head;
+        while (buf && buf->dirty) {
+            buf = buf->lru_next;
+        }
+    }
+    if (!buf) {
+        // Every buffer is pinned or dirty
+        return NULL;
+    }
+    bcache_lru_remove(buf);
+    if (buf->valid) {
+        bcache_hash_remove(buf);
+        buf->valid = false;
+        bcache_stats.evictions++;
+        if (buf->readahead) {
+            bcache_stats.ra_wasted++;
+        }
+    }
+    buf->readahead = false;
+    return buf;
+}
+
+// Runs from the block queue's completion, with interrupts off
+static void bcache_ra_complete(int status, void* ctx)
+{
+    struct bcache_buf* buf = ctx;
+    buf->io_status = status;
+    buf->done_next = bcache_ra_done_list;
+    bcache_ra_done_list = buf;
+    buf->pending = false;
+}
+
+// Publishes finished read-ahead buffers and drops their I/O pin
+static void bcache_ra_reap_done()
+{
+    uint32_t flags = irq_save();
+    struct bcache_buf* buf = bcache_ra_done_list;
+    bcache_ra_done_list = NULL;
+    irq_restore(flags);
+
+    while (buf) {
+        struct bcache_buf* next = buf->done_next;
+        bcache_ra_inflight--;
+        if (buf->io_status == RZOS_ALL_OK) {
+            buf->valid = true;
+        } else {
+            bcache_hash_remove(buf);
+            buf->readahead = false;
+            bcache_stats.errors++;
+        }
+        if (--buf->refcount == 0) {
+            bcache_lru_push(buf);
+        }
+        buf = next;
+    }
+}
+
+// Queues blocks [start, end) that aren't cached yet, returns the first block
+// it didn't get to
+static uint32_t bcache_prefetch(struct block_device* dev, uint32_t start, uint32_t end)
+{
+    uint32_t dev_blocks = (dev->sectors + BCACHE_SECTORS_PER_BLOCK - 1) / BCACHE_SECTORS_PER_BLOCK;
+    if (end > dev_blocks) {
+        end = dev_blocks;
+    }
+
+    uint32_t block;
+    for (block = start; block < end; block++) {
+        if (bcache_ra_inflight >= BCACHE_READAHEAD_QUEUE) {
+            break;
+        }
+        if (bcache_lookup(dev, block)) {
+            continue;
+        }
+        struct bcache_buf* buf = bcache_get_free(false);
+        if (!buf) {
+            break;
+        }
+        if (dev->sectors - block * BCACHE_SECTORS_PER_BLOCK < BCACHE_SECTORS_PER_BLOCK) {
+            memset(buf->data, 0, RZOS_BCACHE_BLOCK_SIZE);
+        }
+        buf->dev = dev;
+        buf->block = block;
+        buf->refcount = 1;
+        buf->valid = false;
+        buf->readahead = true;
+        buf->io_status = RZOS_ALL_OK;
+        buf->pending = true;
+        bcache_hash_insert(buf);
+
+        uint32_t lba = block * BCACHE_SECTORS_PER_BLOCK;
+        uint32_t count = dev->sectors - lba;
+        if (count > BCACHE_SECTORS_PER_BLOCK) {
+            count = BCACHE_SECTORS_PER_BLOCK;
+        }
+        blkq_init_request(&buf->req, dev, lba, count, buf->data, false);
+        buf->req.callback = bcache_ra_complete;
+        buf->req.ctx = buf;
+        if (blkq_submit(&buf->req) < 0) {
+            bcache_hash_remove(buf);
+            buf->pending = false;
+            buf->readahead = false;
+            buf->refcount = 0;
+            bcache_lru_push(buf);
+            break;
+        }
+        bcache_ra_inflight++;
+        bcache_stats.ra_issued++;
+    }
+
+    return block;
+}
+
+// Tracks sequential readers. A read starting where a stream's last one ended
+// starts read-ahead with a small window, which doubles up to the cap each time
+// the reader gets within half a window of the prefetched data. A read that
+// fits no stream takes over the least recently used one with the window
+// reset, so random access never prefetches.
+static void bcache_readahead(struct block_device* dev, uint32_t lba, uint32_t count)
+{
+    if (!bcache_readahead_enabled || !dev->submit) {
+        return;
+    }
+
+    bcache_stream_clock++;
+    struct bcache_stream* stream = NULL;
+    struct bcache_stream* victim = &bcache_streams[0];
+    for (int i = 0; i < RZOS_READAHEAD_STREAMS; i++) {
+        struct bcache_stream* s = &bcache_streams[i];
+        if (s->dev == dev && lba == s->next) {
+            stream = s;
+            break;
+        }
+        if (s->last_used < victim->last_used) {
+            victim = s;
+        }
+    }
+    if (!stream) {
+        victim->dev = dev;
+        victim->next = lba + count;
+        victim->ra_end = 0;
+        victim->window = 0;
+        victim->last_used = bcache_stream_clock;
+        return;
+    }
+
+    stream->last_used = bcache_stream_clock;
+    stream->next = lba + count;
+    // The block the next read lands in, it may already be partly consumed
+    uint32_t base = stream->next / BCACHE_SECTORS_PER_BLOCK;
+    if (stream->ra_end < base) {
+        stream->ra_end = base;
+    }
+    if (stream->window == 0) {
+        stream->window = RZOS_READAHEAD_MIN_BLOCKS;
+    } else if (stream->ra_end - base > stream->window / 2) {
+        return;
+    } else if (stream->window < RZOS_READAHEAD_MAX_BLOCKS) {
+        stream->window *= 2;
+    }
+    stream->ra_end = bcache_prefetch(dev, stream->ra_end, base + stream->window);
+}
+
+void bcache_set_readahead(bool enable)
+{
+    bcache_readahead_enabled = enable;
+}
+
+int bcache_init(uint32_t budget_bytes)
+{
+    uint32_t capacity = budget_bytes / RZOS_BCACHE_BLOCK_SIZE;
+    if (capacity == 0) {
+        return -EINVARG;
+    }
+    bcache_bufs = kzalloc(capacity * sizeof(struct bcache_buf));
+    bcache_flush_list = kzalloc(capacity * sizeof(struct bcache_buf*));
+    if (!bcache_bufs || !bcache_flush_list) {
+        kfree(bcache_bufs);
+        kfree(bcache_flush_list);
+        return -ENOMEM;
+    }
+    bcache_capacity = capacity;
+    return RZOS_ALL_OK;
+}
+
+// Returns the block pinned. On a miss the buffer is read from the device
+// when fill is set, otherwise it comes back zeroed for a caller that is about
+// to overwrite all of it.
+static struct bcache_buf* bcache_get(struct block_device* dev, uint32_t block, bool fill)
+{
+    if (!dev || !bcache_capacity) {
+        return NULL;
+    }
+
+    struct bcache_buf* buf;
+    for (;;) {
+        bcache_ra_reap_done();
+        buf = bcache_lookup(dev, block);
+        if (!buf || (buf->valid && !buf->pending)) {
+            break;
+        }
+        // A read-ahead that finished after the reap is on the done list,
+        // neither pending nor valid yet. Go round to publish or drop it.
+        if (buf->pending) {
+            blkq_wait(&buf->req);
+        }
+    }
+    if (buf) {
+        bcache_stats.hits++;
+        if (buf->readahead) {
+            buf->readahead = false;
+            bcache_stats.ra_hits++;
+        }
+        if (buf->refcount++ == 0) {
+            bcache_lru_remove(buf);
+        }
+        return buf;
+    }
+
+    bcache_stats.misses++;
+    uint32_t lba = block * BCACHE_SECTORS_PER_BLOCK;
+    if (lba >= dev->sectors) {
+        return NULL;
+    }
+    buf = bcache_get_free(true);
+    if (!buf) {
+        return NULL;
+    }
+
+    // The last block of a device may be short, the rest reads as zeroes
+    uint32_t count = dev->sectors - lba;
+    if (count > BCACHE_SECTORS_PER_BLOCK) {
+        count = BCACHE_SECTORS_PER_BLOCK;
+    } else {
+        memset(buf->data, 0, RZOS_BCACHE_BLOCK_SIZE);
+    }
+    if (!fill) {
+        memset(buf->data, 0, RZOS_BCACHE_BLOCK_SIZE);
+    } else if (block_read(dev, lba, count, buf->data) < 0) {
+        bcache_stats.errors++;
+        // Unused, so it goes first the next time a buffer is needed
+        buf->lru_next = bcache_lru_head;
+        buf->lru_prev = NULL;
+        if (bcache_lru_head) {
+            bcache_lru_head->lru_prev = buf;
+        } else {
+            bcache_lru_tail = buf;
+        }
+        bcache_lru_head = buf;
+        return NULL;
+    }
+
+    buf->dev = dev;
+    buf->block = block;
+    buf->refcount = 1;
+    buf->valid = true;
+    bcache_hash_insert(buf);
+    return buf;
+}
+
+// Returns the block pinned, reading it from the device on a miss. Every
+// successful bread needs a matching brelse.
+struct bcache_buf* bread(struct block_device* dev, uint32_t block)
+{
+    return bcache_get(dev, block, true);
+}
+
+// Marks a pinned buffer as changed. The data reaches the device on the next
+// write-back: from the flusher, bcache_writeback/bcache_flush, or before the
+// buffer gets reused.
+void bdirty(struct bcache_buf* buf)
+{
+    if (buf->dirty) {
+        bcache_stats.absorbed++;
+        return;
+    }
+    buf->dirty = true;
+    buf->dirtied_at = rdtsc();
+    bcache_stats.dirty_bytes += RZOS_BCACHE_BLOCK_SIZE;
+}
+
+void brelse(struct bcache_buf* buf)
+{
+    if (!buf || buf->refcount == 0) {
+        return;
+    }
+    if (--buf->refcount == 0) {
+        bcache_lru_push(buf);
+    }
+}
+
+// Copies sectors out through the cache and feeds the read-ahead stream
+// detector. Falls back to the device when the cache hasn't been set up yet.
+int bcache_read(struct block_device* dev, uint32_t lba, uint32_t count, void* out)
+{
+    if (!dev) {
+        return -EIO;
+    }
+    if (!bcache_capacity) {
+        return block_read(dev, lba, count, out);
+    }
+
+    uint32_t start = lba;
+    uint32_t total = count;
+    uint8_t* ptr = out;
+    while (count) {
+        uint32_t offset = lba % BCACHE_SECTORS_PER_BLOCK;
+        uint32_t n = BCACHE_SECTORS_PER_BLOCK - offset;
+        if (n > count) {
+            n = count;
+        }
+        struct bcache_buf* buf = bread(dev, lba / BCACHE_SECTORS_PER_BLOCK);
+        if (!buf) {
+            return -EIO;
+        }
+        memcpy(ptr, buf->data + offset * RZOS_SECTOR_SIZE, n * RZOS_SECTOR_SIZE);
+        brelse(buf);
+        ptr += n * RZOS_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    bcache_readahead(dev, start, total);
+    return RZOS_ALL_OK;
+}
+
+// Sectors of block that exist on dev, only the last block can be short
+static uint32_t bcache_block_sectors(struct block_device* dev, uint32_t block)
+{
+    uint32_t count = dev->sectors - block * BCACHE_SECTORS_PER_BLOCK;
+    return count > BCACHE_SECTORS_PER_BLOCK ? BCACHE_SECTORS_PER_BLOCK : count;
+}
+
+// Copies sectors into the cache and marks their blocks dirty, so small writes
+// are absorbed in memory and reach the device later as part of a larger
+// write-back. Blocks that are overwritten whole aren't read first. Going over
+// RZOS_BCACHE_DIRTY_MAX_KB of dirty data writes the device back right away.
+int bcache_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* in)
+{
+    if (!dev) {
+        return -EIO;
+    }
+    if (!dev->write) {
+        return -ERDONLY;
+    }
+    if ((uint64_t)lba + count > dev->sectors) {
+        return -EINVARG;
+    }
+    if (!bcache_capacity) {
+        return block_write(dev, lba, count, (void*)in);
+    }
+
+    bcache_stats.writes++;
+    bcache_stats.write_bytes += count * RZOS_SECTOR_SIZE;
+    const uint8_t* ptr = in;
+    while (count) {
+        uint32_t offset = lba % BCACHE_SECTORS_PER_BLOCK;
+        uint32_t n = BCACHE_SECTORS_PER_BLOCK - offset;
+        if (n > count) {
+            n = count;
+        }
+        uint32_t block = lba / BCACHE_SECTORS_PER_BLOCK;
+        bool whole = offset == 0 && n == bcache_block_sectors(dev, block);
+        struct bcache_buf* buf = bcache_get(dev, block, !whole);
+        if (!buf) {
+            return -EIO;
+        }
+        memcpy(buf->data + offset * RZOS_SECTOR_SIZE, (void*)ptr, n * RZOS_SECTOR_SIZE);
+        bdirty(buf);
+        brelse(buf);
+        ptr += n * RZOS_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+
+    if (bcache_stats.dirty_bytes > RZOS_BCACHE_DIRTY_MAX_KB * 1024) {
+        return bcache_writeback(dev);
+    }
+    return RZOS_ALL_OK;
+}
+
+// Writes every dirty block of dev back in LBA order. The requests collect in
+// a plugged queue first, so each run of neighbouring blocks leaves as one
+// command. Blocks that fail to write stay dirty.
+int bcache_writeback(struct block_device* dev)
+{
+    if (!dev || !bcache_capacity) {
+        return RZOS_ALL_OK;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < bcache_stats.buffers; i++) {
+        struct bcache_buf* buf = &bcache_bufs[i];
+        if (!buf->dirty || buf->dev != dev) {
+            continue;
+        }
+        uint32_t j = n++;
+        while (j > 0 && bcache_flush_list[j - 1]->block > buf->block) {
+            bcache_flush_list[j] = bcache_flush_list[j - 1];
+            j--;
+        }
+        bcache_flush_list[j] = buf;
+    }
+    if (n == 0) {
+        return RZOS_ALL_OK;
+    }
+    bcache_stats.flush_batches++;
+
+    // Without interrupts the queue can't be waited on, blocks go one by one
+    bool queued = dev->submit && irq_enabled();
+    if (queued) {
+        blkq_plug(dev);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        struct bcache_buf* buf = bcache_flush_list[i];
+        uint32_t lba = buf->block * BCACHE_SECTORS_PER_BLOCK;
+        uint32_t count = bcache_block_sectors(dev, buf->block);
+        if (queued) {
+            blkq_init_request(&buf->req, dev, lba, count, buf->data, true);
+            buf->io_status = blkq_submit(&buf->req);
+        } else {
+            buf->io_status = block_write(dev, lba, count, buf->data);
+        }
+    }
+    if (queued) {
+        blkq_unplug(dev);
+    }
+
+    int res = RZOS_ALL_OK;
+    for (uint32_t i = 0; i < n; i++) {
+        struct bcache_buf* buf = bcache_flush_list[i];
+        int status = buf->io_status;
+        if (queued && status == RZOS_ALL_OK) {
+            status = blkq_wait(&buf->req);
+        }
+        if (status < 0) {
+            bcache_stats.write_errors++;
+            res = -EIO;
+            continue;
+        }
+        buf->dirty = false;
+        bcache_stats.dirty_bytes -= RZOS_BCACHE_BLOCK_SIZE;
+        bcache_stats.disk_write_bytes += bcache_block_sectors(dev, buf->block) * RZOS_SECTOR_SIZE;
+    }
+    return res;
+}
+
+// Writes dev's dirty blocks back and then has the device make them durable,
+// for ATA that is FLUSH CACHE
+int bcache_flush(struct block_device* dev)
+{
+    int res = bcache_writeback(dev);
+    int flush_res = block_flush(dev);
+    return res < 0 ? res : flush_res;
+}
+
+// Periodic flusher, called from the idle loop. A device is written back once
+// its oldest dirty block has waited RZOS_BCACHE_WRITEBACK_MS.
+void bcache_writeback_tick()
+{
+    if (!bcache_stats.dirty_bytes) {
+        return;
+    }
+    uint64_t now = rdtsc();
+    uint64_t max_age = (uint64_t)tsc_mhz * 1000 * RZOS_BCACHE_WRITEBACK_MS;
+    for (uint32_t i = 0; i < bcache_stats.buffers; i++) {
+        struct bcache_buf* buf = &bcache_bufs[i];
+        if (buf->dirty && now - buf->dirtied_at >= max_age) {
+            bcache_writeback(buf->dev);
+        }
+    }
+}
+
+// Forgets every clean unpinned block of dev, pinned and dirty ones stay
+void bcache_invalidate(struct block_device* dev)
+{
+    bcache_ra_reap_done();
+    for (int i = 0; i < RZOS_READAHEAD_STREAMS; i++) {
+        if (bcache_streams[i].dev == dev) {
+            bcache_streams[i].dev = NULL;
+        }
+    }
+    for (uint32_t i = 0; i < bcache_stats.buffers; i++) {
+        struct bcache_buf* buf = &bcache_bufs[i];
+        if (buf->valid && buf->dev == dev && buf->refcount == 0 && !buf->dirty) {
+            bcache_hash_remove(buf);
+            buf->valid = false;
+            if (buf->readahead) {
+                buf->readahead = false;
+                bcache_stats.ra_wasted++;
+            }
+        }
+    }
+}
+
+void bcache_print_stats()
+{
+    print_serial("Block cache: ");
+    kputdec(bcache_stats.hits);
+    print_serial(" hits, ");
+    kputdec(bcache_stats.misses);
+    print_serial(" misses, ");
+    kputdec(bcache_stats.evictions);
+    print_serial(" evictions, ");
+    kputdec(bcache_stats.buffers);
+    print_serial("/");
+    kputdec(bcache_capacity);
+    print_serial(" buffers\n");
+    print_serial("Read-ahead: ");
+    kputdec(bcache_stats.ra_issued);
+    print_serial(" blocks issued, ");
+    kputdec(bcache_stats.ra_hits);
+    print_serial(" hits, ");
+    kputdec(bcache_stats.ra_wasted);
+    print_serial(" wasted\n");
+    print_serial("Write-back: ");
+    kputdec(bcache_stats.writes);
+    print_serial(" writes, ");
+    kputdec(bcache_stats.absorbed);
+    print_serial(" absorbed, ");
+    kputdec(bcache_stats.flush_batches);
+    print_serial(" flush batches, ");
+    kputdec(bcache_stats.write_errors);
+    print_serial(" errors, ");
+    kputdec(bcache_stats.dirty_bytes / 1024);
+    print_serial(" KiB dirty\n");
+    if (bcache_stats.write_bytes) {
+        // Bytes sent to the device per byte written, in hundredths
+        uint64_t disk = bcache_stats.disk_write_bytes;
+        uint64_t written = bcache_stats.write_bytes;
+        while (written >> 32) {
+            disk >>= 1;
+            written >>= 1;
+        }
+        uint32_t amp = udiv64(disk * 100, written);
+        print_serial("Write amplification: ");
+        kputdec(amp / 100);
+        print_serial(".");
+        if (amp % 100 < 10) {
+            print_serial("0");
+        }
+        kputdec(amp % 100);
+        print_serial("x\n");
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ssd/block.h"
+#include "ssd/blkq.h"
+
+#define BCACHE_SECTORS_PER_BLOCK (RZOS_BCACHE_BLOCK_SIZE / RZOS_SECTOR_SIZE)
+// Buckets are picked by the top bits of a multiplicative hash
+#define BCACHE_HASH_BITS 6
+#define BCACHE_HASH_BUCKETS (1 << BCACHE_HASH_BITS)
+
+// Read-ahead blocks allowed in flight at once
+#define BCACHE_READAHEAD_QUEUE 64
+
+// One cached block. Buffers with refcount 0 sit on the LRU list and may be
+// reused, a pinned buffer keeps its data and identity until brelse.
+// A read-ahead buffer is pinned by its I/O while pending is set. A dirty
+// buffer holds data the device doesn't have yet and is written back before
+// it can be reused.
+struct bcache_buf {
+    struct block_device* dev;
+    uint32_t block;
+    uint32_t refcount;
+    bool valid;
+    volatile bool pending;
+    int io_status;
+    // Filled by read-ahead and not looked at yet
+    bool readahead;
+    bool dirty;
+    // TSC when it went from clean to dirty
+    uint64_t dirtied_at;
+    // Read-ahead I/O, and the link on the completed list once it's done
+    struct block_request req;
+    struct bcache_buf* done_next;
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;
+    struct bcache_buf* lru_next;
+    uint8_t* data;
+};
+
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t errors;
+    uint32_t buffers;
+    // Blocks prefetched, prefetched blocks later read, and ones evicted unread
+    uint32_t ra_issued;
+    uint32_t ra_hits;
+    uint32_t ra_wasted;
+    // Write-back. Bytes handed to bcache_write and bytes sent to devices,
+    // their ratio is the write amplification.
+    uint32_t dirty_bytes;
+    uint32_t writes;
+    // Writes that landed on a block that was already dirty
+    uint32_t absorbed;
+    uint64_t write_bytes;
+    uint64_t disk_write_bytes;
+    uint32_t flush_batches;
+    uint32_t write_errors;
+};
+
+// A sequential reader. next is the sector its next read should start at,
+// blocks before ra_end are cached or on their way.
+struct bcache_stream {
+    struct block_device* dev;
+    uint32_t next;
+    uint32_t ra_end;
+    uint32_t window;
+    uint32_t last_used;
+};
+
+extern struct bcache_stats bcache_stats;
+
+int bcache_init(uint32_t budget_bytes);
+struct bcache_buf* bread(struct block_device* dev, uint32_t block);
+void brelse(struct bcache_buf* buf);
+void bdirty(struct bcache_buf* buf);
+int bcache_read(struct block_device* dev, uint32_t lba, uint32_t count, void* out);
+int bcache_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* in);
+int bcache_writeback(struct block_device* dev);
+int bcache_flush(struct block_device* dev);
+void bcache_writeback_tick();
+void bcache_invalidate(struct block_device* dev);
+void bcache_set_readahead(bool enable);
+void bcache_print_stats();
+
+#endif
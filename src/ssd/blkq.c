@@ -0,0 +1,366 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/blkq.h"
+#include "idt/irq.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+struct blkq_stats blkq_stats;
+
+// Requests carried by one command, in LBA order. reqs is NULL while the
+// slot is free.
+struct blkq_batch {
+    struct block_device* dev;
+    struct block_request* reqs;
+};
+
+// Per-device queue. Pending requests are kept unsorted, the elevator picks
+// from them at dispatch time. Up to the device's queue_depth commands are in
+// flight, one batch slot each.
+struct blkq {
+    struct block_request* pending;
+    struct blkq_batch batches[BLKQ_MAX_INFLIGHT];
+    uint32_t inflight;
+    // Requests pending plus in flight
+    uint32_t depth;
+    // Sector after the last dispatched command, where the C-LOOK sweep is
+    uint32_t head;
+    // While set, requests collect in pending so they can be merged
+    bool plugged;
+    struct block_segment segs[BLOCK_MAX_SEGMENTS];
+};
+
+static struct blkq blkq_queues[BLOCK_MAX_DEVICES];
+
+void blkq_init_request(struct block_request* req, struct block_device* dev, uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    req->dev = dev;
+    req->lba = lba;
+    req->count = count;
+    req->buf = buf;
+    req->write = write;
+    req->done = false;
+    req->status = RZOS_ALL_OK;
+    req->callback = NULL;
+    req->ctx = NULL;
+    req->next = NULL;
+}
+
+// The owner may reuse req as soon as done is set, so nothing touches it after
+static void blkq_finish(struct block_request* req, int status)
+{
+    BLOCK_CALLBACK callback = req->callback;
+    void* ctx = req->ctx;
+    req->status = status;
+    req->done = true;
+    if (callback) {
+        callback(status, ctx);
+    }
+}
+
+static void blkq_finish_batch(struct blkq* q, struct block_request* req, int status)
+{
+    while (req) {
+        struct block_request* next = req->next;
+        q->depth--;
+        blkq_finish(req, status);
+        req = next;
+    }
+}
+
+static void blkq_dispatch(struct block_device* dev);
+
+static void blkq_complete(int status, void* ctx)
+{
+    struct blkq_batch* batch = ctx;
+    struct block_device* dev = batch->dev;
+    struct blkq* q = &blkq_queues[dev->id];
+    struct block_request* reqs = batch->reqs;
+    batch->reqs = NULL;
+    q->inflight--;
+    blkq_finish_batch(q, reqs, status);
+    blkq_dispatch(dev);
+}
+
+static uint32_t blkq_max_inflight(struct block_device* dev)
+{
+    if (dev->queue_depth == 0) {
+        return 1;
+    }
+    if (dev->queue_depth > BLKQ_MAX_INFLIGHT) {
+        return BLKQ_MAX_INFLIGHT;
+    }
+    return dev->queue_depth;
+}
+
+// Sends one command. C-LOOK: take the lowest pending LBA at or past the
+// head, or wrap around to the lowest overall. Pending requests that continue
+// it on either side in the same direction are then folded into the same
+// command, as far as the device's page limit allows. Returns -EISTKN when
+// the device turned it down for now.
+static int blkq_dispatch_one(struct block_device* dev, struct blkq* q)
+{
+    struct block_request** pick = NULL;
+    struct block_request** lowest = NULL;
+    for (struct block_request** link = &q->pending; *link; link = &(*link)->next) {
+        struct block_request* req = *link;
+        if (!lowest || req->lba < (*lowest)->lba) {
+            lowest = link;
+        }
+        if (req->lba >= q->head && (!pick || req->lba < (*pick)->lba)) {
+            pick = link;
+        }
+    }
+    if (!pick) {
+        pick = lowest;
+    }
+    struct block_request* first = *pick;
+    *pick = first->next;
+    first->next = NULL;
+
+    struct block_request* batch = first;
+    struct block_request* tail = first;
+    uint32_t start = first->lba;
+    uint32_t end = first->lba + first->count;
+    uint32_t nsegs = 1;
+    uint32_t pages = block_pages(first->buf, first->count);
+    bool merged = true;
+    while (merged && nsegs < BLOCK_MAX_SEGMENTS) {
+        merged = false;
+        for (struct block_request** link = &q->pending; *link; link = &(*link)->next) {
+            struct block_request* req = *link;
+            if (req->write != first->write || end - start + req->count > BLKQ_MERGE_MAX_SECTORS) {
+                continue;
+            }
+            uint32_t req_pages = block_pages(req->buf, req->count);
+            if (dev->max_pages && pages + req_pages > dev->max_pages) {
+                continue;
+            }
+            if (req->lba == end) {
+                *link = req->next;
+                req->next = NULL;
+                tail->next = req;
+                tail = req;
+                end += req->count;
+            } else if (req->lba + req->count == start) {
+                *link = req->next;
+                req->next = batch;
+                batch = req;
+                start = req->lba;
+            } else {
+                continue;
+            }
+            nsegs++;
+            pages += req_pages;
+            merged = true;
+            break;
+        }
+    }
+
+    uint32_t i = 0;
+    for (struct block_request* req = batch; req; req = req->next) {
+        q->segs[i].buf = req->buf;
+        q->segs[i].count = req->count;
+        i++;
+    }
+
+    struct blkq_batch* slot = &q->batches[0];
+    while (slot->reqs) {
+        slot++;
+    }
+    slot->dev = dev;
+    slot->reqs = batch;
+    q->inflight++;
+    int res = dev->submit(dev, start, first->write, q->segs, nsegs, blkq_complete, slot);
+    if (res == RZOS_ALL_OK) {
+        q->head = end;
+        blkq_stats.dispatched++;
+        blkq_stats.merged += nsegs - 1;
+        if (q->inflight > blkq_stats.max_inflight) {
+            blkq_stats.max_inflight = q->inflight;
+        }
+        return RZOS_ALL_OK;
+    }
+
+    slot->reqs = NULL;
+    q->inflight--;
+    if (res == -EISTKN) {
+        // The device is full, try again on the next kick
+        tail->next = q->pending;
+        q->pending = batch;
+        return res;
+    }
+    blkq_finish_batch(q, batch, res);
+    return RZOS_ALL_OK;
+}
+
+// Sends commands while the device has room for them. Runs with interrupts off.
+// A plugged queue holds back until it fills up.
+static void blkq_dispatch(struct block_device* dev)
+{
+    struct blkq* q = &blkq_queues[dev->id];
+    if (q->plugged && q->depth < RZOS_BLOCK_QUEUE_DEPTH) {
+        return;
+    }
+    while (q->pending && q->inflight < blkq_max_inflight(dev)) {
+        if (blkq_dispatch_one(dev, q) < 0) {
+            return;
+        }
+    }
+}
+
+// Queues req and returns without waiting for the data. Sleeps for a free
+// slot when the queue is full, or returns -EISTKN if called with interrupts
+// off. Devices without a submit hook complete the request before returning.
+// req has to fit in one command, see block_fit.
+int blkq_submit(struct block_request* req)
+{
+    struct block_device* dev = req->dev;
+    if (!dev || !req->buf || req->count == 0) {
+        return -EINVARG;
+    }
+    if ((uint64_t)req->lba + req->count > dev->sectors) {
+        return -EINVARG;
+    }
+    if (req->write && !dev->write) {
+        return -ERDONLY;
+    }
+    if (dev->submit && block_fit(dev, req->buf, req->count) < req->count) {
+        return -EINVARG;
+    }
+    req->done = false;
+    req->status = RZOS_ALL_OK;
+    req->next = NULL;
+
+    if (!dev->submit) {
+        blkq_stats.submitted++;
+        if (req->write) {
+            blkq_finish(req, dev->write(dev, req->lba, req->count, req->buf));
+        } else {
+            blkq_finish(req, dev->read(dev, req->lba, req->count, req->buf));
+        }
+        return RZOS_ALL_OK;
+    }
+
+    struct blkq* q = &blkq_queues[dev->id];
+    uint32_t flags = irq_save();
+    if (q->depth >= RZOS_BLOCK_QUEUE_DEPTH) {
+        if (!(flags & EFLAGS_IF)) {
+            irq_restore(flags);
+            return -EISTKN;
+        }
+        blkq_stats.full_waits++;
+        while (q->depth >= RZOS_BLOCK_QUEUE_DEPTH) {
+            blkq_dispatch(dev);
+            __asm__ volatile("sti; hlt" ::: "memory");
+            irq_disable();
+        }
+    }
+
+    blkq_stats.submitted++;
+    req->next = q->pending;
+    q->pending = req;
+    q->depth++;
+    if (q->depth > blkq_stats.max_depth) {
+        blkq_stats.max_depth = q->depth;
+    }
+    blkq_dispatch(dev);
+    irq_restore(flags);
+    return RZOS_ALL_OK;
+}
+
+// Sleeps until req is done and returns its status. Called with interrupts
+// off, e.g. from a page fault, it polls the device instead and leaves them
+// off throughout.
+int blkq_wait(struct block_request* req)
+{
+    uint32_t flags = irq_save();
+    struct block_device* dev = req->dev;
+    while (!req->done) {
+        blkq_dispatch(dev);
+        if (!(flags & EFLAGS_IF) && dev->poll) {
+            dev->poll(dev);
+            continue;
+        }
+        // sti only takes effect after the next instruction, so a completion
+        // arriving between the check and the hlt still wakes us
+        __asm__ volatile("sti; hlt" ::: "memory");
+        irq_disable();
+    }
+    irq_restore(flags);
+    return req->status;
+}
+
+// Blocking transfer through the queue. With interrupts off, or for devices
+// that can't queue, it goes straight to the device's own read/write.
+static int blkq_transfer_one(struct block_device* dev, uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    if (!dev->submit || !irq_enabled()) {
+        if (write) {
+            return dev->write ? dev->write(dev, lba, count, buf) : -ERDONLY;
+        }
+        return dev->read(dev, lba, count, buf);
+    }
+
+    struct block_request req;
+    blkq_init_request(&req, dev, lba, count, buf, write);
+    int res = blkq_submit(&req);
+    if (res < 0) {
+        return res;
+    }
+    return blkq_wait(&req);
+}
+
+// Splits the transfer into pieces that fit one command each
+int blkq_transfer(struct block_device* dev, uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    uint8_t* ptr = buf;
+    do {
+        uint32_t n = block_fit(dev, ptr, count);
+        if (n == 0) {
+            return -EINVARG;
+        }
+        int res = blkq_transfer_one(dev, lba, n, ptr, write);
+        if (res < 0) {
+            return res;
+        }
+        lba += n;
+        count -= n;
+        ptr += n * RZOS_SECTOR_SIZE;
+    } while (count);
+    return RZOS_ALL_OK;
+}
+
+// Holds dispatch back while a batch of requests is submitted, so neighbours
+// end up in one command instead of the first going out alone
+void blkq_plug(struct block_device* dev)
+{
+    blkq_queues[dev->id].plugged = true;
+}
+
+void blkq_unplug(struct block_device* dev)
+{
+    uint32_t flags = irq_save();
+    blkq_queues[dev->id].plugged = false;
+    blkq_dispatch(dev);
+    irq_restore(flags);
+}
+
+void blkq_print_stats()
+{
+    print_serial("Block queue: ");
+    kputdec(blkq_stats.submitted);
+    print_serial(" requests, ");
+    kputdec(blkq_stats.dispatched);
+    print_serial(" commands, ");
+    kputdec(blkq_stats.merged);
+    print_serial(" merged, max depth ");
+    kputdec(blkq_stats.max_depth);
+    print_serial(", max in flight ");
+    kputdec(blkq_stats.max_inflight);
+    print_serial(", ");
+    kputdec(blkq_stats.full_waits);
+    print_serial(" waits for a slot\n");
+}
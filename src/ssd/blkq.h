@@ -0,0 +1,53 @@
+#ifndef BLKQ_H
+#define BLKQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ssd/block.h"
+
+// Largest command the queue builds by merging neighbouring requests
+#define BLKQ_MERGE_MAX_SECTORS 1024
+// Commands the queue keeps in flight per device, capped by its queue_depth
+#define BLKQ_MAX_INFLIGHT 32
+
+// One read or write of count sectors. The caller owns the memory and must
+// keep it alive until done is set. callback, if any, runs in interrupt
+// context once the data has moved.
+struct block_request {
+    struct block_device* dev;
+    uint32_t lba;
+    uint32_t count;
+    void* buf;
+    bool write;
+    volatile bool done;
+    int status;
+    BLOCK_CALLBACK callback;
+    void* ctx;
+    // Pending list, then the batch it was dispatched in
+    struct block_request* next;
+};
+
+struct blkq_stats {
+    uint32_t submitted;
+    // Commands sent to devices, each carries one or more requests
+    uint32_t dispatched;
+    // Requests that rode along in another request's command
+    uint32_t merged;
+    uint32_t max_depth;
+    uint32_t max_inflight;
+    // Submissions that had to wait for a free slot
+    uint32_t full_waits;
+};
+
+extern struct blkq_stats blkq_stats;
+
+void blkq_init_request(struct block_request* req, struct block_device* dev, uint32_t lba, uint32_t count, void* buf, bool write);
+int blkq_submit(struct block_request* req);
+int blkq_wait(struct block_request* req);
+int blkq_transfer(struct block_device* dev, uint32_t lba, uint32_t count, void* buf, bool write);
+void blkq_plug(struct block_device* dev);
+void blkq_unplug(struct block_device* dev);
+void blkq_print_stats();
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "ssd/block.h"
+#include "ssd/blkq.h"
+#include "config.h"
+#include "status.h"
+
+static struct block_device* block_devices[BLOCK_MAX_DEVICES];
+static uint32_t block_total = 0;
+
+int block_register(struct block_device* dev)
+{
+    if (!dev || !dev->read) {
+        return -EINVARG;
+    }
+    if (block_total >= BLOCK_MAX_DEVICES) {
+        return -ENOMEM;
+    }
+    dev->id = block_total;
+    block_devices[block_total++] = dev;
+    return RZOS_ALL_OK;
+}
+
+struct block_device* block_get(uint32_t id)
+{
+    if (id >= block_total) {
+        return NULL;
+    }
+    return block_devices[id];
+}
+
+int block_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    if (!dev) {
+        return -EINVARG;
+    }
+    if ((uint64_t)lba + count > dev->sectors) {
+        return -EINVARG;
+    }
+    return blkq_transfer(dev, lba, count, buf, false);
+}
+
+int block_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    if (!dev) {
+        return -EINVARG;
+    }
+    if (!dev->write) {
+        return -ERDONLY;
+    }
+    if ((uint64_t)lba + count > dev->sectors) {
+        return -EINVARG;
+    }
+    return blkq_transfer(dev, lba, count, buf, true);
+}
+
+int block_flush(struct block_device* dev)
+{
+    if (!dev) {
+        return -EINVARG;
+    }
+    if (!dev->flush) {
+        return RZOS_ALL_OK;
+    }
+    return dev->flush(dev);
+}
+
+// Pages that count sectors at buf touch
+uint32_t block_pages(void* buf, uint32_t count)
+{
+    uintptr_t start = (uintptr_t)buf;
+    uintptr_t end = start + count * RZOS_SECTOR_SIZE;
+    return ((end + PAGE_SIZE - 1) / PAGE_SIZE) - start / PAGE_SIZE;
+}
+
+// How many of the count sectors at buf one command to dev can take
+uint32_t block_fit(struct block_device* dev, void* buf, uint32_t count)
+{
+    if (!dev->max_pages) {
+        return count;
+    }
+    uint32_t bytes = dev->max_pages * PAGE_SIZE - ((uintptr_t)buf & (PAGE_SIZE - 1));
+    uint32_t max = bytes / RZOS_SECTOR_SIZE;
+    return count < max ? count : max;
+}
@@ -0,0 +1,62 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Anything that reads in 512-byte sectors: the ATA disk, later others.
+// Devices are numbered in the order they register, the boot disk is 0.
+#define BLOCK_MAX_DEVICES 8
+// Buffers one command can scatter to or gather from
+#define BLOCK_MAX_SEGMENTS 32
+
+struct block_device;
+
+// count sectors at buf, consecutive segments cover consecutive sectors
+struct block_segment {
+    void* buf;
+    uint32_t count;
+};
+
+typedef int (*BLOCK_READ)(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+typedef int (*BLOCK_WRITE)(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+// Completion runs in interrupt context
+typedef void (*BLOCK_CALLBACK)(int status, void* ctx);
+// Makes writes that have completed durable, e.g. out of a drive's write cache
+typedef int (*BLOCK_FLUSH)(struct block_device* dev);
+// Starts one command over the segments and returns, -EISTKN while the device
+// can't take another. The segment array is copied.
+typedef int (*BLOCK_SUBMIT)(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx);
+// Runs the completions of finished commands without waiting for their
+// interrupts. Called with interrupts off by waiters that can't sleep.
+typedef void (*BLOCK_POLL)(struct block_device* dev);
+
+struct block_device {
+    const char* name;
+    uint32_t id;
+    uint32_t sectors;
+    BLOCK_READ read;
+    BLOCK_WRITE write;
+    // Optional, devices without a volatile cache leave it out
+    BLOCK_FLUSH flush;
+    // Optional, devices without it get no read-ahead or queueing
+    BLOCK_SUBMIT submit;
+    // Needed along with submit
+    BLOCK_POLL poll;
+    // Commands submit accepts before returning -EISTKN, 0 means one
+    uint32_t queue_depth;
+    // Buffer pages one command can cover, 0 means no limit. Each page may
+    // need a DMA descriptor of its own, heap buffers aren't contiguous.
+    uint32_t max_pages;
+    void* private;
+};
+
+int block_register(struct block_device* dev);
+struct block_device* block_get(uint32_t id);
+int block_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+int block_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+int block_flush(struct block_device* dev);
+uint32_t block_pages(void* buf, uint32_t count);
+uint32_t block_fit(struct block_device* dev, void* buf, uint32_t count);
+
+#endif
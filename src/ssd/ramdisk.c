@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/ramdisk.h"
+#include "memory/memory.h"
+#include "shell/shell.h"
+#include "status.h"
+#include "utils.h"
+
+struct ramdisk_stats ramdisk_stats;
+
+static uint8_t* ramdisk_data = NULL;
+
+static int ramdisk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    memcpy(buf, ramdisk_data + lba * RZOS_SECTOR_SIZE, count * RZOS_SECTOR_SIZE);
+    return RZOS_ALL_OK;
+}
+
+static struct block_device ramdisk_block_device = {
+    .name = "ram0",
+    .read = ramdisk_read,
+};
+
+// Reads the header sector at lba and returns the archive size
+static int ramdisk_initrd_size(struct block_device* boot, uint32_t lba, uint32_t* out)
+{
+    char* header = kzalloc(RZOS_SECTOR_SIZE);
+    if (!header) {
+        return -ENOMEM;
+    }
+    int res = block_read(boot, lba, 1, header);
+    const char* magic = RAMDISK_INITRD_MAGIC;
+    uint32_t i = 0;
+    for (; res == RZOS_ALL_OK && magic[i]; i++) {
+        if (header[i] != magic[i]) {
+            res = -EINFORMAT;
+        }
+    }
+    uint32_t size = 0;
+    for (; res == RZOS_ALL_OK && header[i] >= '0' && header[i] <= '9'; i++) {
+        size = size * 10 + (header[i] - '0');
+        if (size > RZOS_INITRD_MAX_SECTORS * RZOS_SECTOR_SIZE) {
+            res = -EINFORMAT;
+        }
+    }
+    if (res == RZOS_ALL_OK && size == 0) {
+        res = -EINFORMAT;
+    }
+    kfree(header);
+    *out = size;
+    return res;
+}
+
+// Pulls the initrd whose header sector is at lba into memory with one
+// block_read, the disk driver splits it into the largest commands it can,
+// and registers it as ram0. The loader reports lba in boot_info.
+int ramdisk_load_initrd(struct block_device* boot, uint32_t lba)
+{
+    if (!boot || !lba || ramdisk_data) {
+        return -EINVARG;
+    }
+    uint32_t size;
+    int res = ramdisk_initrd_size(boot, lba, &size);
+    if (res < 0) {
+        return res;
+    }
+    uint32_t sectors = (size + RZOS_SECTOR_SIZE - 1) / RZOS_SECTOR_SIZE;
+    uint8_t* data = kmalloc(sectors * RZOS_SECTOR_SIZE);
+    if (!data) {
+        return -ENOMEM;
+    }
+
+    uint64_t t0 = rdtsc();
+    res = block_read(boot, lba + 1, sectors, data);
+    ramdisk_stats.load_cycles = rdtsc() - t0;
+    if (res < 0) {
+        kfree(data);
+        return res;
+    }
+
+    ramdisk_data = data;
+    ramdisk_stats.bytes = size;
+    ramdisk_block_device.sectors = sectors;
+    ramdisk_block_device.private = data;
+    res = block_register(&ramdisk_block_device);
+    if (res < 0) {
+        ramdisk_data = NULL;
+        kfree(data);
+    }
+    return res;
+}
+
+struct block_device* ramdisk_device()
+{
+    return ramdisk_data ? &ramdisk_block_device : NULL;
+}
+
+// The bytes behind a ramdisk, NULL for any other device. Filesystems on it
+// read straight from here instead of going through sectors.
+void* ramdisk_memory(struct block_device* dev)
+{
+    return dev && dev->read == ramdisk_read ? dev->private : NULL;
+}
+
+uint32_t ramdisk_size(struct block_device* dev)
+{
+    return ramdisk_memory(dev) ? ramdisk_stats.bytes : 0;
+}
+
+void ramdisk_print_stats()
+{
+    print_serial("initrd: ");
+    kputdec(ramdisk_stats.bytes / 1024);
+    print_serial(" KiB loaded in ");
+    kputdec((uint32_t)tsc_cycles_to_us(ramdisk_stats.load_cycles));
+    print_serial(" us\n");
+}
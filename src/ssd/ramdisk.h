@@ -0,0 +1,28 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include "config.h"
+#include "ssd/block.h"
+
+// The initrd, read off the boot disk once and served from memory as a
+// read-only block device. On disk it is a header sector followed by the
+// archive: the header starts with RAMDISK_INITRD_MAGIC and the archive size
+// in decimal.
+#define RAMDISK_INITRD_MAGIC "RZINITRD "
+
+struct ramdisk_stats {
+    uint32_t bytes;
+    // Time taken to read it off the boot disk
+    uint64_t load_cycles;
+};
+
+extern struct ramdisk_stats ramdisk_stats;
+
+int ramdisk_load_initrd(struct block_device* boot, uint32_t lba);
+struct block_device* ramdisk_device();
+void* ramdisk_memory(struct block_device* dev);
+uint32_t ramdisk_size(struct block_device* dev);
+void ramdisk_print_stats();
+
+#endif
@@ -2,4 +2,6 @@
 #define SSD_H
 
 int read_sector(int lba,int total,void *buf);
+int write_sector(int lba,int total,void *buf);
+int flush_sectors();
 #endif
\ No newline at end of file
@@ -0,0 +1,460 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ssd/virtio_blk.h"
+#include "io/io.h"
+#include "idt/irq.h"
+#include "shell/shell.h"
+#include "config.h"
+#include "status.h"
+#include "pci/pci.h"
+#include "memory/memory.h"
+#include "memory/page.h"
+#include "memory/frame.h"
+#include "ssd/block.h"
+
+struct virtio_blk_stats virtio_blk_stats;
+
+// Header and status byte of one request. They live in a page of their own so
+// the device can reach them by physical address.
+struct virtio_blk_cmd {
+    struct virtio_blk_req_hdr hdr;
+    uint8_t status;
+    uint8_t pad[15];
+};
+
+struct virtio_blk_slot {
+    bool busy;
+    BLOCK_CALLBACK callback;
+    void* ctx;
+};
+
+// The one request queue. Descriptors past the slot heads form a free list
+// linked through next.
+struct virtio_blk_queue {
+    uint16_t size;
+    struct virtq_desc* desc;
+    struct virtq_avail* avail;
+    volatile struct virtq_used* used;
+    uint16_t free_head;
+    uint16_t free_count;
+    uint16_t last_used;
+    uint16_t slots;
+    uint16_t inflight;
+};
+
+static struct virtio_blk_queue virtio_blk_queue;
+static struct virtio_blk_slot virtio_blk_slots[VIRTIO_BLK_MAX_INFLIGHT];
+static struct virtio_blk_cmd* virtio_blk_cmds = NULL;
+static uintptr_t virtio_blk_cmds_phys = 0;
+static uint16_t virtio_blk_io = 0;
+
+static int virtio_blk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+static int virtio_blk_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf);
+static int virtio_blk_submit(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx);
+static void virtio_blk_poll(struct block_device* dev);
+
+static struct block_device virtio_blk_block_device = {
+    .name = "vda",
+    .read = virtio_blk_read,
+    .write = virtio_blk_write,
+    .submit = virtio_blk_submit,
+    .poll = virtio_blk_poll,
+};
+static bool virtio_blk_ready = false;
+
+static uint16_t virtio_blk_alloc_desc()
+{
+    struct virtio_blk_queue* q = &virtio_blk_queue;
+    uint16_t d = q->free_head;
+    q->free_head = q->desc[d].next;
+    q->free_count--;
+    return d;
+}
+
+// Returns every descriptor chained after head to the free list
+static void virtio_blk_free_chain(uint16_t head)
+{
+    struct virtio_blk_queue* q = &virtio_blk_queue;
+    bool more = q->desc[head].flags & VIRTQ_DESC_F_NEXT;
+    uint16_t next = q->desc[head].next;
+    q->desc[head].flags = 0;
+    while (more) {
+        uint16_t d = next;
+        more = q->desc[d].flags & VIRTQ_DESC_F_NEXT;
+        next = q->desc[d].next;
+        q->desc[d].flags = 0;
+        q->desc[d].next = q->free_head;
+        q->free_head = d;
+        q->free_count++;
+    }
+}
+
+// Hands finished requests back to their owners. Runs with interrupts off,
+// from the IRQ handler or a polling caller.
+static void virtio_blk_reap()
+{
+    struct virtio_blk_queue* q = &virtio_blk_queue;
+    while (q->last_used != q->used->idx) {
+        uint32_t id = q->used->ring[q->last_used % q->size].id;
+        q->last_used++;
+        if (id >= q->slots || !virtio_blk_slots[id].busy) {
+            continue;
+        }
+
+        struct virtio_blk_slot* slot = &virtio_blk_slots[id];
+        virtio_blk_free_chain(id);
+        int status = RZOS_ALL_OK;
+        if (virtio_blk_cmds[id].status != VIRTIO_BLK_S_OK) {
+            virtio_blk_stats.errors++;
+            status = -EIO;
+        }
+        BLOCK_CALLBACK callback = slot->callback;
+        void* ctx = slot->ctx;
+        slot->busy = false;
+        q->inflight--;
+        if (callback) {
+            callback(status, ctx);
+        }
+    }
+}
+
+static void virtio_blk_poll(struct block_device* dev)
+{
+    uint32_t flags = irq_save();
+    virtio_blk_reap();
+    irq_restore(flags);
+}
+
+static void virtio_blk_irq_handler(registers_t* regs)
+{
+    // Reading the ISR acks the interrupt and lowers the line
+    if (!(insb(virtio_blk_io + VIRTIO_REG_ISR) & VIRTIO_ISR_QUEUE)) {
+        return;
+    }
+    virtio_blk_stats.irqs++;
+    virtio_blk_reap();
+}
+
+// Queues one request: header, one descriptor per physically contiguous run
+// of the segments, status byte. A flush has no segments. Returns -EISTKN
+// while every slot or too many descriptors are taken.
+static int virtio_blk_queue_request(uint32_t type, uint32_t lba, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx)
+{
+    struct virtio_blk_queue* q = &virtio_blk_queue;
+    bool write = type == VIRTIO_BLK_T_OUT;
+
+    uint32_t flags = irq_save();
+    uint16_t head = 0;
+    while (head < q->slots && virtio_blk_slots[head].busy) {
+        head++;
+    }
+    // Every request, a flush included, needs at least the status descriptor
+    if (head == q->slots || q->free_count < 1) {
+        irq_restore(flags);
+        return -EISTKN;
+    }
+
+    struct virtio_blk_cmd* cmd = &virtio_blk_cmds[head];
+    cmd->hdr.type = type;
+    cmd->hdr.reserved = 0;
+    cmd->hdr.sector = lba;
+    cmd->status = 0xFF;
+    uintptr_t cmd_phys = virtio_blk_cmds_phys + head * sizeof(struct virtio_blk_cmd);
+    q->desc[head].addr = cmd_phys;
+    q->desc[head].len = sizeof(struct virtio_blk_req_hdr);
+    q->desc[head].flags = 0;
+
+    // The device writes into our buffers on a read
+    uint16_t data_flags = write ? 0 : VIRTQ_DESC_F_WRITE;
+    uint16_t prev = head;
+    uint32_t sectors = 0;
+    int res = RZOS_ALL_OK;
+    for (uint32_t i = 0; i < nsegs && res == RZOS_ALL_OK; i++) {
+        uintptr_t va = (uintptr_t)segs[i].buf;
+        uint32_t left = segs[i].count * RZOS_SECTOR_SIZE;
+        sectors += segs[i].count;
+        while (left) {
+            uintptr_t pa = virt_to_phys(va);
+            if (pa == (uintptr_t)-1) {
+                res = -EINVARG;
+                break;
+            }
+            uint32_t len = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+            if (len > left) {
+                len = left;
+            }
+            struct virtq_desc* last = &q->desc[prev];
+            if (prev != head && last->addr + last->len == pa) {
+                last->len += len;
+            } else {
+                // Keep one back for the status byte
+                if (q->free_count < 2) {
+                    res = q->inflight ? -EISTKN : -ENOMEM;
+                    break;
+                }
+                uint16_t d = virtio_blk_alloc_desc();
+                q->desc[d].addr = pa;
+                q->desc[d].len = len;
+                q->desc[d].flags = data_flags;
+                last->next = d;
+                last->flags |= VIRTQ_DESC_F_NEXT;
+                prev = d;
+            }
+            va += len;
+            left -= len;
+        }
+    }
+    if (res < 0) {
+        virtio_blk_free_chain(head);
+        irq_restore(flags);
+        return res;
+    }
+
+    uint16_t d = virtio_blk_alloc_desc();
+    q->desc[d].addr = cmd_phys + offsetof(struct virtio_blk_cmd, status);
+    q->desc[d].len = 1;
+    q->desc[d].flags = VIRTQ_DESC_F_WRITE;
+    q->desc[prev].next = d;
+    q->desc[prev].flags |= VIRTQ_DESC_F_NEXT;
+
+    struct virtio_blk_slot* slot = &virtio_blk_slots[head];
+    slot->busy = true;
+    slot->callback = callback;
+    slot->ctx = ctx;
+    q->inflight++;
+    if (q->inflight > virtio_blk_stats.max_inflight) {
+        virtio_blk_stats.max_inflight = q->inflight;
+    }
+
+    q->avail->ring[q->avail->idx % q->size] = head;
+    // The ring entry has to be visible before the index that publishes it
+    __asm__ volatile("" ::: "memory");
+    q->avail->idx++;
+    __asm__ volatile("" ::: "memory");
+    outw(virtio_blk_io + VIRTIO_REG_QUEUE_NOTIFY, 0);
+
+    virtio_blk_stats.requests++;
+    virtio_blk_stats.notifies++;
+    virtio_blk_stats.sectors += sectors;
+    if (write) {
+        virtio_blk_stats.writes++;
+    } else if (type == VIRTIO_BLK_T_FLUSH) {
+        virtio_blk_stats.flushes++;
+    }
+    irq_restore(flags);
+    return RZOS_ALL_OK;
+}
+
+static int virtio_blk_submit(struct block_device* dev, uint32_t lba, bool write, struct block_segment* segs, uint32_t nsegs, BLOCK_CALLBACK callback, void* ctx)
+{
+    if (!virtio_blk_ready || nsegs == 0) {
+        return -EINVARG;
+    }
+    if (write && !virtio_blk_block_device.write) {
+        return -ERDONLY;
+    }
+    return virtio_blk_queue_request(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, lba, segs, nsegs, callback, ctx);
+}
+
+struct virtio_blk_wait {
+    volatile bool done;
+    int status;
+};
+
+static void virtio_blk_transfer_done(int status, void* ctx)
+{
+    struct virtio_blk_wait* wait = ctx;
+    wait->status = status;
+    wait->done = true;
+}
+
+// Blocking request for callers outside the block queue. It polls the used
+// ring rather than sleeping so it also works with interrupts off.
+static int virtio_blk_request_wait(uint32_t type, uint32_t lba, struct block_segment* segs, uint32_t nsegs)
+{
+    struct virtio_blk_wait wait = { .done = false, .status = RZOS_ALL_OK };
+    int res;
+    for (;;) {
+        res = virtio_blk_queue_request(type, lba, segs, nsegs, virtio_blk_transfer_done, &wait);
+        if (res != -EISTKN) {
+            break;
+        }
+        uint32_t flags = irq_save();
+        virtio_blk_reap();
+        irq_restore(flags);
+    }
+    if (res < 0) {
+        return res;
+    }
+    while (!wait.done) {
+        uint32_t flags = irq_save();
+        virtio_blk_reap();
+        irq_restore(flags);
+    }
+    return wait.status;
+}
+
+static int virtio_blk_transfer(uint32_t lba, uint32_t count, void* buf, bool write)
+{
+    if ((uint64_t)lba + count > virtio_blk_block_device.sectors || count == 0) {
+        return -EINVARG;
+    }
+    struct block_segment seg = { .buf = buf, .count = count };
+    return virtio_blk_request_wait(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, lba, &seg, 1);
+}
+
+static int virtio_blk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return virtio_blk_transfer(lba, count, buf, false);
+}
+
+static int virtio_blk_write(struct block_device* dev, uint32_t lba, uint32_t count, void* buf)
+{
+    return virtio_blk_transfer(lba, count, buf, true);
+}
+
+// Only hooked up when the device offers VIRTIO_BLK_F_FLUSH, without it the
+// device has no volatile cache to flush
+static int virtio_blk_flush(struct block_device* dev)
+{
+    if (!virtio_blk_ready) {
+        return -EIO;
+    }
+    return virtio_blk_request_wait(VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+}
+
+// Sets up queue 0 in physically contiguous frames and tells the device where
+static int virtio_blk_setup_queue()
+{
+    struct virtio_blk_queue* q = &virtio_blk_queue;
+    outw(virtio_blk_io + VIRTIO_REG_QUEUE_SELECT, 0);
+    q->size = insw(virtio_blk_io + VIRTIO_REG_QUEUE_SIZE);
+    if (q->size < 4) {
+        return -ENOFOUND;
+    }
+
+    uint32_t avail_end = q->size * sizeof(struct virtq_desc) + sizeof(struct virtq_avail) + (q->size + 1) * sizeof(uint16_t);
+    uint32_t used_start = (avail_end + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+    uint32_t bytes = used_start + sizeof(struct virtq_used) + q->size * sizeof(struct virtq_used_elem) + sizeof(uint16_t);
+    int order = 0;
+    while ((PAGE_SIZE << order) < bytes) {
+        order++;
+    }
+    uintptr_t phys = frame_alloc(order);
+    if (!phys) {
+        return -ENOMEM;
+    }
+    uint8_t* mem = paging_phys_to_virt(phys);
+    memset(mem, 0, PAGE_SIZE << order);
+    q->desc = (struct virtq_desc*)mem;
+    q->avail = (struct virtq_avail*)(mem + q->size * sizeof(struct virtq_desc));
+    q->used = (struct virtq_used*)(mem + used_start);
+
+    // Keep descriptors for at least three full chains per slot
+    q->slots = q->size / 4;
+    if (q->slots > VIRTIO_BLK_MAX_INFLIGHT) {
+        q->slots = VIRTIO_BLK_MAX_INFLIGHT;
+    }
+    q->free_head = q->slots;
+    q->free_count = q->size - q->slots;
+    for (uint16_t i = q->slots; i < q->size; i++) {
+        q->desc[i].next = i + 1;
+    }
+    q->last_used = 0;
+    q->inflight = 0;
+
+    outl(virtio_blk_io + VIRTIO_REG_QUEUE_PFN, phys / PAGE_SIZE);
+    return RZOS_ALL_OK;
+}
+
+static int virtio_blk_probe(struct pci_device* dev)
+{
+    virtio_blk_io = dev->bar[0] & 0xFFFC;
+    pci_enable_bus_master(dev);
+
+    outb(virtio_blk_io + VIRTIO_REG_STATUS, 0);
+    outb(virtio_blk_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(virtio_blk_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // Flush is the only optional feature taken, read-only is only noted
+    uint32_t features = insl(virtio_blk_io + VIRTIO_REG_DEVICE_FEATURES);
+    outl(virtio_blk_io + VIRTIO_REG_GUEST_FEATURES, features & VIRTIO_BLK_F_FLUSH);
+    if (features & VIRTIO_BLK_F_RO) {
+        virtio_blk_block_device.write = NULL;
+    }
+    if (features & VIRTIO_BLK_F_FLUSH) {
+        virtio_blk_block_device.flush = virtio_blk_flush;
+    }
+
+    uint32_t capacity_lo = insl(virtio_blk_io + VIRTIO_REG_BLK_CAPACITY);
+    uint32_t capacity_hi = insl(virtio_blk_io + VIRTIO_REG_BLK_CAPACITY + 4);
+    virtio_blk_block_device.sectors = capacity_hi ? 0xFFFFFFFF : capacity_lo;
+
+    void* page = alloc_page();
+    if (!page) {
+        return -ENOMEM;
+    }
+    virtio_blk_cmds_phys = (uintptr_t)page;
+    virtio_blk_cmds = paging_phys_to_virt(virtio_blk_cmds_phys);
+
+    int res = virtio_blk_setup_queue();
+    if (res < 0) {
+        return res;
+    }
+    virtio_blk_block_device.queue_depth = virtio_blk_queue.slots;
+    // A request alone on the queue can have every free descriptor but the
+    // one its status byte takes
+    virtio_blk_block_device.max_pages = virtio_blk_queue.size - virtio_blk_queue.slots - 1;
+
+    res = irq_register_handler(dev->irq, virtio_blk_irq_handler);
+    if (res < 0) {
+        return res;
+    }
+    irq_unmask(dev->irq);
+    outb(virtio_blk_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    return RZOS_ALL_OK;
+}
+
+int virtio_blk_init()
+{
+    if (pci_device_count() == 0) {
+        pci_init();
+    }
+    struct pci_device* dev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK);
+    if (!dev || !(dev->bar[0] & PCI_BAR_IO) || dev->irq >= IRQ_COUNT) {
+        return -ENOFOUND;
+    }
+
+    int res = virtio_blk_probe(dev);
+    if (res < 0) {
+        outb(virtio_blk_io + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return res;
+    }
+    virtio_blk_ready = true;
+    return block_register(&virtio_blk_block_device);
+}
+
+struct block_device* virtio_blk_device()
+{
+    return virtio_blk_ready ? &virtio_blk_block_device : NULL;
+}
+
+void virtio_blk_print_stats()
+{
+    print_serial("virtio-blk: ");
+    kputdec(virtio_blk_stats.requests);
+    print_serial(" requests, ");
+    kputdec(virtio_blk_stats.writes);
+    print_serial(" writes, ");
+    kputdec(virtio_blk_stats.flushes);
+    print_serial(" flushes, ");
+    kputdec(virtio_blk_stats.sectors);
+    print_serial(" sectors, ");
+    kputdec(virtio_blk_stats.irqs);
+    print_serial(" irqs, ");
+    kputdec(virtio_blk_stats.errors);
+    print_serial(" errors, max in flight ");
+    kputdec(virtio_blk_stats.max_inflight);
+    print_serial("\n");
+}
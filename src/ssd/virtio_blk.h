@@ -0,0 +1,97 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ssd/block.h"
+
+// Transitional virtio-blk, driven through the legacy I/O BAR
+#define VIRTIO_PCI_VENDOR 0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK 0x1001
+
+// Legacy register offsets from BAR0
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_PFN 0x08
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_STATUS 0x12
+#define VIRTIO_REG_ISR 0x13
+// Device config follows, for a block device the capacity comes first
+#define VIRTIO_REG_BLK_CAPACITY 0x14
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_ISR_QUEUE 0x01
+
+#define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK 0
+
+// Split virtqueue, legacy layout: descriptors, then the available ring, then
+// the used ring on the next page boundary
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_ALIGN PAGE_SIZE
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+} __attribute__((packed));
+
+struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+// Requests in flight at once. Descriptor i is the header of slot i, data and
+// status descriptors come from the free list.
+#define VIRTIO_BLK_MAX_INFLIGHT 16
+
+struct virtio_blk_stats {
+    uint32_t requests;
+    uint32_t writes;
+    uint32_t flushes;
+    uint32_t sectors;
+    uint32_t irqs;
+    uint32_t errors;
+    uint32_t notifies;
+    uint32_t max_inflight;
+};
+
+extern struct virtio_blk_stats virtio_blk_stats;
+
+int virtio_blk_init();
+struct block_device* virtio_blk_device();
+void virtio_blk_print_stats();
+
+#endif
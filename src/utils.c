@@ -1,10 +1,13 @@
 // utils.c
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "shell/shell.h"
 #include "utils.h"
 #include "kernel.h"
+#include "io/io.h"
+#include "config.h"
 void int_to_hex(uint32_t n, char* out) {
     const char* hex = "0123456789ABCDEF";
     for (int i = 7; i >= 0; i--) {
@@ -68,3 +71,199 @@ void kputhex(uint32_t x) {
     print_serial(b);
 }
 
+
+void kputdec(uint32_t x) {
+    char b[11];
+    int i = 10;
+    b[i] = '\0';
+    do {
+        b[--i] = '0' + (x % 10);
+        x /= 10;
+    } while (x);
+    print_serial(&b[i]);
+}
+
+// 64-by-32 bit division without pulling in libgcc's __udivdi3
+uint64_t udiv64(uint64_t n, uint32_t d) {
+    uint64_t q = 0;
+    uint64_t r = 0;
+    if (d == 0) {
+        return 0;
+    }
+    for (int i = 63; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= ((uint64_t)1 << i);
+        }
+    }
+    return q;
+}
+
+// PIT input clock is 1193182 Hz, 11932 ticks is 10ms
+#define PIT_CALIBRATE_TICKS 11932
+#define PIT_CALIBRATE_US 10000
+
+uint32_t tsc_mhz = 0;
+
+// Counts TSC cycles while PIT channel 2 runs a 10ms one-shot. Port 0x61 bit 0
+// gates channel 2, bit 5 reads its output, which goes high at terminal count.
+uint32_t tsc_calibrate(void) {
+    uint8_t gate = insb(0x61);
+    outb(0x61, (gate & ~0x02) | 0x01);
+    // Channel 2, lobyte/hibyte, mode 0
+    outb(0x43, 0xB0);
+    outb(0x42, PIT_CALIBRATE_TICKS & 0xFF);
+    outb(0x42, PIT_CALIBRATE_TICKS >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(insb(0x61) & 0x20)) {
+    }
+    uint64_t cycles = rdtsc() - start;
+    outb(0x61, gate);
+
+    tsc_mhz = (uint32_t)udiv64(cycles, PIT_CALIBRATE_US);
+    if (tsc_mhz == 0) {
+        tsc_mhz = 1;
+    }
+    return tsc_mhz;
+}
+
+uint64_t tsc_cycles_to_us(uint64_t cycles) {
+    return udiv64(cycles, tsc_mhz ? tsc_mhz : 1);
+}
+
+struct prof_span {
+    const char* name;
+    uint64_t start;
+    uint64_t cycles;
+    uint32_t depth;
+    bool open;
+};
+
+static struct prof_span prof_spans[RZOS_PROF_MAX_SPANS];
+static uint32_t prof_count = 0;
+static uint32_t prof_dropped = 0;
+// Indices of the spans still open, innermost last
+static uint32_t prof_stack[RZOS_PROF_MAX_DEPTH];
+static uint32_t prof_depth = 0;
+
+static bool prof_name_is(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+void prof_begin(const char* name) {
+    if (prof_count == RZOS_PROF_MAX_SPANS || prof_depth == RZOS_PROF_MAX_DEPTH) {
+        prof_dropped++;
+        return;
+    }
+    struct prof_span* span = &prof_spans[prof_count];
+    span->name = name;
+    span->depth = prof_depth;
+    span->open = true;
+    prof_stack[prof_depth++] = prof_count++;
+    span->start = rdtsc();
+}
+
+// Closes the innermost open span called name, and any left open inside it
+void prof_end(const char* name) {
+    uint64_t now = rdtsc();
+    for (uint32_t i = prof_depth; i > 0; i--) {
+        if (!prof_name_is(prof_spans[prof_stack[i - 1]].name, name)) {
+            continue;
+        }
+        while (prof_depth >= i) {
+            struct prof_span* span = &prof_spans[prof_stack[--prof_depth]];
+            span->cycles = now - span->start;
+            span->open = false;
+        }
+        return;
+    }
+}
+
+static uint32_t prof_digits(uint32_t x) {
+    uint32_t n = 1;
+    while (x >= 10) {
+        x /= 10;
+        n++;
+    }
+    return n;
+}
+
+static void prof_pad(uint32_t n) {
+    while (n--) {
+        print_serial(" ");
+    }
+}
+
+static void prof_put_column(uint32_t x, uint32_t width) {
+    uint32_t digits = prof_digits(x);
+    prof_pad(digits < width ? width - digits : 1);
+    kputdec(x);
+}
+
+#define PROF_NAME_WIDTH 28
+
+// One line per span in start order, nested spans indented under their parent.
+// The share is of the time from the first span's start to the last one's end.
+void prof_print() {
+    if (prof_count == 0) {
+        return;
+    }
+    uint64_t first = prof_spans[0].start;
+    uint64_t last = first;
+    for (uint32_t i = 0; i < prof_count; i++) {
+        if (!prof_spans[i].open && prof_spans[i].start + prof_spans[i].cycles > last) {
+            last = prof_spans[i].start + prof_spans[i].cycles;
+        }
+    }
+    uint32_t total_us = (uint32_t)tsc_cycles_to_us(last - first);
+
+    print_serial("Boot profile, TSC at ");
+    kputdec(tsc_mhz);
+    print_serial(" MHz\n  span");
+    prof_pad(PROF_NAME_WIDTH - 4);
+    print_serial("      cycles        us  share\n");
+    for (uint32_t i = 0; i < prof_count; i++) {
+        struct prof_span* span = &prof_spans[i];
+        uint32_t len = 2 * span->depth;
+        prof_pad(2 + len);
+        print_serial(span->name);
+        const char* c = span->name;
+        while (*c++) {
+            len++;
+        }
+        prof_pad(len < PROF_NAME_WIDTH ? PROF_NAME_WIDTH - len : 1);
+        if (span->open) {
+            print_serial("        open\n");
+            continue;
+        }
+        // Cycle counts over 4G are printed in thousands
+        if (span->cycles >> 32) {
+            prof_put_column((uint32_t)udiv64(span->cycles, 1000), 11);
+            print_serial("k");
+        } else {
+            prof_put_column((uint32_t)span->cycles, 12);
+        }
+        uint32_t us = (uint32_t)tsc_cycles_to_us(span->cycles);
+        prof_put_column(us, 10);
+        uint32_t tenths = total_us ? (uint32_t)udiv64((uint64_t)us * 1000, total_us) : 0;
+        prof_put_column(tenths / 10, 5);
+        print_serial(".");
+        kputdec(tenths % 10);
+        print_serial("%\n");
+    }
+    print_serial("  total");
+    prof_pad(PROF_NAME_WIDTH - 5 + 12);
+    prof_put_column(total_us, 10);
+    print_serial("\n");
+    if (prof_dropped) {
+        print_serial("  spans dropped: ");
+        kputdec(prof_dropped);
+        print_serial("\n");
+    }
+}
@@ -7,4 +7,26 @@ void int_to_hex(uint32_t n, char *out);
 void kputhex(uint32_t x);
 void kputs(const char* s);
 void itoa(int value, char* str, int base);
+void kputdec(uint32_t x);
+uint64_t udiv64(uint64_t n, uint32_t d);
+
+// Read the CPU time-stamp counter
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+// TSC rate, measured against the PIT by tsc_calibrate
+extern uint32_t tsc_mhz;
+uint32_t tsc_calibrate(void);
+uint64_t tsc_cycles_to_us(uint64_t cycles);
+
+// Boot-phase profiler. prof_begin and prof_end bracket a named span, spans
+// nest and are kept in start order in a static buffer. Cycles are recorded
+// raw, so spans may start before tsc_calibrate. prof_print dumps the table
+// over serial.
+void prof_begin(const char* name);
+void prof_end(const char* name);
+void prof_print();
 #endif